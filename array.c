@@ -3,12 +3,15 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include "golf.h"
 
 #define ARRAY_INIT_SIZE 8
 
 Array new_array() {
-  Array arr = {malloc(ARRAY_INIT_SIZE * sizeof(Item)), 0, ARRAY_INIT_SIZE};
+  Array arr = {
+    region_malloc(ARRAY_INIT_SIZE * sizeof(Item)), 0, ARRAY_INIT_SIZE, 0
+  };
   if (arr.items == NULL) {
     error("Unable to allocate space for new array!");
   }
@@ -19,7 +22,22 @@ void free_array(Array *array) {
   for (uint32_t i = 0; i < array->length; i++) {
     free_item(&array->items[i]);
   }
-  free(array->items);
+  free_array_buffer(array);
+}
+
+// Frees the space an array's elements are kept in, but not the elements
+void free_array_buffer(Array *array) {
+  region_free(array->items - array->start);
+}
+
+// Moves an array's elements back to the start of its allocation, reclaiming
+// the space left by elements removed from the front
+static void array_compact(Array *array) {
+  Item *buffer = array->items - array->start;
+  memmove(buffer, array->items, sizeof(Item) * array->length);
+  array->items = buffer;
+  array->allocated += array->start;
+  array->start = 0;
 }
 
 // Converts a string into an array of integers
@@ -31,10 +49,29 @@ Array array_from_string(const String *str) {
   return int_array;
 }
 
+// Makes sure the array has space for at least min_allocated items
+void array_reserve(Array *arr, uint32_t min_allocated) {
+  if (min_allocated > arr->allocated && arr->start > 0) {
+    array_compact(arr);
+  }
+  if (min_allocated > arr->allocated) {
+    while (min_allocated > arr->allocated) {
+      arr->allocated <<= 1;
+    }
+    arr->items = region_realloc(arr->items, sizeof(Item) * arr->allocated);
+    if (arr->items == NULL) {
+      error("Unable to allocate additional space for array!");
+    }
+  }
+}
+
 void array_push(Array *arr, Item item) {
+  if (arr->length >= arr->allocated && arr->start > 0) {
+    array_compact(arr);
+  }
   if (arr->length >= arr->allocated) {
     arr->allocated <<= 1;
-    arr->items = realloc(arr->items, sizeof(Item) * arr->allocated);
+    arr->items = region_realloc(arr->items, sizeof(Item) * arr->allocated);
     if (arr->items == NULL) {
       error("Unable to allocate additional space for array!");
     }
@@ -44,7 +81,7 @@ void array_push(Array *arr, Item item) {
 
 // Removes a number of elements from the array's front
 void array_remove_from_front(Array *array, Bigint to_remove) {
-  if (to_remove.is_negative || bigint_is_zero(&to_remove))
+  if (bigint_is_negative(&to_remove) || bigint_is_zero(&to_remove))
     return;
 
   uint32_t to_remove_int;
@@ -56,12 +93,16 @@ void array_remove_from_front(Array *array, Bigint to_remove) {
   for (uint32_t i = 0; i < to_remove_int; i++) {
     free_item(&array->items[i]);
   }
+  array_drop_front(array, to_remove_int);
+}
 
-  array->length -= to_remove_int;
-
-  for (uint32_t i = 0; i < array->length; i++) {
-    array->items[i] = array->items[i + to_remove_int];
-  }
+// Forgets the first elements of an array without freeing them, which takes
+// constant time since the rest stay where they are
+void array_drop_front(Array *array, uint32_t to_drop) {
+  array->items += to_drop;
+  array->start += to_drop;
+  array->allocated -= to_drop;
+  array->length -= to_drop;
 }
 
 // Returns the index of an element, or -1 if it's not present in the array
@@ -82,9 +123,47 @@ void array_reverse(Array *array) {
   }
 }
 
+// Joins an array of strings with a string between each, working out the
+// length first so the characters are only copied once. Returns false if the
+// array has anything but strings in it
+static bool join_strings(const Array *array, const String *sep, Item *joined) {
+  uint64_t total_len = 0;
+  for (uint32_t i = 0; i < array->length; i++) {
+    if (array->items[i].type != TYPE_STRING) {
+      return false;
+    }
+    total_len += array->items[i].str_val->length;
+  }
+  if (array->length > 0) {
+    total_len += (uint64_t) sep->length * (array->length - 1);
+  }
+  if (total_len > UINT32_MAX) {
+    error("Unable to allocate space for string!");
+  }
+
+  *joined = empty_string();
+  String *str = joined->str_val;
+  string_reserve(str, total_len);
+  for (uint32_t i = 0; i < array->length; i++) {
+    const String *to_add = array->items[i].str_val;
+    memcpy(str->str_data + str->length, to_add->str_data, to_add->length);
+    str->length += to_add->length;
+    if (i + 1 < array->length) {
+      memcpy(str->str_data + str->length, sep->str_data, sep->length);
+      str->length += sep->length;
+    }
+  }
+  return true;
+}
+
 // Joins an array's elements with a string or array in between each element
 Item join_array(Array *array, const Item *sep) {
   Item joined_array;
+  if (sep->type == TYPE_STRING &&
+      join_strings(array, sep->str_val, &joined_array))
+  {
+    return joined_array;
+  }
 
   if (sep->type == TYPE_ARRAY)
     joined_array = make_array();
@@ -107,34 +186,46 @@ Item join_array(Array *array, const Item *sep) {
 
 void map_array(Array *array, Item *block) {
   Array mapped_array = new_array();
+  Code *code = get_code(block->str_val);
   for (uint32_t i = 0; i < array->length; i++) {
     uint32_t start_stack_size = stack.length;
     stack_push(array->items[i]);
-    execute_string(&block->str_val);
+    execute_code(code);
     for (uint32_t j = start_stack_size; j < stack.length; j++) {
+      item_expand(&stack.items[j]);
       array_push(&mapped_array, stack.items[j]);
     }
     stack.length = min(stack.length, start_stack_size);
   }
-  free(array->items);
+  release_code(code);
+  free_array_buffer(array);
   *array = mapped_array;
 }
 
 void fold_array(Array *array, Item *block) {
+  if (native_fold_array(array, block)) {
+    return;
+  }
   if (array->length > 0) {
     stack_push(make_copy(&array->items[0]));
+    Code *code = get_code(block->str_val);
     for (uint32_t i = 1; i < array->length; i++) {
       stack_push(make_copy(&array->items[i]));
-      execute_string(&block->str_val);
+      execute_code(code);
     }
+    release_code(code);
   }
 }
 
 void filter_array(Array *array, Item *block) {
+  if (parallel_filter_array(array, block)) {
+    return;
+  }
   uint32_t items_removed = 0;
+  Code *code = get_code(block->str_val);
   for (uint32_t i = 0; i < array->length; i++) {
     stack_push(make_copy(&array->items[i]));
-    execute_string(&block->str_val);
+    execute_code(code);
     Item mapped_item = stack_pop();
     if (item_boolean(&mapped_item)) {
       array->items[i - items_removed] = array->items[i];
@@ -145,6 +236,7 @@ void filter_array(Array *array, Item *block) {
     }
     free_item(&mapped_item);
   }
+  release_code(code);
   array->length -= items_removed;
 }
 
@@ -153,7 +245,7 @@ void array_remove_empty_strings(Array *array) {
   uint32_t removed_elements = 0;
   for (uint32_t i = 0; i < array->length; i++) {
     if (array->items[i].type == TYPE_STRING &&
-        array->items[i].str_val.length == 0)
+        array->items[i].str_val->length == 0)
     {
       free_item(&array->items[i]);
       removed_elements++;
@@ -169,8 +261,10 @@ void array_remove_empty_strings(Array *array) {
 void array_remove_empty_arrays(Array *array) {
   uint32_t removed_elements = 0;
   for (uint32_t i = 0; i < array->length; i++) {
-    if (array->items[i].type == TYPE_ARRAY &&
-        array->items[i].arr_val.length == 0)
+    if ((array->items[i].type == TYPE_ARRAY &&
+         array->items[i].arr_val->length == 0) ||
+        (array->items[i].type == TYPE_PACKED &&
+         array->items[i].packed_val->length == 0))
     {
       free_item(&array->items[i]);
       removed_elements++;
@@ -183,23 +277,25 @@ void array_remove_empty_arrays(Array *array) {
 }
 
 void array_multiply(Array *array, Bigint factor) {
-  if (factor.is_negative) {
+  if (bigint_is_negative(&factor)) {
     error("Cannot multiply array by a negative argument!");
   }
   if (!bigint_fits_in_uint32(&factor)) {
     error("Factor too large to multiply array by!");
   }
   uint32_t to_multiply_by = bigint_to_uint32(&factor);
-  uint64_t new_len = array->length * to_multiply_by;
-  if (new_len > array->allocated) {
-    while (new_len > array->allocated) {
-      array->allocated <<= 1;
-    }
-    array->items = realloc(array->items, sizeof(Item) * array->allocated);
-    if (array->items == NULL) {
-      error("Unable to allocate additional space for array!");
+  if (to_multiply_by == 0) {
+    for (uint32_t i = 0; i < array->length; i++) {
+      free_item(&array->items[i]);
     }
+    array->length = 0;
+    return;
   }
+  uint64_t new_len = (uint64_t) array->length * to_multiply_by;
+  if (new_len > UINT32_MAX) {
+    error("Factor too large to multiply array by!");
+  }
+  array_reserve(array, new_len);
   uint32_t cur_len = array->length;
   while (--to_multiply_by > 0) {
     for (uint32_t i = 0; i < array->length; i++) {
@@ -245,6 +341,7 @@ void array_split(Array *array, const Array *sep) {
       }
     }
     if (matched_sep) {
+      item_pack(&cur_array);
       array_push(&split_array, cur_array);
       cur_array = make_array();
       for (uint32_t j = 0; j < sep->length; j++) {
@@ -253,14 +350,15 @@ void array_split(Array *array, const Array *sep) {
       i += sep->length - 1;
     }
     else {
-      array_push(&cur_array.arr_val, array->items[i]);
+      array_push(cur_array.arr_val, array->items[i]);
     }
   }
   while (i < array->length) {
-    array_push(&cur_array.arr_val, array->items[i++]);
+    array_push(cur_array.arr_val, array->items[i++]);
   }
+  item_pack(&cur_array);
   array_push(&split_array, cur_array);
-  free(array->items);
+  free_array_buffer(array);
   *array = split_array;
 }
 
@@ -268,9 +366,8 @@ void array_split_into_groups(Array *array, Bigint group_len) {
   Array split_array = new_array();
   Item cur_array = make_array();
 
-  if (group_len.is_negative) {
+  if (bigint_is_negative(&group_len)) {
     array_reverse(array);
-    group_len.is_negative = false;
   }
   else if (bigint_is_zero(&group_len)) {
     error("Cannot split into groups of size 0!");
@@ -280,23 +377,25 @@ void array_split_into_groups(Array *array, Bigint group_len) {
   if (!bigint_fits_in_uint32(&group_len))
     group_size = UINT32_MAX;
   else
-    group_size = bigint_to_uint32(&group_len);
+    group_size = bigint_digit(&group_len, 0);
 
   for (uint32_t i = 0; i < array->length; i++) {
-    array_push(&cur_array.arr_val, array->items[i]);
-    if (cur_array.arr_val.length == group_size) {
+    array_push(cur_array.arr_val, array->items[i]);
+    if (cur_array.arr_val->length == group_size) {
+      item_pack(&cur_array);
       array_push(&split_array, cur_array);
       cur_array = make_array();
     }
   }
-  if (cur_array.arr_val.length > 0) {
+  if (cur_array.arr_val->length > 0) {
+    item_pack(&cur_array);
     array_push(&split_array, cur_array);
   }
   else {
     free_item(&cur_array);
   }
 
-  free(array->items);
+  free_array_buffer(array);
   *array = split_array;
 }
 
@@ -304,16 +403,15 @@ void array_step_over(Array *array, Bigint step_size) {
   if (bigint_is_zero(&step_size)) {
     error("Cannot select elements with 0 step size!");
   }
-  else if (step_size.is_negative) {
+  else if (bigint_is_negative(&step_size)) {
     array_reverse(array);
-    step_size.is_negative = false;
   }
   uint32_t step_len;
   if (!bigint_fits_in_uint32(&step_size)) {
     step_len = UINT32_MAX;
   }
   else {
-    step_len = bigint_to_uint32(&step_size);
+    step_len = bigint_digit(&step_size, 0);
   }
 
   if (step_len > 1) {
@@ -394,7 +492,7 @@ void array_sort(Array *array) {
   }
 
   free(indexes);
-  free(array->items);
+  free_array_buffer(array);
   *array = temp;
 }
 
@@ -409,7 +507,7 @@ void array_sort_by_mapping(Array *array, const Array *mapped_array) {
   }
 
   free(indexes);
-  free(array->items);
+  free_array_buffer(array);
   *array = temp;
 }
 
@@ -424,7 +522,7 @@ void string_sort_by_mapping(String *str, const Array *mapped_str) {
   }
 
   free(indexes);
-  free(str->str_data);
+  free_string(str);
   *str = sorted_str;
 }
 
@@ -482,6 +580,9 @@ void array_or(Array *array, const Array *to_or) {
 void array_xor(Array *array, const Array *to_xor) {
   Set first_set  = new_set();
   Set second_set = new_set();
+  // Elements that are dropped may still be in first_set, so they're only
+  // freed once it's gone
+  Array dropped = new_array();
   for (uint32_t i = 0; i < to_xor->length; i++) {
     set_add(&second_set, &to_xor->items[i]);
   }
@@ -496,7 +597,7 @@ void array_xor(Array *array, const Array *to_xor) {
         continue;
       }
     }
-    free_item(&array->items[i]);
+    array_push(&dropped, array->items[i]);
     items_removed++;
   }
   array->length -= items_removed;
@@ -511,4 +612,5 @@ void array_xor(Array *array, const Array *to_xor) {
 
   free_set(&first_set);
   free_set(&second_set);
+  free_array(&dropped);
 }
@@ -0,0 +1,7 @@
+;
+
+# Times the $ operator sorting arrays of integers, strings and arrays
+
+1000000,{7919*1000003%}%$-1=p
+300000,{7919*1000003%`}%$-1=p
+200000,{7919*1000003%.3%\[]+}%$-1=p
@@ -0,0 +1,7 @@
+# Times tight loops over small integers, where most of the time goes into
+# getting from each instruction to its builtin
+
+1 3000000{.3%+)}*p
+1 3000000{.7%\2/+}*p
+0 1 3000000{\.@+7%}*p;
+0 3000000{.5<+(}*p
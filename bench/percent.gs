@@ -0,0 +1,8 @@
+;
+
+# Times the % operator mapping blocks over arrays of integers, strings and
+# arrays, where most of the time goes into moving items around
+
+2000000,{..*\3%+}%{+}*p
+200000,{`}%{1>}%,p
+300000,{[.]}%{~)}%{+}*p
@@ -0,0 +1,6 @@
+;
+
+# Times zip transposing arrays of arrays and of strings
+
+2500,{;2500,}%zip zip,p
+5000,{;"abcdefghij"200*}%zip,p
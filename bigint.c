@@ -3,150 +3,324 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include "golf.h"
 
-// Returns a new bigint, initialized to zero
-Bigint new_bigint() {
-  Bigint num = {calloc(1, sizeof(uint64_t)), 1, 1, false};
+// The range of integers that are kept inside a bigint itself
+#define SMALL_MIN (-(INT64_C(1) << 62))
+#define SMALL_MAX ((INT64_C(1) << 62) - 1)
+
+// The digits of a bigint too big to be kept inside it, least significant
+// first. A single digit is kept inline rather than allocated, which is marked
+// by having none allocated. Bigints are worked on in this form, and only kept
+// in it once they don't fit in a small one
+typedef struct Digits {
+  union {
+    uint64_t *digits;
+    uint64_t digit;
+  };
+  uint32_t length, allocated;
+  bool is_negative;
+} Digits;
+
+#define digits_of(num) \
+  ((num)->allocated == 0 ? &(num)->digit : (num)->digits)
+
+static inline bool is_small(const Bigint *num) {
+  return num->small & 1;
+}
+
+static inline int64_t small_value(const Bigint *num) {
+  return num->small >> 1;
+}
+
+static inline Bigint make_small(int64_t val) {
+  Bigint num = {.small = val * 2 + 1};
   return num;
 }
 
-void free_bigint(Bigint *num) {
-  free(num->digits);
+static inline uint64_t magnitude(int64_t val) {
+  return val < 0 ? 0 - (uint64_t) val : (uint64_t) val;
 }
 
-// Returns a new bigint, all digits initially set to zero, but with a certain
-// pre-set length
-Bigint bigint_with_digits(uint32_t num_digits) {
+// Boxes of digits, and arrays of up to FREE_LIST_DIGITS digits, are put on
+// lists of their own once they're freed, and used again before anything more
+// is allocated. A worker thread frees them, since its lists would be lost
+#define FREE_LIST_DIGITS 64
+#define FREE_LIST_LENGTH 256
+#define FREE_LIST_SIZES 6  // For arrays of 2, 4, ..., 64 digits
+
+// Something on a free list, which is linked through its own memory
+typedef struct FreeBlock {
+  struct FreeBlock *next;
+} FreeBlock;
+
+typedef struct FreeList {
+  FreeBlock *first;
+  uint32_t length;
+} FreeList;
+
+static _Thread_local FreeList free_boxes;
+static _Thread_local FreeList free_arrays[FREE_LIST_SIZES];
+
+// Returns the free list for arrays with a certain number of digits allocated,
+// or NULL if they're too big to go on one
+static inline FreeList *array_list(uint32_t allocated) {
+  if (allocated > FREE_LIST_DIGITS) {
+    return NULL;
+  }
+  int size = 0;
+  while (allocated > 2u << size) {
+    size++;
+  }
+  return &free_arrays[size];
+}
+
+// Allocates something from a free list if there's anything on it, and from
+// the region or the heap otherwise
+static inline void *list_malloc(FreeList *list, size_t size) {
+  if (list == NULL || list->first == NULL || region_in_use()) {
+    return region_malloc(size);
+  }
+  FreeBlock *block = list->first;
+  list->first = block->next;
+  list->length--;
+  return block;
+}
+
+static inline void list_free(FreeList *list, void *ptr) {
+  if (list == NULL || list->length == FREE_LIST_LENGTH || is_worker_thread ||
+      in_region(ptr))
+  {
+    region_free(ptr);
+    return;
+  }
+  FreeBlock *block = ptr;
+  block->next = list->first;
+  list->first = block;
+  list->length++;
+}
+
+// Allocates space for a certain number of digits, which is a power of two
+static inline uint64_t *allocate_digits(uint32_t allocated) {
+  uint64_t *digits = list_malloc(array_list(allocated),
+                                 sizeof(uint64_t) * allocated);
+  if (digits == NULL) {
+    error("Unable to allocate space for integer!");
+  }
+  return digits;
+}
+
+// Returns zero in the form bigints are worked on in
+static Digits new_digits() {
+  Digits num = {.digit = 0, .length = 1, .allocated = 0, .is_negative = false};
+  return num;
+}
+
+static void free_digits(Digits *num) {
+  if (num->allocated > 0) {
+    list_free(array_list(num->allocated), num->digits);
+  }
+}
+
+// Returns digits that are all zero, with a certain length
+static Digits digits_with_length(uint32_t num_digits) {
+  if (num_digits <= 1) {
+    return new_digits();
+  }
   uint32_t to_allocate = 1;
   while (num_digits > to_allocate) {
     to_allocate <<= 1;
   }
-  Bigint num = {
-    .digits = calloc(to_allocate, sizeof(uint64_t)),
+  Digits num = {
+    .digits = allocate_digits(to_allocate),
     .length = num_digits,
     .allocated = to_allocate,
     .is_negative = false
   };
+  memset(num.digits, 0, sizeof(uint64_t) * to_allocate);
   return num;
 }
 
-Bigint bigint_from_int64(int64_t int_val) {
-  Bigint num = new_bigint();
-  if (int_val < 0) {
-    int_val *= -1;
-    num.is_negative = true;
+static Digits copy_digits(const Digits *to_copy) {
+  Digits new_num = digits_with_length(to_copy->length);
+  for (uint32_t i = 0; i < to_copy->length; i++) {
+    digits_of(&new_num)[i] = digits_of(to_copy)[i];
   }
-  num.digits[0] = int_val;
-  return num;
+  new_num.is_negative = to_copy->is_negative;
+  return new_num;
 }
 
-Bigint bigint_from_uint64(uint64_t int_val) {
-  Bigint num = new_bigint();
-  num.digits[0] = int_val;
-  return num;
+static inline bool digits_are_zero(const Digits *num) {
+  return num->length == 1 && digits_of(num)[0] == 0;
 }
 
-Bigint bigint_from_string(const String *str) {
-  Bigint result = new_bigint();
-  Bigint ten = bigint_from_int64(10);
-
-  uint32_t start = (str->str_data[0] == '-' ? 1: 0);
-  for (uint32_t i = start; i < str->length; i++) {
-    Bigint digit = bigint_from_int64(str->str_data[i] - '0');
-    Bigint result_temp = bigint_multiply(&result, &ten);
+// Returns the digits of a bigint, which are only valid for as long as the
+// bigint is, and mustn't be changed or freed
+static inline Digits view(const Bigint *num) {
+  if (is_small(num)) {
+    int64_t val = small_value(num);
+    Digits digits = {
+      .digit = magnitude(val), .length = 1, .allocated = 0,
+      .is_negative = val < 0
+    };
+    return digits;
+  }
+  return *num->big;
+}
 
-    free_bigint(&result);
-    bigint_add(&result_temp, &digit);
-    result = result_temp;
-    free_bigint(&digit);
+// Takes the digits of a bigint, which is left with nothing to free
+static inline Digits take(Bigint *num) {
+  if (is_small(num)) {
+    return view(num);
   }
+  Digits digits = *num->big;
+  list_free(&free_boxes, num->big);
+  *num = make_small(0);
+  return digits;
+}
 
-  if (str->str_data[0] == '-' && !bigint_is_zero(&result)) {
-    result.is_negative = true;
+// Turns digits with no leading zeros back into a bigint, keeping them inside
+// it if they fit
+static Bigint pack(Digits digits) {
+  if (digits.length == 1) {
+    uint64_t digit = digits_of(&digits)[0];
+    if (!digits.is_negative && digit <= (uint64_t) SMALL_MAX) {
+      free_digits(&digits);
+      return make_small(digit);
+    }
+    else if (digits.is_negative && digit <= magnitude(SMALL_MIN)) {
+      free_digits(&digits);
+      return make_small(-(int64_t) digit);
+    }
   }
+  Bigint num = {.big = list_malloc(&free_boxes, sizeof(Digits))};
+  if (num.big == NULL) {
+    error("Unable to allocate space for integer!");
+  }
+  *num.big = digits;
+  return num;
+}
 
-  free_bigint(&ten);
+// Makes a bigint from the magnitude and the sign of an integer
+static Bigint bigint_from_magnitude(uint64_t magnitude, bool is_negative) {
+  Digits digits = new_digits();
+  digits.digit = magnitude;
+  digits.is_negative = is_negative && magnitude != 0;
+  return pack(digits);
+}
 
-  return result;
+// Returns a new bigint, initialized to zero
+Bigint new_bigint() {
+  return make_small(0);
 }
 
-String bigint_to_string(const Bigint *num) {
-  String num_str = new_string();
-  if (bigint_is_zero(num)) {
-    string_add_char(&num_str, '0');
-    return num_str;
+void free_bigint(Bigint *num) {
+  if (!is_small(num)) {
+    free_digits(num->big);
+    list_free(&free_boxes, num->big);
   }
-  else {
-    Bigint num_copy = copy_bigint(num);
-    Bigint ten_quintillion = bigint_from_uint64(10000000000000000000ULL);
-
-    while (!bigint_is_zero(&num_copy)) {
-      Bigint remainder, quotient;
-      bigint_divmod(&num_copy, &ten_quintillion, &quotient, &remainder);
-      for (uint32_t i = 0; i < 19; i++) {
-        if (remainder.digits[0] != 0 || !bigint_is_zero(&quotient)) {
-          string_add_char(&num_str, (remainder.digits[0] % 10) + '0');
-          remainder.digits[0] /= 10;
-        }
-      }
-      free_bigint(&remainder);
-      free_bigint(&num_copy);
-      num_copy = quotient;
-    }
+}
 
-    if (num->is_negative) {
-      string_add_char(&num_str, '-');
-    }
-    string_reverse(&num_str);
+Bigint bigint_from_int64(int64_t int_val) {
+  if (int_val >= SMALL_MIN && int_val <= SMALL_MAX) {
+    return make_small(int_val);
+  }
+  return bigint_from_magnitude(magnitude(int_val), int_val < 0);
+}
 
-    free_bigint(&num_copy);
-    free_bigint(&ten_quintillion);
+Bigint bigint_from_uint64(uint64_t int_val) {
+  return bigint_from_magnitude(int_val, false);
+}
 
-    return num_str;
+// Makes a bigint from its digits, least significant first
+Bigint bigint_from_digits(const uint64_t *digits, uint32_t length,
+                          bool is_negative)
+{
+  while (length > 1 && digits[length - 1] == 0) {
+    length--;
+  }
+  if (length == 0) {
+    return new_bigint();
+  }
+  Digits num = digits_with_length(length);
+  for (uint32_t i = 0; i < length; i++) {
+    digits_of(&num)[i] = digits[i];
   }
+  num.is_negative = is_negative && !digits_are_zero(&num);
+  return pack(num);
 }
 
-bool bigint_fits_in_uint32(const Bigint *num) {
-  return num->length == 1 && num->digits[0] < (1ULL << 32);
+// The number of digits a bigint has
+uint32_t bigint_length(const Bigint *num) {
+  return is_small(num) ? 1 : num->big->length;
 }
 
-uint32_t bigint_to_uint32(const Bigint *num) {
-  assert(bigint_fits_in_uint32(num));
-  assert(!num->is_negative);
+// One of the digits of a bigint's absolute value, least significant first
+uint64_t bigint_digit(const Bigint *num, uint32_t index) {
+  if (is_small(num)) {
+    return magnitude(small_value(num));
+  }
+  return digits_of(num->big)[index];
+}
 
-  return num->digits[0];
+bool bigint_is_negative(const Bigint *num) {
+  return is_small(num) ? small_value(num) < 0 : num->big->is_negative;
 }
 
-Bigint copy_bigint(const Bigint *to_copy) {
-  Bigint new_num = bigint_with_digits(to_copy->length);
-  for (uint32_t i = 0; i < to_copy->length; i++) {
-    new_num.digits[i] = to_copy->digits[i];
+// Changes the sign of a bigint
+void bigint_negate(Bigint *num) {
+  if (is_small(num) && small_value(num) != SMALL_MIN) {
+    *num = make_small(-small_value(num));
+  }
+  else {
+    Digits digits = take(num);
+    digits.is_negative = !digits.is_negative && !digits_are_zero(&digits);
+    *num = pack(digits);
   }
-  new_num.is_negative = to_copy->is_negative;
-  return new_num;
 }
 
-bool bigint_is_zero(const Bigint *num) {
-  return num->length == 1 && num->digits[0] == 0;
+// Makes a bigint positive
+void bigint_abs(Bigint *num) {
+  if (bigint_is_negative(num)) {
+    bigint_negate(num);
+  }
 }
 
 // Adds a digit to the front of a bigint, initializing the digit to zero, and
 // allocating additional memory for the number if need be
-static inline void bigint_add_digit(Bigint *num) {
-  if (num->length == num->allocated) {
+static inline void add_digit(Digits *num) {
+  if (num->allocated == 0) {
+    uint64_t digit = num->digit;
+    num->digits = allocate_digits(2);
+    num->digits[0] = digit;
+    num->allocated = 2;
+  }
+  else if (num->length == num->allocated) {
+    if (num->allocated < FREE_LIST_DIGITS) {
+      uint64_t *digits = allocate_digits(num->allocated << 1);
+      memcpy(digits, num->digits, sizeof(uint64_t) * num->length);
+      free_digits(num);
+      num->digits = digits;
+    }
+    else {
+      num->digits = region_realloc(num->digits,
+                                   sizeof(uint64_t) * num->allocated * 2);
+      if (num->digits == NULL) {
+        error("Unable to allocate space for integer!");
+      }
+    }
     num->allocated <<= 1;
-    num->digits = realloc(num->digits, sizeof(uint64_t) * num->allocated);
   }
-  num->digits[num->length] = 0;
+  digits_of(num)[num->length] = 0;
   num->length++;
 }
 
 // Removes all the zeros from the front of a bigint, and corrects a bigint
 // if it's "negative zero"
-static inline void bigint_remove_leading_zeros(Bigint *num) {
+static inline void remove_leading_zeros(Digits *num) {
   for (uint32_t i = num->length - 1; i > 0; i--) {
-    if (num->digits[i] != 0) {
+    if (digits_of(num)[i] != 0) {
       return;
     }
     else {
@@ -154,70 +328,70 @@ static inline void bigint_remove_leading_zeros(Bigint *num) {
     }
   }
   // Correct negative zero
-  if (num->digits[0] == 0)
+  if (digits_of(num)[0] == 0)
     num->is_negative = false;
 }
 
-static inline void bigint_do_increment(Bigint *num) {
+static inline void do_increment(Digits *num) {
   bool carry = true;
   for (uint32_t i = 0; carry && i < num->length; i++) {
-    num->digits[i]++;
-    carry = (num->digits[i] == 0);
+    digits_of(num)[i]++;
+    carry = (digits_of(num)[i] == 0);
   }
   if (carry) {
-    bigint_add_digit(num);
-    num->digits[num->length - 1] = 1;
+    add_digit(num);
+    digits_of(num)[num->length - 1] = 1;
   }
 }
 
-static inline void bigint_do_decrement(Bigint *num) {
-  if (bigint_is_zero(num)) {
-    num->digits[0] = 1;
+static inline void do_decrement(Digits *num) {
+  if (digits_are_zero(num)) {
+    digits_of(num)[0] = 1;
     num->is_negative = !num->is_negative;
   }
   else {
     bool borrow = true;
     for (uint32_t i = 0; borrow && i < num->length; i++) {
-      borrow = (num->digits[i] == 0);
-      num->digits[i]--;
+      borrow = (digits_of(num)[i] == 0);
+      digits_of(num)[i]--;
     }
-    bigint_remove_leading_zeros(num);
+    remove_leading_zeros(num);
   }
 }
 
-void bigint_increment(Bigint *num) {
+static void increment_digits(Digits *num) {
   if (num->is_negative) {
-    bigint_do_decrement(num);
+    do_decrement(num);
   }
   else {
-    bigint_do_increment(num);
+    do_increment(num);
   }
 }
 
-void bigint_decrement(Bigint *num) {
+static void decrement_digits(Digits *num) {
   if (num->is_negative) {
-    bigint_do_increment(num);
+    do_increment(num);
   }
   else {
-    bigint_do_decrement(num);
+    do_decrement(num);
   }
 }
 
-static inline void bigint_bitshift_left(Bigint *num) {
-  bigint_add_digit(num);
+static inline void bitshift_left(Digits *num) {
+  add_digit(num);
   uint64_t carry = 0;
   for (uint32_t i = 0; i < num->length; i++) {
     uint64_t old_carry = carry;
-    carry = num->digits[i] >> 63;
-    num->digits[i] <<= 1;
-    num->digits[i] |= old_carry;
+    carry = digits_of(num)[i] >> 63;
+    digits_of(num)[i] <<= 1;
+    digits_of(num)[i] |= old_carry;
   }
-  bigint_remove_leading_zeros(num);
+  remove_leading_zeros(num);
 }
 
 // Compares the absolute values of two bigints, returning 1 if the first
 // is larger, -1 if the second is larger, and 0 if they're equal
-static int bigint_compare_absolute(const Bigint *a, const Bigint *b) {
+static int compare_absolute(const Digits *a, const Digits *b) {
   if (a->length != b->length) {
     if (a->length > b->length)
       return 1;
@@ -226,168 +400,36 @@ static int bigint_compare_absolute(const Bigint *a, const Bigint *b) {
   }
   else {
     for (int64_t i = a->length - 1; i >= 0; i--) {
-      if (a->digits[i] > b->digits[i])
+      if (digits_of(a)[i] > digits_of(b)[i])
         return 1;
-      else if (a->digits[i] < b->digits[i])
+      else if (digits_of(a)[i] < digits_of(b)[i])
         return -1;
     }
     return 0;
   }
 }
 
-// Compares two bigints to each other, returning 1 if the first bigint is
-// bigger, -1 if the second bigint is larger, or 0 if they are equal
-int bigint_compare(const Bigint *a, const Bigint *b) {
-  if (a->is_negative) {
-    if (b->is_negative) {
-      return bigint_compare_absolute(a, b) * -1;
-    }
-    else {
-      return -1;
-    }
-  }
-  else if (b->is_negative) {
-    return 1;
-  }
-  else {
-    return bigint_compare_absolute(a, b);
-  }
-}
-
-// Returns a bigint's two's complement representation
-// Used only for bitwise operations which would result in erroneous
-// results if the bigints weren't in two's complement representation
-static Bigint bigint_convert_to_twos_complement(const Bigint *num) {
-  Bigint twos_num = copy_bigint(num);
-  if (twos_num.digits[twos_num.length - 1] & (1ULL << 63))
-    bigint_add_digit(&twos_num);
-
-  if (twos_num.is_negative) {
-    for (uint32_t i = 0; i < twos_num.length; i++) {
-      twos_num.digits[i] = ~twos_num.digits[i];
-    }
-    bigint_decrement(&twos_num);
-  }
-  return twos_num;
-}
-
-// Converts a number in two's complement to the representation for Bigints
-static void bigint_convert_from_twos_complement(Bigint *num) {
-  if (num->digits[num->length - 1] & (1ULL << 63)) {
-    num->is_negative = true;
-    bigint_increment(num);
-    for (uint32_t i = 0; i < num->length; i++) {
-      num->digits[i] = ~num->digits[i];
-    }
-  }
-  else {
-    num->is_negative = false;
-  }
-  bigint_remove_leading_zeros(num);
-}
-
-// Performs a bitwise or on two bigints
-Bigint bigint_or(const Bigint *a, const Bigint *b) {
-  Bigint num1 = bigint_convert_to_twos_complement(a);
-  Bigint num2 = bigint_convert_to_twos_complement(b);
-
-  Bigint result = bigint_with_digits(max(num1.length, num2.length));
-  for (uint32_t i = 0; i < result.length; i++) {
-    if (i < num1.length)
-      result.digits[i] |= num1.digits[i];
-    else if (num1.is_negative)
-      result.digits[i] |= UINT64_MAX;
-
-    if (i < num2.length)
-      result.digits[i] |= num2.digits[i];
-    else if (num2.is_negative)
-      result.digits[i] |= UINT64_MAX;
-  }
-
-  free_bigint(&num1);
-  free_bigint(&num2);
-  bigint_convert_from_twos_complement(&result);
-
-  return result;
-}
-
-// Performs a bitwise and on two bigints
-Bigint bigint_and(const Bigint *a, const Bigint *b) {
-  Bigint num1 = bigint_convert_to_twos_complement(a);
-  Bigint num2 = bigint_convert_to_twos_complement(b);
-
-  Bigint result = bigint_with_digits(max(num1.length, num2.length));
-  for (uint32_t i = 0; i < result.length; i++) {
-    if (i >= num1.length) {
-      if (num1.is_negative)
-        result.digits[i] = num2.digits[i];
-      else
-        break;
-    }
-    else if (i >= num2.length) {
-      if (num2.is_negative)
-        result.digits[i] = num1.digits[i];
-      else
-        break;
-    }
-    else {
-      result.digits[i] = num1.digits[i] & num2.digits[i];
-    }
-  }
-
-  free_bigint(&num1);
-  free_bigint(&num2);
-  bigint_convert_from_twos_complement(&result);
-
-  return result;
-}
-
-// Performs a bitwise xor on two bigints
-Bigint bigint_xor(const Bigint *a, const Bigint *b) {
-  Bigint num1 = bigint_convert_to_twos_complement(a);
-  Bigint num2 = bigint_convert_to_twos_complement(b);
-
-  Bigint result = bigint_with_digits(max(num1.length, num2.length));
-  for (uint32_t i = 0; i < result.length; i++) {
-    if (i < num1.length)
-      result.digits[i] ^= num1.digits[i];
-    else if (num1.is_negative)
-      result.digits[i] ^= UINT64_MAX;
-
-    if (i < num2.length)
-      result.digits[i] ^= num2.digits[i];
-    else if (num2.is_negative)
-      result.digits[i] ^= UINT64_MAX;
-  }
-
-  free_bigint(&num1);
-  free_bigint(&num2);
-  bigint_convert_from_twos_complement(&result);
-
-  return result;
-}
-
 // Adds one bigint to another. Does not handle signs correctly, just blindly
 // adds the digits to each other
-static void bigint_do_add(Bigint *a, const Bigint *b) {
+static void do_add(Digits *a, const Digits *b) {
   uint32_t digit = 0;
   bool carry = false;
 
   while (digit < b->length || carry) {
     if (digit >= a->length) {
-      bigint_add_digit(a);
+      add_digit(a);
     }
 
     bool overflowed = false;
 
     if (b->length > digit) {
-      a->digits[digit] += b->digits[digit];
-      overflowed = (a->digits[digit] < b->digits[digit]);
+      digits_of(a)[digit] += digits_of(b)[digit];
+      overflowed = (digits_of(a)[digit] < digits_of(b)[digit]);
     }
 
     if (carry) {
-      a->digits[digit]++;
-      overflowed |= (a->digits[digit] == 0);
+      digits_of(a)[digit]++;
+      overflowed |= (digits_of(a)[digit] == 0);
     }
 
     carry = overflowed;
@@ -398,77 +440,49 @@ static void bigint_do_add(Bigint *a, const Bigint *b) {
 // Subtracts one bigint from another
 // Does not make any considerations for the bigints' signs, and assumes
 // that a is greater than or equal to b
-static void bigint_do_subtract(Bigint *a, const Bigint *b) {
+static void do_subtract(Digits *a, const Digits *b) {
   bool borrow = false;
 
   for (uint32_t i = 0; i < b->length || borrow; i++) {
     if (borrow) {
-      borrow = (a->digits[i] == 0);
-      a->digits[i]--;
+      borrow = (digits_of(a)[i] == 0);
+      digits_of(a)[i]--;
     }
 
     if (i < b->length) {
-      if (b->digits[i] > a->digits[i]) {
+      if (digits_of(b)[i] > digits_of(a)[i]) {
         borrow = true;
       }
-      a->digits[i] -= b->digits[i];
+      digits_of(a)[i] -= digits_of(b)[i];
     }
   }
 
-  bigint_remove_leading_zeros(a);
+  remove_leading_zeros(a);
 }
 
-// Returns the result of adding a and b, taking into account the signs of
-// the numbers
-void bigint_add(Bigint *a, const Bigint *b) {
-  if (a->is_negative == b->is_negative) {
-    bigint_do_add(a, b);
+// Adds b to a, or subtracts it if subtracting is set, taking into account the
+// signs of the numbers
+static void add_digits(Digits *a, const Digits *b, bool subtracting) {
+  if ((a->is_negative == b->is_negative) != subtracting) {
+    do_add(a, b);
   }
   else {
-    int comp_result = bigint_compare_absolute(a, b);
+    int comp_result = compare_absolute(a, b);
     if (comp_result > 0) {
-      bigint_do_subtract(a, b);
+      do_subtract(a, b);
     }
     else if (comp_result < 0) {
-      Bigint result = copy_bigint(b);
-      bigint_do_subtract(&result, a);
-      free_bigint(a);
+      Digits result = copy_digits(b);
+      do_subtract(&result, a);
+      result.is_negative = subtracting ? !a->is_negative : b->is_negative;
+      free_digits(a);
       *a = result;
     }
     else {
       // They're equal, just with different signs. They cancel each other out,
       // so we set a to zero
-      a->length = 1;
-      a->digits[0] = 0;
-      a->is_negative = false;
-    }
-  }
-}
-
-// Returns the result of subtracting b from a, taking into account the signs
-// of the numbers
-void bigint_subtract(Bigint *a, const Bigint *b) {
-  if (a->is_negative != b->is_negative) {
-    bigint_do_add(a, b);
-  }
-  else {
-    int comp_result = bigint_compare_absolute(a, b);
-    if (comp_result > 0) {
-      bigint_do_subtract(a, b);
-    }
-    else if (comp_result < 0) {
-      Bigint result = copy_bigint(b);
-      bigint_do_subtract(&result, a);
-      result.is_negative = !a->is_negative;
-      free_bigint(a);
-      *a = result;
-    }
-    else {
-      // They're equal to each other, so they cancel each other out. In this
-      // case, we set a to 0.
-      a->length = 1;
-      a->digits[0] = 0;
-      a->is_negative = false;
+      free_digits(a);
+      *a = new_digits();
     }
   }
 }
@@ -482,8 +496,8 @@ static bool add_check_overflow(uint64_t *a, uint64_t b) {
 
 // Returns the result of multiplying a and b, but doesn't adjust the
 // sign of the number
-static Bigint bigint_do_multiply(const Bigint *a, const Bigint *b) {
-  Bigint result = new_bigint();
+static Digits do_multiply(const Digits *a, const Digits *b) {
+  Digits result = new_digits();
 
   for (uint32_t i = 0; i < a->length; i++) {
     uint64_t overflow = 0;
@@ -492,7 +506,7 @@ static Bigint bigint_do_multiply(const Bigint *a, const Bigint *b) {
       uint32_t cur_digit = i + j;
 
       if (result.length <= cur_digit) {
-        bigint_add_digit(&result);
+        add_digit(&result);
       }
 
       // In order to multiply the two digits of the numbers together, but
@@ -500,31 +514,31 @@ static Bigint bigint_do_multiply(const Bigint *a, const Bigint *b) {
       // Where the first 32 bits and last 32 bits of the digits are each
       // multiplied by each other and are shifted and added together to get the
       // correct result in regards to overflow
-      uint64_t lower_a = a->digits[i] & UINT32_MAX;
-      uint64_t lower_b = b->digits[j] & UINT32_MAX;
-      uint64_t upper_a = a->digits[i] >> 32;
-      uint64_t upper_b = b->digits[j] >> 32;
+      uint64_t lower_a = digits_of(a)[i] & UINT32_MAX;
+      uint64_t lower_b = digits_of(b)[j] & UINT32_MAX;
+      uint64_t upper_a = digits_of(a)[i] >> 32;
+      uint64_t upper_b = digits_of(b)[j] >> 32;
 
       uint64_t res1 = lower_a * lower_b;
       uint64_t res2 = lower_a * upper_b;
       uint64_t res3 = upper_a * lower_b;
       uint64_t res4 = upper_a * upper_b;
 
-      if (add_check_overflow(&result.digits[cur_digit], overflow)) {
+      if (add_check_overflow(&digits_of(&result)[cur_digit], overflow)) {
         res4++;
       }
 
       overflow = res4;
 
-      if (add_check_overflow(&result.digits[cur_digit], res1)) {
+      if (add_check_overflow(&digits_of(&result)[cur_digit], res1)) {
         overflow++;
       }
 
-      if (add_check_overflow(&result.digits[cur_digit], res2 << 32)) {
+      if (add_check_overflow(&digits_of(&result)[cur_digit], res2 << 32)) {
         overflow++;
       }
 
-      if (add_check_overflow(&result.digits[cur_digit], res3 << 32)) {
+      if (add_check_overflow(&digits_of(&result)[cur_digit], res3 << 32)) {
         overflow++;
       }
 
@@ -533,8 +547,8 @@ static Bigint bigint_do_multiply(const Bigint *a, const Bigint *b) {
   }
 
     if (overflow) {
-      bigint_add_digit(&result);
-      result.digits[i + b->length] = overflow;
+      add_digit(&result);
+      digits_of(&result)[i + b->length] = overflow;
     }
   }
 
@@ -543,65 +557,415 @@ static Bigint bigint_do_multiply(const Bigint *a, const Bigint *b) {
 
 // Returns the result of multiplying a and b, but making the result
 // negative or positive appropriately
-Bigint bigint_multiply(const Bigint *a, const Bigint *b) {
-  Bigint result = bigint_do_multiply(a, b);
+static Digits multiply_digits(const Digits *a, const Digits *b) {
+  Digits result = do_multiply(a, b);
   result.is_negative = (a->is_negative != b->is_negative);
-  bigint_remove_leading_zeros(&result);
+  remove_leading_zeros(&result);
   return result;
 }
 
-// Divides a by b, and returns the quotient and remainder through the passed
-// in pointers. Pass in NULL to either the quotient_result or remainder_result
-// to not save that result
-void bigint_divmod(const Bigint *a, const Bigint *b, Bigint *quotient_result,
-                   Bigint *remainder_result)
+// Divides a by b, giving the quotient and the remainder of their absolute
+// values, either of which can be NULL to not save that result
+static void divide_digits(const Digits *a, const Digits *b, Digits *quotient,
+                          Digits *remainder)
 {
-  assert(!bigint_is_zero(b));
+  Digits quotient_num = new_digits();
+  Digits remainder_num = new_digits();
 
-  Bigint quotient = new_bigint();
-  Bigint remainder = new_bigint();
+  if (a->length == 1 && b->length == 1) {
+    // Single digits can just be divided
+    uint64_t a_digit = digits_of(a)[0];
+    uint64_t b_digit = digits_of(b)[0];
+    quotient_num.digit = a_digit / b_digit;
+    remainder_num.digit = a_digit % b_digit;
+  }
+  else {
+    for (int64_t i = a->length - 1; i >= 0; i--) {
+      for (int32_t j = 63; j >= 0; j--) {
+        bitshift_left(&quotient_num);
+        bitshift_left(&remainder_num);
+
+        digits_of(&remainder_num)[0] |=
+          ((digits_of(a)[i] & (1ULL << j)) >> j);
+        if (compare_absolute(b, &remainder_num) <= 0) {
+          do_subtract(&remainder_num, b);
+          digits_of(&quotient_num)[0] |= 1;
+        }
+      }
+    }
+  }
+
+  if (quotient == NULL)
+    free_digits(&quotient_num);
+  else
+    *quotient = quotient_num;
+  if (remainder == NULL)
+    free_digits(&remainder_num);
+  else
+    *remainder = remainder_num;
+}
+
+Bigint bigint_from_string(const String *str) {
+  Digits result = new_digits();
+  Digits ten = new_digits();
+  ten.digit = 10;
+
+  uint32_t start = (str->str_data[0] == '-' ? 1: 0);
+  for (uint32_t i = start; i < str->length; i++) {
+    Digits digit = new_digits();
+    digit.digit = str->str_data[i] - '0';
+    Digits result_temp = multiply_digits(&result, &ten);
+
+    free_digits(&result);
+    do_add(&result_temp, &digit);
+    result = result_temp;
+  }
+
+  if (str->str_data[0] == '-' && !digits_are_zero(&result)) {
+    result.is_negative = true;
+  }
 
-  for (int64_t i = a->length - 1; i >= 0; i--) {
-    for (int32_t j = 63; j >= 0; j--) {
-      bigint_bitshift_left(&quotient);
-      bigint_bitshift_left(&remainder);
+  return pack(result);
+}
 
-      remainder.digits[0] |= ((a->digits[i] & (1ULL << j)) >> j);
-      if (bigint_compare_absolute(b, &remainder) <= 0) {
-        bigint_do_subtract(&remainder, b);
-        quotient.digits[0] |= 1;
+String bigint_to_string(const Bigint *num) {
+  String num_str = new_string();
+  if (bigint_is_zero(num)) {
+    string_add_char(&num_str, '0');
+    return num_str;
+  }
+  else {
+    Digits num_view = view(num);
+    Digits num_copy = copy_digits(&num_view);
+    Digits ten_quintillion = new_digits();
+    ten_quintillion.digit = 10000000000000000000ULL;
+
+    while (!digits_are_zero(&num_copy)) {
+      Digits remainder, quotient;
+      divide_digits(&num_copy, &ten_quintillion, &quotient, &remainder);
+      for (uint32_t i = 0; i < 19; i++) {
+        if (digits_of(&remainder)[0] != 0 || !digits_are_zero(&quotient)) {
+          string_add_char(&num_str, (digits_of(&remainder)[0] % 10) + '0');
+          digits_of(&remainder)[0] /= 10;
+        }
       }
+      free_digits(&remainder);
+      free_digits(&num_copy);
+      num_copy = quotient;
+    }
+
+    if (num_view.is_negative) {
+      string_add_char(&num_str, '-');
     }
+    string_reverse(&num_str);
+
+    free_digits(&num_copy);
+
+    return num_str;
+  }
+}
+
+bool bigint_fits_in_uint32(const Bigint *num) {
+  if (is_small(num)) {
+    return magnitude(small_value(num)) < (1ULL << 32);
   }
+  return num->big->length == 1 && digits_of(num->big)[0] < (1ULL << 32);
+}
+
+uint32_t bigint_to_uint32(const Bigint *num) {
+  assert(bigint_fits_in_uint32(num));
+  assert(!bigint_is_negative(num));
+
+  return bigint_digit(num, 0);
+}
+
+// Checks whether a bigint fits in an int64, leaving out INT64_MIN so that
+// every int64 it gives can be negated
+bool bigint_fits_in_int64(const Bigint *num) {
+  if (is_small(num)) {
+    return true;
+  }
+  return num->big->length == 1 && digits_of(num->big)[0] <= INT64_MAX;
+}
+
+int64_t bigint_to_int64(const Bigint *num) {
+  assert(bigint_fits_in_int64(num));
+
+  if (is_small(num)) {
+    return small_value(num);
+  }
+  int64_t val = digits_of(num->big)[0];
+  return num->big->is_negative ? -val : val;
+}
 
-  if (remainder_result == NULL) {
-    free_bigint(&remainder);
+Bigint copy_bigint(const Bigint *to_copy) {
+  if (is_small(to_copy)) {
+    return *to_copy;
+  }
+  return pack(copy_digits(to_copy->big));
+}
+
+bool bigint_is_zero(const Bigint *num) {
+  return num->small == 1;
+}
+
+void bigint_increment(Bigint *num) {
+  if (is_small(num) && small_value(num) < SMALL_MAX) {
+    num->small += 2;
+    return;
+  }
+  Digits digits = take(num);
+  increment_digits(&digits);
+  *num = pack(digits);
+}
+
+void bigint_decrement(Bigint *num) {
+  if (is_small(num) && small_value(num) > SMALL_MIN) {
+    num->small -= 2;
+    return;
+  }
+  Digits digits = take(num);
+  decrement_digits(&digits);
+  *num = pack(digits);
+}
+
+// Compares two bigints to each other, returning 1 if the first bigint is
+// bigger, -1 if the second bigint is larger, or 0 if they are equal
+int bigint_compare(const Bigint *a, const Bigint *b) {
+  if (is_small(a) && is_small(b)) {
+    return (a->small > b->small) - (a->small < b->small);
+  }
+  Digits num1 = view(a);
+  Digits num2 = view(b);
+  if (num1.is_negative) {
+    if (num2.is_negative) {
+      return compare_absolute(&num1, &num2) * -1;
+    }
+    else {
+      return -1;
+    }
+  }
+  else if (num2.is_negative) {
+    return 1;
   }
   else {
-    *remainder_result = remainder;
-    if (!bigint_is_zero(remainder_result)) {
-        remainder_result->is_negative = b->is_negative;
+    return compare_absolute(&num1, &num2);
+  }
+}
+
+// Returns a bigint's two's complement representation
+// Used only for bitwise operations which would result in erroneous
+// results if the bigints weren't in two's complement representation
+static Digits convert_to_twos_complement(const Bigint *num) {
+  Digits num_view = view(num);
+  Digits twos_num = copy_digits(&num_view);
+  if (digits_of(&twos_num)[twos_num.length - 1] & (1ULL << 63))
+    add_digit(&twos_num);
+
+  if (twos_num.is_negative) {
+    for (uint32_t i = 0; i < twos_num.length; i++) {
+      digits_of(&twos_num)[i] = ~digits_of(&twos_num)[i];
     }
+    decrement_digits(&twos_num);
   }
+  return twos_num;
+}
 
-  if (quotient_result == NULL) {
-    free_bigint(&quotient);
+// Converts a number in two's complement to the representation for Bigints
+static Bigint convert_from_twos_complement(Digits num) {
+  if (digits_of(&num)[num.length - 1] & (1ULL << 63)) {
+    num.is_negative = true;
+    increment_digits(&num);
+    for (uint32_t i = 0; i < num.length; i++) {
+      digits_of(&num)[i] = ~digits_of(&num)[i];
+    }
   }
   else {
-    *quotient_result = quotient;
-    quotient_result->is_negative = (a->is_negative != b->is_negative);
+    num.is_negative = false;
+  }
+  remove_leading_zeros(&num);
+  return pack(num);
+}
+
+// Performs a bitwise or on two bigints
+Bigint bigint_or(const Bigint *a, const Bigint *b) {
+  if (is_small(a) && is_small(b)) {
+    return make_small(small_value(a) | small_value(b));
+  }
+  Digits num1 = convert_to_twos_complement(a);
+  Digits num2 = convert_to_twos_complement(b);
+
+  Digits result = digits_with_length(max(num1.length, num2.length));
+  for (uint32_t i = 0; i < result.length; i++) {
+    if (i < num1.length)
+      digits_of(&result)[i] |= digits_of(&num1)[i];
+    else if (num1.is_negative)
+      digits_of(&result)[i] |= UINT64_MAX;
+
+    if (i < num2.length)
+      digits_of(&result)[i] |= digits_of(&num2)[i];
+    else if (num2.is_negative)
+      digits_of(&result)[i] |= UINT64_MAX;
+  }
+
+  free_digits(&num1);
+  free_digits(&num2);
+  return convert_from_twos_complement(result);
+}
+
+// Performs a bitwise and on two bigints
+Bigint bigint_and(const Bigint *a, const Bigint *b) {
+  if (is_small(a) && is_small(b)) {
+    return make_small(small_value(a) & small_value(b));
+  }
+  Digits num1 = convert_to_twos_complement(a);
+  Digits num2 = convert_to_twos_complement(b);
+
+  Digits result = digits_with_length(max(num1.length, num2.length));
+  for (uint32_t i = 0; i < result.length; i++) {
+    if (i >= num1.length) {
+      if (num1.is_negative)
+        digits_of(&result)[i] = digits_of(&num2)[i];
+      else
+        break;
+    }
+    else if (i >= num2.length) {
+      if (num2.is_negative)
+        digits_of(&result)[i] = digits_of(&num1)[i];
+      else
+        break;
+    }
+    else {
+      digits_of(&result)[i] = digits_of(&num1)[i] & digits_of(&num2)[i];
+    }
+  }
+
+  free_digits(&num1);
+  free_digits(&num2);
+  return convert_from_twos_complement(result);
+}
+
+// Performs a bitwise xor on two bigints
+Bigint bigint_xor(const Bigint *a, const Bigint *b) {
+  if (is_small(a) && is_small(b)) {
+    return make_small(small_value(a) ^ small_value(b));
+  }
+  Digits num1 = convert_to_twos_complement(a);
+  Digits num2 = convert_to_twos_complement(b);
+
+  Digits result = digits_with_length(max(num1.length, num2.length));
+  for (uint32_t i = 0; i < result.length; i++) {
+    if (i < num1.length)
+      digits_of(&result)[i] ^= digits_of(&num1)[i];
+    else if (num1.is_negative)
+      digits_of(&result)[i] ^= UINT64_MAX;
+
+    if (i < num2.length)
+      digits_of(&result)[i] ^= digits_of(&num2)[i];
+    else if (num2.is_negative)
+      digits_of(&result)[i] ^= UINT64_MAX;
+  }
+
+  free_digits(&num1);
+  free_digits(&num2);
+  return convert_from_twos_complement(result);
+}
+
+// Adds b to a, or subtracts it, however big they are
+static void add_bigints(Bigint *a, const Bigint *b, bool subtracting) {
+  Digits num2 = view(b);
+  if (a == b) {
+    num2 = copy_digits(&num2);
+  }
+  Digits num1 = take(a);
+  add_digits(&num1, &num2, subtracting);
+  *a = pack(num1);
+  if (a == b) {
+    free_digits(&num2);
+  }
+}
+
+// Returns the result of adding a and b, taking into account the signs of
+// the numbers
+void bigint_add(Bigint *a, const Bigint *b) {
+  if (is_small(a) && is_small(b)) {
+    *a = bigint_from_int64(small_value(a) + small_value(b));
+    return;
+  }
+  add_bigints(a, b, false);
+}
+
+// Returns the result of subtracting b from a, taking into account the signs
+// of the numbers
+void bigint_subtract(Bigint *a, const Bigint *b) {
+  if (is_small(a) && is_small(b)) {
+    *a = bigint_from_int64(small_value(a) - small_value(b));
+    return;
+  }
+  add_bigints(a, b, true);
+}
+
+// Returns the result of multiplying a and b
+Bigint bigint_multiply(const Bigint *a, const Bigint *b) {
+  if (is_small(a) && is_small(b) &&
+      magnitude(small_value(a)) < (1ULL << 31) &&
+      magnitude(small_value(b)) < (1ULL << 31))
+  {
+    return make_small(small_value(a) * small_value(b));
+  }
+  Digits num1 = view(a);
+  Digits num2 = view(b);
+  return pack(multiply_digits(&num1, &num2));
+}
+
+// Divides a by b, and returns the quotient and remainder through the passed
+// in pointers. Pass in NULL to either the quotient_result or remainder_result
+// to not save that result. The quotient has the sign of a divided by b, and
+// the remainder has the sign of b
+void bigint_divmod(const Bigint *a, const Bigint *b, Bigint *quotient_result,
+                   Bigint *remainder_result)
+{
+  assert(!bigint_is_zero(b));
+
+  bool quotient_negative = bigint_is_negative(a) != bigint_is_negative(b);
+  bool remainder_negative = bigint_is_negative(b);
+  if (is_small(a) && is_small(b)) {
+    uint64_t a_magnitude = magnitude(small_value(a));
+    uint64_t b_magnitude = magnitude(small_value(b));
+    if (quotient_result != NULL) {
+      *quotient_result = bigint_from_magnitude(a_magnitude / b_magnitude,
+                                               quotient_negative);
+    }
+    if (remainder_result != NULL) {
+      *remainder_result = bigint_from_magnitude(a_magnitude % b_magnitude,
+                                                remainder_negative);
+    }
+    return;
+  }
+
+  Digits num1 = view(a);
+  Digits num2 = view(b);
+  Digits quotient, remainder;
+  divide_digits(&num1, &num2, quotient_result ? &quotient : NULL,
+                remainder_result ? &remainder : NULL);
+  if (quotient_result != NULL) {
+    quotient.is_negative = quotient_negative && !digits_are_zero(&quotient);
+    *quotient_result = pack(quotient);
+  }
+  if (remainder_result != NULL) {
+    remainder.is_negative = remainder_negative && !digits_are_zero(&remainder);
+    *remainder_result = pack(remainder);
   }
 }
 
 Bigint bigint_exponent(const Bigint *base, const Bigint *exponent) {
   Bigint result = bigint_from_int64(1);
   Bigint digit_val = copy_bigint(base);
-  for (uint32_t i = 0; i < exponent->length; i++) {
-    for (uint64_t j = 1;
-         j > 0 && (i + 1 < exponent->length || j <= exponent->digits[i]);
-         j <<= 1)
-    {
-      if (j & exponent->digits[i]) {
+  uint32_t length = bigint_length(exponent);
+  for (uint32_t i = 0; i < length; i++) {
+    uint64_t digit = bigint_digit(exponent, i);
+    for (uint64_t j = 1; j > 0 && (i + 1 < length || j <= digit); j <<= 1) {
+      if (j & digit) {
         Bigint temp_result = bigint_multiply(&result, &digit_val);
         free_bigint(&result);
         result = temp_result;
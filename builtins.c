@@ -2,12 +2,60 @@
 // Contains functions implementing golfscript's builtin functions
 
 #include <stdlib.h>
+#include <string.h>
 #include "golf.h"
 
+// Returns whether two popped items are a lazy item (a range or packed array)
+// and an item of another type, in either order, putting them in the order
+// (lazy, other) if so
+static bool pair_lazy_with(Item *item1, Item *item2, enum Type lazy_type,
+                           enum Type other_type)
+{
+  if (item1->type == other_type && item2->type == lazy_type) {
+    swap_items(item1, item2);
+  }
+  return item1->type == lazy_type && item2->type == other_type;
+}
+
+static bool pair_range_with(Item *item1, Item *item2, enum Type other_type) {
+  return pair_lazy_with(item1, item2, TYPE_RANGE, other_type);
+}
+
+static bool pair_packed_with(Item *item1, Item *item2, enum Type other_type) {
+  return pair_lazy_with(item1, item2, TYPE_PACKED, other_type);
+}
+
+static bool pair_input_with(Item *item1, Item *item2, enum Type other_type) {
+  return pair_lazy_with(item1, item2, TYPE_INPUT, other_type);
+}
+
+// The prelude words are written in golfscript, and are run natively only
+// while none of the tokens they're written in have been assigned to. Blanks
+// and literals are tokens too, which the compiler keeps without their
+// closing quote or brace
+static bool prelude_assigned(const char *const tokens[]) {
+  if (definitions.num_items == 0) {
+    return false;
+  }
+  for (uint32_t i = 0; tokens[i] != NULL; i++) {
+    String token = {(unsigned char *) tokens[i], strlen(tokens[i]), 0, NULL};
+    if (map_get(&definitions, &token) != NULL) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Runs a prelude word as it's written, for when it can't be run natively
+static void run_prelude(const char *source) {
+  String code = {(unsigned char *) source, strlen(source), 0, NULL};
+  execute_string(&code);
+}
+
 void builtin_abs() {
   Item item = stack_pop();
   if (item.type == TYPE_INTEGER) {
-    item.int_val.is_negative = false;
+    bigint_abs(&item.int_val);
     stack_push(item);
   }
   else {
@@ -26,19 +74,45 @@ void builtin_ampersand() {
     item2.int_val = and_val;
   }
   else if (item1.type == TYPE_BLOCK || item1.type == TYPE_STRING) {
-    string_setwise_and(&item2.str_val, &item1.str_val);
+    string_setwise_and(item2.str_val, item1.str_val);
   }
   else if (item1.type == TYPE_ARRAY) {
-    array_and(&item2.arr_val, &item1.arr_val);
+    array_and(item2.arr_val, item1.arr_val);
   }
 
   free_item(&item1);
   stack_push(item2);
 }
 
+// and is 1$if
+void builtin_and() {
+  static const char *const tokens[] = {"1", "$", "if", NULL};
+  if (prelude_assigned(tokens)) {
+    run_prelude("1$if");
+    return;
+  }
+  stack_push(make_integer(1));
+  builtin_dollar_sign();
+  builtin_if();
+}
+
 void builtin_asterisk() {
-  Item item1 = stack_pop();
-  Item item2 = stack_pop();
+  Item item1 = stack_pop_lazy();
+  Item item2 = stack_pop_lazy();
+
+  if (pair_range_with(&item1, &item2, TYPE_BLOCK)) {
+    fold_range(&item1.range_val, &item2);
+    free_item(&item2);
+    return;
+  }
+  else if (pair_packed_with(&item1, &item2, TYPE_BLOCK)) {
+    fold_packed(item1.packed_val, &item2);
+    free_item(&item1);
+    free_item(&item2);
+    return;
+  }
+  item_expand(&item1);
+  item_expand(&item2);
 
   if (item1.type < item2.type)
     swap_items(&item1, &item2);
@@ -50,13 +124,12 @@ void builtin_asterisk() {
       item1.int_val = product;
     }
     else if (item1.type == TYPE_ARRAY)
-      array_multiply(&item1.arr_val, item2.int_val);
+      array_multiply(item1.arr_val, item2.int_val);
     else if (item1.type == TYPE_STRING)
-      string_multiply(&item1.str_val, item2.int_val);
+      string_multiply(item1.str_val, item2.int_val);
     else if (item1.type == TYPE_BLOCK) {
       repeat_block(&item1, item2.int_val);
       free_item(&item1);
-      free_item(&item2);
       return;
     }
     free_item(&item2);
@@ -65,19 +138,19 @@ void builtin_asterisk() {
   }
   else if (item2.type == TYPE_ARRAY) {
     if (item1.type == TYPE_ARRAY || item1.type == TYPE_STRING)
-      stack_push(join_array(&item2.arr_val, &item1));
+      stack_push(join_array(item2.arr_val, &item1));
     else if (item1.type == TYPE_BLOCK)
-      fold_array(&item2.arr_val, &item1);
+      fold_array(item2.arr_val, &item1);
   }
   else if (item2.type == TYPE_STRING) {
     if (item1.type == TYPE_STRING)
-      stack_push(string_join(&item2.str_val, &item1.str_val));
+      stack_push(string_join(item2.str_val, item1.str_val));
     else if (item1.type == TYPE_BLOCK)
-      fold_string(&item2.str_val, &item1);
+      fold_string(item2.str_val, &item1);
   }
   else if (item2.type == TYPE_BLOCK) {
     if (item1.type == TYPE_BLOCK)
-      fold_string(&item1.str_val, &item2);
+      fold_string(item1.str_val, &item2);
   }
 
   free_item(&item1);
@@ -85,9 +158,9 @@ void builtin_asterisk() {
 }
 
 void builtin_at() {
-  Item item1 = stack_pop();
-  Item item2 = stack_pop();
-  Item item3 = stack_pop();
+  Item item1 = stack_pop_lazy();
+  Item item2 = stack_pop_lazy();
+  Item item3 = stack_pop_lazy();
 
   stack_push(item2);
   stack_push(item1);
@@ -95,8 +168,8 @@ void builtin_at() {
 }
 
 void builtin_backslash() {
-  Item item1 = stack_pop();
-  Item item2 = stack_pop();
+  Item item1 = stack_pop_lazy();
+  Item item2 = stack_pop_lazy();
 
   stack_push(item1);
   stack_push(item2);
@@ -104,7 +177,7 @@ void builtin_backslash() {
 
 void builtin_backtick() {
   Item item = stack_pop();
-  Item item_str = {TYPE_STRING, .str_val = get_literal(&item)};
+  Item item_str = make_string_from(get_literal(&item));
   stack_push(item_str);
   free_item(&item);
 }
@@ -121,10 +194,10 @@ void builtin_bar() {
     item2.int_val = or_val;
   }
   else if (item1.type == TYPE_STRING || item1.type == TYPE_BLOCK) {
-    string_setwise_or(&item2.str_val, &item1.str_val);
+    string_setwise_or(item2.str_val, item1.str_val);
   }
   else if (item1.type == TYPE_ARRAY) {
-    array_or(&item2.arr_val, &item1.arr_val);
+    array_or(item2.arr_val, item1.arr_val);
   }
 
   free_item(&item1);
@@ -142,29 +215,29 @@ void builtin_base() {
     if (item2.type == TYPE_INTEGER) {
       Item digits = make_array();
       if (bigint_is_zero(&item2.int_val)) {
-        array_push(&digits.arr_val, make_integer(0));
+        array_push(digits.arr_val, make_integer(0));
       }
-      item2.int_val.is_negative = false;
+      bigint_abs(&item2.int_val);
       while (!bigint_is_zero(&item2.int_val)) {
         Bigint quotient, remainder;
         bigint_divmod(&item2.int_val, &item1.int_val, &quotient, &remainder);
-        array_push(&digits.arr_val, make_integer_from_bigint(&remainder));
+        array_push(digits.arr_val, make_integer_from_bigint(&remainder));
         free_bigint(&item2.int_val);
         free_bigint(&remainder);
         item2.int_val = quotient;
       }
-      array_reverse(&digits.arr_val);
+      array_reverse(digits.arr_val);
       stack_push(digits);
     }
     else if (item2.type == TYPE_ARRAY) {
       Bigint base_val = bigint_from_int64(1);
       Bigint result = new_bigint();
-      for (int32_t i = item2.arr_val.length - 1; i >= 0; i--) {
-        if (item2.arr_val.items[i].type != TYPE_INTEGER) {
+      for (int32_t i = item2.arr_val->length - 1; i >= 0; i--) {
+        if (item2.arr_val->items[i].type != TYPE_INTEGER) {
           error("Cannot perform base operation on array with non-integers!");
         }
         Bigint product = bigint_multiply(&base_val,
-                                         &item2.arr_val.items[i].int_val);
+                                         &item2.arr_val->items[i].int_val);
         bigint_add(&result, &product);
         Bigint temp_bigint = base_val;
         base_val = bigint_multiply(&item1.int_val, &base_val);
@@ -178,8 +251,8 @@ void builtin_base() {
     else if (item2.type == TYPE_STRING || item2.type == TYPE_BLOCK) {
       Bigint base_val = bigint_from_int64(1);
       Bigint result = new_bigint();
-      for (int32_t i = item2.str_val.length - 1; i >= 0; i--) {
-        Bigint temp_char = bigint_from_int64(item2.str_val.str_data[i]);
+      for (int32_t i = item2.str_val->length - 1; i >= 0; i--) {
+        Bigint temp_char = bigint_from_int64(item2.str_val->str_data[i]);
         Bigint product = bigint_multiply(&temp_char, &base_val);
         bigint_add(&result, &product);
         free_bigint(&temp_char);
@@ -211,10 +284,10 @@ void builtin_caret() {
     item2.int_val = xor_val;
   }
   else if (item1.type == TYPE_STRING || item1.type == TYPE_BLOCK) {
-    string_setwise_xor(&item2.str_val, &item1.str_val);
+    string_setwise_xor(item2.str_val, item1.str_val);
   }
   else if (item1.type == TYPE_ARRAY) {
-    array_xor(&item2.arr_val, &item1.arr_val);
+    array_xor(item2.arr_val, item1.arr_val);
   }
 
   free_item(&item1);
@@ -222,32 +295,61 @@ void builtin_caret() {
 }
 
 void builtin_comma() {
-  Item item = stack_pop();
-  if (item.type == TYPE_INTEGER) {
+  Item item = stack_pop_lazy();
+  if (item.type == TYPE_INPUT) {
+    item_expand(&item);
+  }
+
+  if (item.type == TYPE_INTEGER && bigint_is_negative(&item.int_val)) {
+    stack_push(make_range(0, 0));
+  }
+  else if (item.type == TYPE_INTEGER && bigint_fits_in_uint32(&item.int_val)) {
+    stack_push(make_range(0, bigint_to_uint32(&item.int_val)));
+  }
+  else if (item.type == TYPE_INTEGER) {
     Item array = make_array();
     Bigint cur_val;
     for (cur_val = new_bigint();
          bigint_compare(&cur_val, &item.int_val) < 0;
          bigint_increment(&cur_val))
     {
-      array_push(&array.arr_val, make_integer_from_bigint(&cur_val));
+      array_push(array.arr_val, make_integer_from_bigint(&cur_val));
     }
     free_bigint(&cur_val);
     stack_push(array);
   }
   else if (item.type == TYPE_STRING) {
-    stack_push(make_integer(item.str_val.length));
+    stack_push(make_integer(item.str_val->length));
   }
   else if (item.type == TYPE_ARRAY) {
-    stack_push(make_integer(item.arr_val.length));
+    stack_push(make_integer(item.arr_val->length));
+  }
+  else if (item.type == TYPE_RANGE) {
+    stack_push(make_integer(item.range_val.length));
+  }
+  else if (item.type == TYPE_PACKED) {
+    stack_push(make_integer(item.packed_val->length));
+  }
+  else if (item.type == TYPE_ROPE) {
+    stack_push(make_integer(item.rope_val->length));
   }
   else if (item.type == TYPE_BLOCK) {
-    Item to_filter = stack_pop();
-    if (to_filter.type == TYPE_ARRAY) {
-      filter_array(&to_filter.arr_val, &item);
+    Item to_filter = stack_pop_lazy();
+    if (to_filter.type == TYPE_ROPE || to_filter.type == TYPE_INPUT) {
+      item_expand(&to_filter);
+    }
+    if (to_filter.type == TYPE_RANGE) {
+      Array filtered = filter_range(&to_filter.range_val, &item);
+      to_filter = make_array_from(filtered);
+    }
+    else if (to_filter.type == TYPE_PACKED) {
+      filter_packed(to_filter.packed_val, &item);
+    }
+    else if (to_filter.type == TYPE_ARRAY) {
+      filter_array(to_filter.arr_val, &item);
     }
     else if (to_filter.type == TYPE_STRING || to_filter.type == TYPE_BLOCK) {
-      filter_string(&to_filter.str_val, &item);
+      filter_string(to_filter.str_val, &item);
     }
     else if (to_filter.type == TYPE_INTEGER) {
       error("Cannot filter over an integer!");
@@ -261,11 +363,11 @@ void builtin_do() {
   Item block = stack_pop();
 
   execute_item(&block);
-  Item cond = stack_pop();
+  Item cond = stack_pop_lazy();
   while (item_boolean(&cond)) {
     free_item(&cond);
     execute_item(&block);
-    cond = stack_pop();
+    cond = stack_pop_lazy();
   }
 
   free_item(&cond);
@@ -273,11 +375,24 @@ void builtin_do() {
 }
 
 void builtin_dollar_sign() {
-  Item item = stack_pop();
+  Item item = stack_pop_lazy();
+  if (item.type == TYPE_ROPE || item.type == TYPE_INPUT) {
+    item_expand(&item);
+  }
 
   if (item.type == TYPE_INTEGER) {
-    if (item.int_val.is_negative) {
-      item.int_val.is_negative = false;
+    // A sandbox only has the items it was given, so it can't tell what is
+    // further down the real stack
+    if (sandbox_escape != NULL &&
+        (bigint_is_negative(&item.int_val) ||
+         !bigint_fits_in_uint32(&item.int_val) ||
+         bigint_to_uint32(&item.int_val) >= stack.length))
+    {
+      free_item(&item);
+      error("Cannot copy from outside of a sandbox!");
+    }
+    if (bigint_is_negative(&item.int_val)) {
+      bigint_abs(&item.int_val);
       bigint_decrement(&item.int_val);
       if (bigint_fits_in_uint32(&item.int_val) &&
           bigint_to_uint32(&item.int_val) < stack.length)
@@ -294,11 +409,19 @@ void builtin_dollar_sign() {
     free_item(&item);
   }
   else if (item.type == TYPE_STRING) {
-    string_sort(&item.str_val);
+    string_sort(item.str_val);
     stack_push(item);
   }
   else if (item.type == TYPE_ARRAY) {
-    array_sort(&item.arr_val);
+    array_sort(item.arr_val);
+    stack_push(item);
+  }
+  else if (item.type == TYPE_RANGE) {
+    // Ranges are always in sorted order
+    stack_push(item);
+  }
+  else if (item.type == TYPE_PACKED) {
+    packed_sort(item.packed_val);
     stack_push(item);
   }
   else if (item.type == TYPE_BLOCK) {
@@ -308,23 +431,27 @@ void builtin_dollar_sign() {
     }
     else if (to_sort.type == TYPE_BLOCK || to_sort.type == TYPE_STRING) {
       Item mapped_array = make_array();
-      for (uint32_t i = 0; i < to_sort.str_val.length; i++) {
-        stack_push(make_integer(to_sort.str_val.str_data[i]));
-        execute_string(&item.str_val);
-        array_push(&mapped_array.arr_val, stack_pop());
+      Code *code = get_code(item.str_val);
+      for (uint32_t i = 0; i < to_sort.str_val->length; i++) {
+        stack_push(make_integer(to_sort.str_val->str_data[i]));
+        execute_code(code);
+        array_push(mapped_array.arr_val, stack_pop());
       }
-      string_sort_by_mapping(&to_sort.str_val, &mapped_array.arr_val);
+      release_code(code);
+      string_sort_by_mapping(to_sort.str_val, mapped_array.arr_val);
       stack_push(to_sort);
       free_item(&mapped_array);
     }
     else if (to_sort.type == TYPE_ARRAY) {
       Item mapped_array = make_array();
-      for (uint32_t i = 0; i < to_sort.arr_val.length; i++) {
-        stack_push(make_copy(&to_sort.arr_val.items[i]));
-        execute_string(&item.str_val);
-        array_push(&mapped_array.arr_val, stack_pop());
+      Code *code = get_code(item.str_val);
+      for (uint32_t i = 0; i < to_sort.arr_val->length; i++) {
+        stack_push(make_copy(&to_sort.arr_val->items[i]));
+        execute_code(code);
+        array_push(mapped_array.arr_val, stack_pop());
       }
-      array_sort_by_mapping(&to_sort.arr_val, &mapped_array.arr_val);
+      release_code(code);
+      array_sort_by_mapping(to_sort.arr_val, mapped_array.arr_val);
       stack_push(to_sort);
       free_item(&mapped_array);
     }
@@ -333,8 +460,42 @@ void builtin_dollar_sign() {
 }
 
 void builtin_equal() {
-  Item item1 = stack_pop();
-  Item item2 = stack_pop();
+  Item item1 = stack_pop_lazy();
+  Item item2 = stack_pop_lazy();
+
+  if (pair_range_with(&item1, &item2, TYPE_INTEGER)) {
+    if (bigint_fits_in_uint32(&item2.int_val)) {
+      bool was_negative = bigint_is_negative(&item2.int_val);
+      bigint_abs(&item2.int_val);
+      int64_t index = bigint_to_uint32(&item2.int_val);
+      if (was_negative) {
+        index = item1.range_val.length - index;
+      }
+      if (index < item1.range_val.length && index >= 0) {
+        stack_push(make_integer(item1.range_val.start + index));
+      }
+    }
+    free_item(&item2);
+    return;
+  }
+  else if (pair_packed_with(&item1, &item2, TYPE_INTEGER)) {
+    if (bigint_fits_in_uint32(&item2.int_val)) {
+      bool was_negative = bigint_is_negative(&item2.int_val);
+      bigint_abs(&item2.int_val);
+      int64_t index = bigint_to_uint32(&item2.int_val);
+      if (was_negative) {
+        index = item1.packed_val->length - index;
+      }
+      if (index < item1.packed_val->length && index >= 0) {
+        stack_push(make_integer(packed_get(item1.packed_val, index)));
+      }
+    }
+    free_item(&item1);
+    free_item(&item2);
+    return;
+  }
+  item_expand(&item1);
+  item_expand(&item2);
 
   if (item1.type < item2.type) {
     swap_items(&item1, &item2);
@@ -348,14 +509,14 @@ void builtin_equal() {
     }
     else if (item1.type == TYPE_STRING || item1.type == TYPE_BLOCK) {
       if (bigint_fits_in_uint32(&item2.int_val)) {
-        bool was_negative = item2.int_val.is_negative;
-        item2.int_val.is_negative = false;
+        bool was_negative = bigint_is_negative(&item2.int_val);
+        bigint_abs(&item2.int_val);
         int64_t index = bigint_to_uint32(&item2.int_val);
         if (was_negative) {
-          index = item1.str_val.length - index;
+          index = item1.str_val->length - index;
         }
-        if (index < item1.str_val.length && index >= 0) {
-          stack_push(make_integer(item1.str_val.str_data[index]));
+        if (index < item1.str_val->length && index >= 0) {
+          stack_push(make_integer(item1.str_val->str_data[index]));
         }
       }
       free_item(&item1);
@@ -363,14 +524,14 @@ void builtin_equal() {
     }
     else if (item1.type == TYPE_ARRAY) {
       if (bigint_fits_in_uint32(&item2.int_val)) {
-        bool was_negative = item2.int_val.is_negative;
-        item2.int_val.is_negative = false;
+        bool was_negative = bigint_is_negative(&item2.int_val);
+        bigint_abs(&item2.int_val);
         int64_t index = bigint_to_uint32(&item2.int_val);
         if (was_negative) {
-          index = item1.arr_val.length - index;
+          index = item1.arr_val->length - index;
         }
-        if (index < item1.arr_val.length && index >= 0) {
-          stack_push(make_copy(&item1.arr_val.items[index]));
+        if (index < item1.arr_val->length && index >= 0) {
+          stack_push(make_copy(&item1.arr_val->items[index]));
         }
       }
       free_item(&item1);
@@ -385,14 +546,49 @@ void builtin_equal() {
 }
 
 void builtin_exclamation() {
-  Item item = stack_pop();
+  Item item = stack_pop_lazy();
   stack_push(make_integer(!item_boolean(&item)));
   free_item(&item);
 }
 
 void builtin_greater_than() {
-  Item item1 = stack_pop();
-  Item item2 = stack_pop();
+  Item item1 = stack_pop_lazy();
+  Item item2 = stack_pop_lazy();
+
+  if (pair_range_with(&item1, &item2, TYPE_INTEGER)) {
+    if (bigint_is_negative(&item2.int_val)) {
+      Bigint range_len = bigint_from_int64(item1.range_val.length);
+      bigint_add(&item2.int_val, &range_len);
+      free_bigint(&range_len);
+    }
+    range_remove_from_front(&item1.range_val, item2.int_val);
+    free_item(&item2);
+    stack_push(item1);
+    return;
+  }
+  else if (pair_packed_with(&item1, &item2, TYPE_INTEGER)) {
+    if (bigint_is_negative(&item2.int_val)) {
+      Bigint packed_len = bigint_from_int64(item1.packed_val->length);
+      bigint_add(&item2.int_val, &packed_len);
+      free_bigint(&packed_len);
+    }
+    packed_remove_from_front(item1.packed_val, item2.int_val);
+    free_item(&item2);
+    stack_push(item1);
+    return;
+  }
+  else if (pair_input_with(&item1, &item2, TYPE_INTEGER) &&
+           !bigint_is_negative(&item2.int_val))
+  {
+    uint32_t wanted = bigint_fits_in_uint32(&item2.int_val)
+                    ? bigint_to_uint32(&item2.int_val) : UINT32_MAX;
+    item1.input_val.start += input_available(&item1.input_val, wanted);
+    free_item(&item2);
+    stack_push(item1);
+    return;
+  }
+  item_expand(&item1);
+  item_expand(&item2);
 
   if (item1.type < item2.type) {
     swap_items(&item1, &item2);
@@ -405,22 +601,22 @@ void builtin_greater_than() {
       free_item(&item2);
     }
     else if (item1.type == TYPE_STRING || item1.type == TYPE_BLOCK) {
-      if (item2.int_val.is_negative) {
-        Bigint str_len = bigint_from_int64(item1.str_val.length);
+      if (bigint_is_negative(&item2.int_val)) {
+        Bigint str_len = bigint_from_int64(item1.str_val->length);
         bigint_add(&item2.int_val, &str_len);
         free_bigint(&str_len);
       }
-      string_remove_from_front(&item1.str_val, item2.int_val);
+      string_remove_from_front(item1.str_val, item2.int_val);
       free_item(&item2);
       stack_push(item1);
     }
     else if (item1.type == TYPE_ARRAY) {
-      if (item2.int_val.is_negative) {
-        Bigint arr_len = bigint_from_int64(item1.arr_val.length);
+      if (bigint_is_negative(&item2.int_val)) {
+        Bigint arr_len = bigint_from_int64(item1.arr_val->length);
         bigint_add(&item2.int_val, &arr_len);
         free_bigint(&arr_len);
       }
-      array_remove_from_front(&item1.arr_val, item2.int_val);
+      array_remove_from_front(item1.arr_val, item2.int_val);
       free_item(&item2);
       stack_push(item1);
     }
@@ -433,14 +629,17 @@ void builtin_greater_than() {
 }
 
 void builtin_if() {
+  bool is_tail = in_tail_position;
+  in_tail_position = false;
   Item false_item = stack_pop();
   Item true_item = stack_pop();
-  Item cond = stack_pop();
+  Item cond = stack_pop_lazy();
 
-  if (item_boolean(&cond))
-    execute_item(&true_item);
+  Item *chosen = item_boolean(&cond) ? &true_item : &false_item;
+  if (is_tail)
+    execute_tail_item(chosen);
   else
-    execute_item(&false_item);
+    execute_item(chosen);
 
   free_item(&cond);
   free_item(&true_item);
@@ -452,8 +651,56 @@ void builtin_lbracket() {
 }
 
 void builtin_less_than() {
-  Item item1 = stack_pop();
-  Item item2 = stack_pop();
+  Item item1 = stack_pop_lazy();
+  Item item2 = stack_pop_lazy();
+
+  if (pair_range_with(&item1, &item2, TYPE_INTEGER)) {
+    Range *range = &item1.range_val;
+    if (bigint_is_negative(&item2.int_val)) {
+      bigint_abs(&item2.int_val);
+      uint32_t to_remove = range->length;
+      if (bigint_fits_in_uint32(&item2.int_val))
+        to_remove = min(bigint_to_uint32(&item2.int_val), range->length);
+      range_truncate(range, range->length - to_remove);
+    }
+    else if (bigint_fits_in_uint32(&item2.int_val)) {
+      range_truncate(range, bigint_to_uint32(&item2.int_val));
+    }
+    free_item(&item2);
+    stack_push(item1);
+    return;
+  }
+  else if (pair_packed_with(&item1, &item2, TYPE_INTEGER)) {
+    Packed *packed = item1.packed_val;
+    if (bigint_is_negative(&item2.int_val)) {
+      bigint_abs(&item2.int_val);
+      uint32_t to_remove = packed->length;
+      if (bigint_fits_in_uint32(&item2.int_val))
+        to_remove = min(bigint_to_uint32(&item2.int_val), packed->length);
+      packed_truncate(packed, packed->length - to_remove);
+    }
+    else if (bigint_fits_in_uint32(&item2.int_val)) {
+      packed_truncate(packed, bigint_to_uint32(&item2.int_val));
+    }
+    free_item(&item2);
+    stack_push(item1);
+    return;
+  }
+  else if (pair_input_with(&item1, &item2, TYPE_INTEGER) &&
+           !bigint_is_negative(&item2.int_val))
+  {
+    // Only as much of the input as is being taken is read
+    uint32_t wanted = bigint_fits_in_uint32(&item2.int_val)
+                    ? bigint_to_uint32(&item2.int_val) : UINT32_MAX;
+    uint32_t length = input_available(&item1.input_val, wanted);
+    Item prefix = make_string_from(
+      string_from_chars(input_data(&item1.input_val), length));
+    free_item(&item2);
+    stack_push(prefix);
+    return;
+  }
+  item_expand(&item1);
+  item_expand(&item2);
 
   if (item1.type < item2.type) {
     swap_items(&item1, &item2);
@@ -466,22 +713,23 @@ void builtin_less_than() {
       free_item(&item2);
     }
     else if (item1.type == TYPE_BLOCK || item1.type == TYPE_STRING) {
-      if (item2.int_val.is_negative) {
-        item2.int_val.is_negative = false;
+      if (bigint_is_negative(&item2.int_val)) {
+        bigint_abs(&item2.int_val);
         if (!bigint_fits_in_uint32(&item2.int_val))
-          item1.str_val.length = 0;
+          string_truncate(item1.str_val, 0);
         else {
           uint32_t to_subtract = bigint_to_uint32(&item2.int_val);
-          if (to_subtract > item1.str_val.length)
-            item1.str_val.length = 0;
+          if (to_subtract > item1.str_val->length)
+            string_truncate(item1.str_val, 0);
           else
-            item1.str_val.length -= to_subtract;
+            string_truncate(item1.str_val,
+                            item1.str_val->length - to_subtract);
         }
       }
       else {
         if (bigint_fits_in_uint32(&item2.int_val)) {
           uint32_t new_len = bigint_to_uint32(&item2.int_val);
-          item1.str_val.length = min(new_len, item1.str_val.length);
+          string_truncate(item1.str_val, new_len);
         }
       }
       free_item(&item2);
@@ -489,27 +737,27 @@ void builtin_less_than() {
     }
     else if (item1.type == TYPE_ARRAY) {
       uint32_t to_remove = 0;
-      if (item2.int_val.is_negative) {
-        item2.int_val.is_negative = false;
+      if (bigint_is_negative(&item2.int_val)) {
+        bigint_abs(&item2.int_val);
         if (bigint_fits_in_uint32(&item2.int_val)) {
           to_remove = bigint_to_uint32(&item2.int_val);
-          to_remove = min(to_remove, item1.arr_val.length);
+          to_remove = min(to_remove, item1.arr_val->length);
         }
         else {
-          to_remove = item1.arr_val.length;
+          to_remove = item1.arr_val->length;
         }
       }
       else {
         if (bigint_fits_in_uint32(&item2.int_val)) {
           uint32_t index = bigint_to_uint32(&item2.int_val);
-          if (index < item1.arr_val.length)
-            to_remove = item1.arr_val.length - index;
+          if (index < item1.arr_val->length)
+            to_remove = item1.arr_val->length - index;
         }
       }
       for (int64_t i = 1; i <= to_remove; i++) {
-        free_item(&item1.arr_val.items[item1.arr_val.length - i]);
+        free_item(&item1.arr_val->items[item1.arr_val->length - i]);
       }
-      item1.arr_val.length -= to_remove;
+      item1.arr_val->length -= to_remove;
       free_item(&item2);
       stack_push(item1);
     }
@@ -522,34 +770,46 @@ void builtin_less_than() {
 }
 
 void builtin_lparen() {
-  Item item = stack_pop();
+  Item item = stack_pop_lazy();
+
+  if (item.type == TYPE_PACKED && item.packed_val->length > 0) {
+    Item new_item = make_integer(packed_get(item.packed_val, 0));
+    packed_drop_front(item.packed_val, 1);
+    stack_push(item);
+    stack_push(new_item);
+    return;
+  }
+  else if (item.type == TYPE_INPUT &&
+           input_available(&item.input_val, 1) == 1)
+  {
+    Item new_item = make_integer(input_data(&item.input_val)[0]);
+    item.input_val.start++;
+    stack_push(item);
+    stack_push(new_item);
+    return;
+  }
+  item_expand(&item);
 
   if (item.type == TYPE_INTEGER) {
     bigint_decrement(&item.int_val);
     stack_push(item);
   }
   else if (item.type == TYPE_STRING || item.type == TYPE_BLOCK) {
-    if (item.str_val.length == 0) {
+    if (item.str_val->length == 0) {
       error("Unable to uncons from empty %s!",
             item.type == TYPE_STRING ? "string": "block");
     }
-    Item new_item = make_integer(item.str_val.str_data[0]);
-    for (uint32_t i = 0; i < item.str_val.length; i++) {
-      item.str_val.str_data[i] = item.str_val.str_data[i + 1];
-    }
-    item.str_val.length--;
+    Item new_item = make_integer(item.str_val->str_data[0]);
+    string_drop_front(item.str_val, 1);
     stack_push(item);
     stack_push(new_item);
   }
   else if (item.type == TYPE_ARRAY) {
-    if (item.arr_val.length == 0) {
+    if (item.arr_val->length == 0) {
       error("Unable to uncons from empty array");
     }
-    Item new_item = item.arr_val.items[0];
-    for (uint32_t i = 0; i < item.arr_val.length; i++) {
-      item.arr_val.items[i] = item.arr_val.items[i + 1];
-    }
-    item.arr_val.length--;
+    Item new_item = item.arr_val->items[0];
+    array_drop_front(item.arr_val, 1);
     stack_push(item);
     stack_push(new_item);
   }
@@ -565,18 +825,71 @@ void builtin_minus() {
     bigint_subtract(&item2.int_val, &item1.int_val);
   }
   else if (item2.type == TYPE_STRING || item2.type == TYPE_BLOCK) {
-    string_subtract(&item2.str_val, &item1.str_val);
+    string_subtract(item2.str_val, item1.str_val);
   }
   else if (item2.type == TYPE_ARRAY) {
-    array_subtract(&item2.arr_val, &item1.arr_val);
+    array_subtract(item2.arr_val, item1.arr_val);
   }
   free_item(&item1);
   stack_push(item2);
 }
 
+// n is "\n"
+void builtin_n() {
+  static const char *const tokens[] = {"\"\n", NULL};
+  if (prelude_assigned(tokens)) {
+    run_prelude("\"\n\"");
+    return;
+  }
+  String newline = {(unsigned char *) "\n", 1, 0, NULL};
+  stack_push(make_string(&newline));
+}
+
+// or is 1$\if
+void builtin_or() {
+  static const char *const tokens[] = {"1", "$", "\\", "if", NULL};
+  if (prelude_assigned(tokens)) {
+    run_prelude("1$\\if");
+    return;
+  }
+  stack_push(make_integer(1));
+  builtin_dollar_sign();
+  builtin_backslash();
+  builtin_if();
+}
+
+// p is `puts
+void builtin_p() {
+  static const char *const tokens[] = {"`", "puts", NULL};
+  if (prelude_assigned(tokens)) {
+    run_prelude("`puts");
+    return;
+  }
+  builtin_backtick();
+  builtin_puts();
+}
+
 void builtin_percent() {
-  Item item1 = stack_pop();
-  Item item2 = stack_pop();
+  Item item1 = stack_pop_lazy();
+  Item item2 = stack_pop_lazy();
+
+  if (pair_range_with(&item1, &item2, TYPE_BLOCK)) {
+    Item mapped_array = make_array_from(map_range(&item1.range_val, &item2));
+    item_pack(&mapped_array);
+    stack_push(mapped_array);
+    free_item(&item2);
+    return;
+  }
+  else if (pair_packed_with(&item1, &item2, TYPE_BLOCK)) {
+    Item mapped_array = make_array_from(map_packed(item1.packed_val, &item2));
+    item_pack(&mapped_array);
+    stack_push(mapped_array);
+    free_item(&item1);
+    free_item(&item2);
+    return;
+  }
+  item_expand(&item1);
+  item_expand(&item2);
 
   if (item2.type > item1.type) {
     swap_items(&item1, &item2);
@@ -593,40 +906,41 @@ void builtin_percent() {
       item1.int_val = remainder;
     }
     else if (item1.type == TYPE_ARRAY)
-      array_step_over(&item1.arr_val, item2.int_val);
+      array_step_over(item1.arr_val, item2.int_val);
     else if (item1.type == TYPE_STRING || item1.type == TYPE_BLOCK)
-      string_step_over(&item1.str_val, item2.int_val);
+      string_step_over(item1.str_val, item2.int_val);
 
     free_item(&item2);
     stack_push(item1);
   }
   else if (item2.type == TYPE_ARRAY) {
     if (item1.type == TYPE_ARRAY) {
-      array_split(&item2.arr_val, &item1.arr_val);
-      array_remove_empty_arrays(&item2.arr_val);
+      array_split(item2.arr_val, item1.arr_val);
+      array_remove_empty_arrays(item2.arr_val);
     }
     else if (item1.type == TYPE_STRING) {
-      Array str_array = array_from_string(&item1.str_val);
-      array_split(&str_array, &item2.arr_val);
+      Array str_array = array_from_string(item1.str_val);
+      array_split(&str_array, item2.arr_val);
       array_remove_empty_arrays(&str_array);
       free_item(&item2);
-      item2.arr_val = str_array;
+      item2 = make_array_from(str_array);
     }
     else if (item1.type == TYPE_BLOCK) {
-      map_array(&item2.arr_val, &item1);
+      map_array(item2.arr_val, &item1);
+      item_pack(&item2);
     }
     stack_push(item2);
     free_item(&item1);
   }
   else if (item2.type == TYPE_STRING) {
     if (item1.type == TYPE_STRING) {
-      Item split_string = string_split(&item2.str_val, &item1.str_val);
-      array_remove_empty_strings(&split_string.arr_val);
+      Item split_string = string_split(item2.str_val, item1.str_val);
+      array_remove_empty_strings(split_string.arr_val);
       free_item(&item2);
       item2 = split_string;
     }
     else if (item1.type == TYPE_BLOCK) {
-      map_string(&item2.str_val, &item1);
+      map_string(item2.str_val, &item1);
     }
     stack_push(item2);
     free_item(&item1);
@@ -637,14 +951,43 @@ void builtin_percent() {
 }
 
 void builtin_period() {
-  Item item = stack_pop();
+  Item item = stack_pop_lazy();
   stack_push(make_copy(&item));
   stack_push(item);
 }
 
 void builtin_plus() {
-  Item item1 = stack_pop();
-  Item item2 = stack_pop();
+  Item item1 = stack_pop_lazy();
+  Item item2 = stack_pop_lazy();
+
+  // Ranges that follow on from each other can be joined without expanding
+  if (item1.type == TYPE_RANGE && item2.type == TYPE_RANGE) {
+    Range *first = &item2.range_val;
+    Range *second = &item1.range_val;
+    if (first->length == 0) {
+      stack_push(item1);
+      return;
+    }
+    else if (second->length == 0 ||
+             (uint64_t) first->start + first->length == second->start)
+    {
+      first->length += second->length;
+      stack_push(item2);
+      return;
+    }
+  }
+  else if (item1.type == TYPE_PACKED && item2.type == TYPE_PACKED) {
+    packed_concat(item2.packed_val, item1.packed_val);
+    free_item(&item1);
+    stack_push(item2);
+    return;
+  }
+  else if (rope_add(&item2, &item1)) {
+    stack_push(item2);
+    return;
+  }
+  item_expand(&item1);
+  item_expand(&item2);
 
   items_add(&item2, &item1);
   free_item(&item1);
@@ -652,20 +995,69 @@ void builtin_plus() {
 }
 
 void builtin_print() {
-  Item item = stack_pop();
+  // Ropes are printed a chunk at a time rather than being joined up first
+  Item item = stack_pop_lazy();
+  if (item.type != TYPE_ROPE) {
+    item_expand(&item);
+  }
   output_item(&item);
   free_item(&item);
 }
 
+// puts is print n print, which prints the newline straight from a static
+// string rather than pushing one, so what n is written in counts too
+void builtin_puts() {
+  static const char *const tokens[] = {"print", " ", "n", "\"\n", NULL};
+  if (prelude_assigned(tokens)) {
+    run_prelude("print n print");
+    return;
+  }
+  builtin_print();
+  String newline = {(unsigned char *) "\n", 1, 0, NULL};
+  Item item = {TYPE_STRING, .str_val = &newline};
+  output_item(&item);
+}
+
 void builtin_question() {
-  Item item1 = stack_pop();
-  Item item2 = stack_pop();
+  Item item1 = stack_pop_lazy();
+  Item item2 = stack_pop_lazy();
+
+  if (pair_range_with(&item1, &item2, TYPE_BLOCK)) {
+    int64_t index = find_in_range(&item1.range_val, &item2);
+    if (index >= 0) {
+      stack_push(make_integer(item1.range_val.start + index));
+    }
+    free_item(&item2);
+    return;
+  }
+  else if (pair_range_with(&item1, &item2, TYPE_INTEGER)) {
+    stack_push(make_integer(range_find(&item1.range_val, &item2)));
+    free_item(&item2);
+    return;
+  }
+  else if (pair_packed_with(&item1, &item2, TYPE_BLOCK)) {
+    int64_t index = find_in_packed(item1.packed_val, &item2);
+    if (index >= 0) {
+      stack_push(make_integer(packed_get(item1.packed_val, index)));
+    }
+    free_item(&item1);
+    free_item(&item2);
+    return;
+  }
+  else if (pair_packed_with(&item1, &item2, TYPE_INTEGER)) {
+    stack_push(make_integer(packed_find(item1.packed_val, &item2)));
+    free_item(&item1);
+    free_item(&item2);
+    return;
+  }
+  item_expand(&item1);
+  item_expand(&item2);
 
   if (item1.type < item2.type)
     swap_items(&item1, &item2);
 
   if (item1.type == TYPE_INTEGER) {
-    if (item1.int_val.is_negative) {
+    if (bigint_is_negative(&item1.int_val)) {
       error("Can't raise an integer to a negative power!");
     }
     Bigint power = bigint_exponent(&item2.int_val, &item1.int_val);
@@ -678,24 +1070,24 @@ void builtin_question() {
     if (item2.type == TYPE_ARRAY) {
       swap_items(&item1, &item2);
     }
-    stack_push(make_integer(array_find(&item1.arr_val, &item2)));
+    stack_push(make_integer(array_find(item1.arr_val, &item2)));
     free_item(&item2);
     free_item(&item1);
   }
   else if (item1.type == TYPE_STRING) {
     if (item2.type == TYPE_INTEGER) {
-      stack_push(make_integer(string_find_char(&item1.str_val,
-                                               item2.int_val.digits[0] & 255)));
+      char c = bigint_digit(&item2.int_val, 0) & 255;
+      stack_push(make_integer(string_find_char(item1.str_val, c)));
       free_item(&item2);
     }
     else if (item2.type == TYPE_ARRAY) {
-      stack_push(make_integer(array_find(&item2.arr_val, &item1)));
+      stack_push(make_integer(array_find(item2.arr_val, &item1)));
       free_item(&item1);
       free_item(&item2);
     }
     else if (item2.type == TYPE_STRING) {
-      stack_push(make_integer(string_find_str(&item2.str_val,
-                                              &item1.str_val)));
+      stack_push(make_integer(string_find_str(item2.str_val,
+                                              item1.str_val)));
       free_item(&item1);
       free_item(&item2);
     }
@@ -708,32 +1100,54 @@ void builtin_question() {
       if (item2.type == TYPE_BLOCK) {
         swap_items(&item1, &item2);
       }
-      for (uint32_t i = 0; i < item2.str_val.length; i++) {
-        stack_push(make_integer(item2.str_val.str_data[i]));
-        execute_string(&item1.str_val);
+      int64_t index;
+      if (parallel_find_string(item2.str_val, &item1, &index)) {
+        if (index >= 0) {
+          stack_push(make_integer(item2.str_val->str_data[index]));
+        }
+        free_item(&item1);
+        free_item(&item2);
+        return;
+      }
+      Code *code = get_code(item1.str_val);
+      for (uint32_t i = 0; i < item2.str_val->length; i++) {
+        stack_push(make_integer(item2.str_val->str_data[i]));
+        execute_code(code);
         Item item_bool = stack_pop();
         if (item_boolean(&item_bool)) {
           free_item(&item_bool);
-          stack_push(make_integer(item2.str_val.str_data[i]));
+          stack_push(make_integer(item2.str_val->str_data[i]));
           break;
         }
         free_item(&item_bool);
       }
+      release_code(code);
       free_item(&item1);
       free_item(&item2);
     }
     else if (item2.type == TYPE_ARRAY) {
-      for (uint32_t i = 0; i < item2.arr_val.length; i++) {
-        stack_push(make_copy(&item2.arr_val.items[i]));
-        execute_string(&item1.str_val);
+      int64_t index;
+      if (parallel_find_array(item2.arr_val, &item1, &index)) {
+        if (index >= 0) {
+          stack_push(make_copy(&item2.arr_val->items[index]));
+        }
+        free_item(&item1);
+        free_item(&item2);
+        return;
+      }
+      Code *code = get_code(item1.str_val);
+      for (uint32_t i = 0; i < item2.arr_val->length; i++) {
+        stack_push(make_copy(&item2.arr_val->items[i]));
+        execute_code(code);
         Item item_bool = stack_pop();
         if (item_boolean(&item_bool)) {
           free_item(&item_bool);
-          stack_push(make_copy(&item2.arr_val.items[i]));
+          stack_push(make_copy(&item2.arr_val->items[i]));
           break;
         }
         free_item(&item_bool);
       }
+      release_code(code);
       free_item(&item1);
       free_item(&item2);
     }
@@ -756,6 +1170,9 @@ void builtin_rand() {
 void builtin_rbracket() {
   uint32_t first_item;
   if (bracket_stack.length == 0) {
+    if (sandbox_escape != NULL) {
+      error("Cannot collect items from outside of a sandbox!");
+    }
     first_item = 0;
   }
   else {
@@ -765,46 +1182,61 @@ void builtin_rbracket() {
     free_bigint(&first_bracket);
   }
   Item array = make_array();
+  // Packed arrays stay packed inside the array, while other lazy items are
+  // expanded
   for (uint32_t i = first_item; i < stack.length; i++) {
-    array_push(&array.arr_val, stack.items[i]);
+    if (stack.items[i].type != TYPE_PACKED) {
+      item_expand(&stack.items[i]);
+    }
+    array_push(array.arr_val, stack.items[i]);
   }
   stack.length = first_item;
+  item_pack(&array);
   stack_push(array);
 }
 
 void builtin_rparen() {
-  Item item = stack_pop();
+  Item item = stack_pop_lazy();
+
+  if (item.type == TYPE_PACKED && item.packed_val->length > 0) {
+    Packed *packed = item.packed_val;
+    Item new_item = make_integer(packed_get(packed, packed->length - 1));
+    packed_truncate(packed, packed->length - 1);
+    stack_push(item);
+    stack_push(new_item);
+    return;
+  }
+  item_expand(&item);
 
   if (item.type == TYPE_INTEGER) {
     bigint_increment(&item.int_val);
     stack_push(item);
   }
   else if (item.type == TYPE_STRING || item.type == TYPE_BLOCK) {
-    if (item.str_val.length == 0) {
+    if (item.str_val->length == 0) {
       error("Unable to uncons from empty %s!",
             item.type == TYPE_STRING ? "string": "block");
     }
-    String *str = &item.str_val;
+    String *str = item.str_val;
     Item new_item = make_integer(str->str_data[str->length - 1]);
     str->length -= 1;
-    str->str_data[str->length] = '\0';
 
     stack_push(item);
     stack_push(new_item);
   }
   else if (item.type == TYPE_ARRAY) {
-    if (item.arr_val.length == 0) {
+    if (item.arr_val->length == 0) {
       error("Unable to uncons from empty array");
     }
-    Item new_item = item.arr_val.items[item.arr_val.length - 1];
-    item.arr_val.length -= 1;
+    Item new_item = item.arr_val->items[item.arr_val->length - 1];
+    item.arr_val->length -= 1;
     stack_push(item);
     stack_push(new_item);
   }
 }
 
 void builtin_semicolon() {
-  Item item = stack_pop();
+  Item item = stack_pop_lazy();
   free_item(&item);
 }
 
@@ -830,35 +1262,32 @@ void builtin_slash() {
   }
   else if (item1.type == TYPE_ARRAY) {
     if (item2.type == TYPE_INTEGER) {
-      array_split_into_groups(&item1.arr_val, item2.int_val);
+      array_split_into_groups(item1.arr_val, item2.int_val);
       stack_push(item1);
       free_item(&item2);
     }
     else if (item1.type == TYPE_ARRAY) {
-      array_split(&item2.arr_val, &item1.arr_val);
+      array_split(item2.arr_val, item1.arr_val);
       free_item(&item1);
       stack_push(item2);
     }
   }
   else if (item1.type == TYPE_STRING) {
     if (item2.type == TYPE_INTEGER) {
-      Item split_str = string_split_into_groups(&item1.str_val, item2.int_val);
+      Item split_str = string_split_into_groups(item1.str_val, item2.int_val);
       stack_push(split_str);
       free_item(&item1);
       free_item(&item2);
     }
     else if (item2.type == TYPE_ARRAY) {
-      Item array = make_array();
-      for (uint32_t i = 0; i < item1.str_val.length; i++) {
-        array_push(&array.arr_val, make_integer(item1.str_val.str_data[i]));
-      }
-      array_split(&array.arr_val, &item2.arr_val);
+      Item array = make_array_from(array_from_string(item1.str_val));
+      array_split(array.arr_val, item2.arr_val);
       stack_push(array);
       free_item(&item1);
       free_item(&item2);
     }
     else if (item2.type == TYPE_STRING) {
-      Item split_str = string_split(&item2.str_val, &item1.str_val);
+      Item split_str = string_split(item2.str_val, item1.str_val);
       stack_push(split_str);
       free_item(&item1);
       free_item(&item2);
@@ -866,20 +1295,25 @@ void builtin_slash() {
   }
   else if (item1.type == TYPE_BLOCK) {
     if (item2.type == TYPE_ARRAY) {
-      for (uint32_t i = 0; i < item2.arr_val.length; i++) {
-        stack_push(item2.arr_val.items[i]);
-        execute_string(&item1.str_val);
+      Code *code = get_code(item1.str_val);
+      for (uint32_t i = 0; i < item2.arr_val->length; i++) {
+        stack_push(item2.arr_val->items[i]);
+        execute_code(code);
       }
-      free(item2.arr_val.items);
-      free(item1.str_val.str_data);
+      release_code(code);
+      free_array_buffer(item2.arr_val);
+      region_free(item2.arr_val);
+      free_item(&item1);
     }
     else if (item2.type == TYPE_STRING) {
-      for (uint32_t i = 0; i < item2.str_val.length; i++) {
-        stack_push(make_integer(item2.str_val.str_data[i]));
-        execute_string(&item1.str_val);
+      Code *code = get_code(item1.str_val);
+      for (uint32_t i = 0; i < item2.str_val->length; i++) {
+        stack_push(make_integer(item2.str_val->str_data[i]));
+        execute_code(code);
       }
-      free(item2.str_val.str_data);
-      free(item1.str_val.str_data);
+      release_code(code);
+      free_item(&item2);
+      free_item(&item1);
     }
     else if (item2.type == TYPE_BLOCK) {
       Item final_array = make_array();
@@ -890,7 +1324,7 @@ void builtin_slash() {
       while (item_boolean(&cond_item)) {
         free_item(&cond_item);
         stack_push(make_copy(&top));
-        array_push(&final_array.arr_val, top);
+        array_push(final_array.arr_val, top);
         execute_item(&item1);
         top = stack_pop();
         stack_push(make_copy(&top));
@@ -910,21 +1344,28 @@ void builtin_slash() {
 }
 
 void builtin_tilde() {
+  bool is_tail = in_tail_position;
+  in_tail_position = false;
   Item item = stack_pop();
   if (item.type == TYPE_INTEGER) {
-    item.int_val.is_negative = !item.int_val.is_negative;
+    bigint_negate(&item.int_val);
     bigint_decrement(&item.int_val);
     stack_push(item);
   }
+  else if (is_tail && item.type == TYPE_BLOCK) {
+    execute_tail_item(&item);
+    free_item(&item);
+  }
   else if (item.type == TYPE_STRING || item.type == TYPE_BLOCK) {
-    execute_string(&item.str_val);
+    execute_string(item.str_val);
     free_item(&item);
   }
   else if (item.type == TYPE_ARRAY) {
-    for (uint32_t i = 0; i < item.arr_val.length; i++) {
-      stack_push(item.arr_val.items[i]);
+    for (uint32_t i = 0; i < item.arr_val->length; i++) {
+      stack_push(item.arr_val->items[i]);
     }
-    free(item.arr_val.items);
+    free_array_buffer(item.arr_val);
+    region_free(item.arr_val);
   }
 }
 
@@ -933,12 +1374,12 @@ void builtin_until() {
   Item cond = stack_pop();
 
   execute_item(&cond);
-  Item bool_item = stack_pop();
+  Item bool_item = stack_pop_lazy();
   while (!item_boolean(&bool_item)) {
     free_item(&bool_item);
     execute_item(&body);
     execute_item(&cond);
-    bool_item = stack_pop();
+    bool_item = stack_pop_lazy();
   }
 
   free_item(&bool_item);
@@ -951,12 +1392,12 @@ void builtin_while() {
   Item cond = stack_pop();
 
   execute_item(&cond);
-  Item bool_item = stack_pop();
+  Item bool_item = stack_pop_lazy();
   while (item_boolean(&bool_item)) {
     free_item(&bool_item);
     execute_item(&body);
     execute_item(&cond);
-    bool_item = stack_pop();
+    bool_item = stack_pop_lazy();
   }
 
   free_item(&bool_item);
@@ -964,68 +1405,91 @@ void builtin_while() {
   free_item(&body);
 }
 
+// xor is \!!{!}*, which applies ! as many times as the !! gives
+void builtin_xor() {
+  static const char *const tokens[] = {"\\", "!", "{!", "*", NULL};
+  if (prelude_assigned(tokens)) {
+    run_prelude("\\!!{!}*");
+    return;
+  }
+  builtin_backslash();
+  builtin_exclamation();
+  builtin_exclamation();
+  Item times = stack_pop();
+  if (!bigint_is_zero(&times.int_val)) {
+    builtin_exclamation();
+  }
+  free_item(&times);
+}
+
 void builtin_zip() {
   Item item = stack_pop();
   if (item.type != TYPE_ARRAY) {
     error("Cannot zip a non-array!");
   }
   Item zipped_array = make_array();
-  for (uint32_t i = 0; i < item.arr_val.length; i++) {
-    Item cur_item = item.arr_val.items[i];
+  for (uint32_t i = 0; i < item.arr_val->length; i++) {
+    item_expand(&item.arr_val->items[i]);
+  }
+  for (uint32_t i = 0; i < item.arr_val->length; i++) {
+    Item cur_item = item.arr_val->items[i];
     if (cur_item.type == TYPE_INTEGER) {
       error("Cannot zip an array with an integer!");
     }
     else if (cur_item.type == TYPE_ARRAY) {
-      for (uint32_t j = 0; j < cur_item.arr_val.length; j++) {
-        if (j >= zipped_array.arr_val.length) {
-          if (item.arr_val.items[0].type == TYPE_ARRAY)
-            array_push(&zipped_array.arr_val, make_array());
-          else if (item.arr_val.items[0].type == TYPE_STRING)
-            array_push(&zipped_array.arr_val, empty_string());
-          else if (item.arr_val.items[0].type == TYPE_BLOCK)
-            array_push(&zipped_array.arr_val, make_block(new_string()));
+      for (uint32_t j = 0; j < cur_item.arr_val->length; j++) {
+        if (j >= zipped_array.arr_val->length) {
+          if (item.arr_val->items[0].type == TYPE_ARRAY)
+            array_push(zipped_array.arr_val, make_array());
+          else if (item.arr_val->items[0].type == TYPE_STRING)
+            array_push(zipped_array.arr_val, empty_string());
+          else if (item.arr_val->items[0].type == TYPE_BLOCK)
+            array_push(zipped_array.arr_val, make_block(new_string()));
         }
-        if (zipped_array.arr_val.items[j].type == TYPE_STRING ||
-            zipped_array.arr_val.items[j].type == TYPE_BLOCK)
+        if (zipped_array.arr_val->items[j].type == TYPE_STRING ||
+            zipped_array.arr_val->items[j].type == TYPE_BLOCK)
         {
-          if (cur_item.arr_val.items[j].type != TYPE_INTEGER) {
+          if (cur_item.arr_val->items[j].type != TYPE_INTEGER) {
             error("Invalid array for zip!");
           }
-          string_add_char(&zipped_array.arr_val.items[j].str_val,
-                          cur_item.arr_val.items[j].int_val.digits[0] & 255);
-          free_item(&cur_item.arr_val.items[j]);
+          const Bigint *num = &cur_item.arr_val->items[j].int_val;
+          string_add_char(zipped_array.arr_val->items[j].str_val,
+                          bigint_digit(num, 0) & 255);
+          free_item(&cur_item.arr_val->items[j]);
         }
-        else if (zipped_array.arr_val.items[j].type == TYPE_ARRAY) {
-          array_push(&zipped_array.arr_val.items[j].arr_val,
-                     cur_item.arr_val.items[j]);
+        else if (zipped_array.arr_val->items[j].type == TYPE_ARRAY) {
+          array_push(zipped_array.arr_val->items[j].arr_val,
+                     cur_item.arr_val->items[j]);
         }
       }
-      free(cur_item.arr_val.items);
+      free_array_buffer(cur_item.arr_val);
+      region_free(cur_item.arr_val);
     }
     else if (cur_item.type == TYPE_STRING || cur_item.type == TYPE_BLOCK) {
-      for (uint32_t j = 0; j < cur_item.str_val.length; j++) {
-        if (j >= zipped_array.arr_val.length) {
-          if (item.arr_val.items[0].type == TYPE_ARRAY)
-            array_push(&zipped_array.arr_val, make_array());
-          else if (item.arr_val.items[0].type == TYPE_STRING)
-            array_push(&zipped_array.arr_val, empty_string());
-          else if (item.arr_val.items[0].type == TYPE_BLOCK)
-            array_push(&zipped_array.arr_val, make_block(new_string()));
+      for (uint32_t j = 0; j < cur_item.str_val->length; j++) {
+        if (j >= zipped_array.arr_val->length) {
+          if (item.arr_val->items[0].type == TYPE_ARRAY)
+            array_push(zipped_array.arr_val, make_array());
+          else if (item.arr_val->items[0].type == TYPE_STRING)
+            array_push(zipped_array.arr_val, empty_string());
+          else if (item.arr_val->items[0].type == TYPE_BLOCK)
+            array_push(zipped_array.arr_val, make_block(new_string()));
         }
-        if (zipped_array.arr_val.items[j].type == TYPE_STRING ||
-            zipped_array.arr_val.items[j].type == TYPE_BLOCK)
+        if (zipped_array.arr_val->items[j].type == TYPE_STRING ||
+            zipped_array.arr_val->items[j].type == TYPE_BLOCK)
         {
-          string_add_char(&zipped_array.arr_val.items[j].str_val,
-                          cur_item.str_val.str_data[j]);
+          string_add_char(zipped_array.arr_val->items[j].str_val,
+                          cur_item.str_val->str_data[j]);
         }
-        else if (zipped_array.arr_val.items[j].type == TYPE_ARRAY) {
-          array_push(&zipped_array.arr_val.items[j].arr_val,
-                     make_integer(cur_item.str_val.str_data[j]));
+        else if (zipped_array.arr_val->items[j].type == TYPE_ARRAY) {
+          array_push(zipped_array.arr_val->items[j].arr_val,
+                     make_integer(cur_item.str_val->str_data[j]));
         }
       }
       free_item(&cur_item);
     }
   }
   stack_push(zipped_array);
-  free(item.arr_val.items);
+  free_array_buffer(item.arr_val);
+  region_free(item.arr_val);
 }
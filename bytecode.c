@@ -0,0 +1,361 @@
+// bytecode.c
+// Contains functions for writing compiled programs to .gsc files and loading
+// them back, so that a program doesn't have to be tokenized every time it's
+// run, and the cache of them kept with --cache
+
+// For mkdir and getpid
+#define _DEFAULT_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "golf.h"
+
+// Bumped whenever the format changes, or the tokens code is split into do
+#define BYTECODE_VERSION 1
+
+static const char bytecode_magic[4] = {'G', 'S', 'C', '\0'};
+
+// A .gsc file is made up of the header, the symbols, the code, the tokens,
+// the blocks and the data the symbols point into, one after the other.
+// Everything is in the byte order of the machine that wrote it, which a
+// different machine sees as a different version. Every token is a symbol, as
+// is the program's source, so that each different token is only stored once,
+// and nothing refers to anything by more than its offset, so the file can be
+// used as it's mapped
+typedef struct BytecodeHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t source_hash;   // The string_hash of the program's source
+  uint32_t program;       // The symbol that's the program's source
+  uint32_t num_symbols, num_codes, num_tokens, num_blocks, data_length;
+} BytecodeHeader;
+
+// Where a symbol's characters are in the data
+typedef struct BytecodeSymbol {
+  uint32_t offset, length;
+} BytecodeSymbol;
+
+// A piece of code, with the blocks in it always coming before it. Its tokens
+// are symbols, and its blocks are the code of each of its block literals
+typedef struct BytecodeCode {
+  uint32_t source_offset, source_length;  // Where its source is in the data
+  uint32_t first_token, num_tokens;
+  uint32_t first_block, num_blocks;
+} BytecodeCode;
+
+// A list of symbols or pieces of code, by their numbers
+typedef struct IndexList {
+  uint32_t *indices;
+  uint32_t length, allocated;
+} IndexList;
+
+// A .gsc file as it's being put together
+typedef struct BytecodeWriter {
+  Map symbol_nums;
+  BytecodeSymbol *symbols;
+  uint32_t num_symbols, symbols_allocated;
+  IndexList tokens, blocks;
+  String data;
+} BytecodeWriter;
+
+// Returns the number of the symbol for a string, adding it if it's new
+static uint32_t add_symbol(BytecodeWriter *writer, const String *str) {
+  Item *found = map_get(&writer->symbol_nums, str);
+  if (found != NULL) {
+    return bigint_to_uint32(&found->int_val);
+  }
+  if (writer->num_symbols == writer->symbols_allocated) {
+    writer->symbols_allocated *= 2;
+    writer->symbols = realloc(writer->symbols, sizeof(BytecodeSymbol) *
+                                               writer->symbols_allocated);
+    if (writer->symbols == NULL) {
+      error("Unable to allocate space for bytecode!");
+    }
+  }
+  BytecodeSymbol symbol = {writer->data.length, str->length};
+  writer->symbols[writer->num_symbols] = symbol;
+  string_add_str(&writer->data, str);
+  map_set(&writer->symbol_nums, copy_string(str),
+          make_integer(writer->num_symbols));
+  return writer->num_symbols++;
+}
+
+static void add_index(IndexList *list, uint32_t index) {
+  if (list->length == list->allocated) {
+    list->allocated = list->allocated == 0 ? 64 : list->allocated * 2;
+    list->indices = realloc(list->indices, sizeof(uint32_t) * list->allocated);
+    if (list->indices == NULL) {
+      error("Unable to allocate space for bytecode!");
+    }
+  }
+  list->indices[list->length++] = index;
+}
+
+// Writes a compiled program to a .gsc file, returning false if it couldn't
+// be written, or if the program has a malformed token in it. The file is
+// written under another name first and then renamed, so that nothing ever
+// sees half of it
+bool write_bytecode(Code *program, const char *filename) {
+  CodeList list = {NULL, 0, 0};
+  collect_code(&list, program);
+  for (uint32_t i = 0; i < list.length; i++) {
+    Code *code = list.codes[i];
+    if (code->length > 0 &&
+        code->instructions[code->length - 1].op == OP_ERROR)
+    {
+      free(list.codes);
+      return false;
+    }
+  }
+
+  BytecodeWriter writer = {
+    .symbol_nums = new_map(), .symbols = malloc(sizeof(BytecodeSymbol) * 16),
+    .num_symbols = 0, .symbols_allocated = 16,
+    .tokens = {NULL, 0, 0}, .blocks = {NULL, 0, 0}, .data = new_string()
+  };
+  BytecodeCode *codes = malloc(sizeof(BytecodeCode) * list.length);
+  if (writer.symbols == NULL || codes == NULL) {
+    error("Unable to allocate space for bytecode!");
+  }
+
+  BytecodeHeader header = {
+    .version = BYTECODE_VERSION, .source_hash = string_hash(&program->source),
+    .program = add_symbol(&writer, &program->source),
+    .num_codes = list.length
+  };
+  memcpy(header.magic, bytecode_magic, sizeof(bytecode_magic));
+  BytecodeCode *program_record = &codes[list.length - 1];
+  program_record->source_offset = writer.symbols[header.program].offset;
+  program_record->source_length = program->source.length;
+
+  // Fused instructions and pipelines stand in for instructions that are kept
+  // after them, so they're left out
+  for (uint32_t i = 0; i < list.length; i++) {
+    Code *code = list.codes[i];
+    BytecodeCode *record = &codes[i];
+    record->first_token = writer.tokens.length;
+    record->first_block = writer.blocks.length;
+    for (uint32_t j = 0; j < code->length; j++) {
+      Instruction *instr = &code->instructions[j];
+      if (instr->op == OP_FUSED || instr->op == OP_PIPELINE) {
+        continue;
+      }
+      uint32_t symbol = add_symbol(&writer, &instr->token);
+      add_index(&writer.tokens, symbol);
+
+      for (uint32_t k = 0; instr->block != NULL && k < list.length; k++) {
+        if (list.codes[k] == instr->block) {
+          // A block's source is its token without the opening brace
+          codes[k].source_offset = writer.symbols[symbol].offset + 1;
+          codes[k].source_length = writer.symbols[symbol].length - 1;
+          add_index(&writer.blocks, k);
+        }
+      }
+    }
+    record->num_tokens = writer.tokens.length - record->first_token;
+    record->num_blocks = writer.blocks.length - record->first_block;
+  }
+  header.num_symbols = writer.num_symbols;
+  header.num_tokens = writer.tokens.length;
+  header.num_blocks = writer.blocks.length;
+  header.data_length = writer.data.length;
+
+  char temp_name[4096];
+  snprintf(temp_name, sizeof(temp_name), "%s.%ld", filename, (long) getpid());
+  FILE *file = fopen(temp_name, "wb");
+  bool written = file != NULL;
+  if (file != NULL) {
+    written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(writer.symbols, sizeof(BytecodeSymbol),
+                     writer.num_symbols, file) == writer.num_symbols &&
+              fwrite(codes, sizeof(BytecodeCode), list.length, file)
+                == list.length &&
+              fwrite(writer.tokens.indices, sizeof(uint32_t),
+                     writer.tokens.length, file) == writer.tokens.length &&
+              fwrite(writer.blocks.indices, sizeof(uint32_t),
+                     writer.blocks.length, file) == writer.blocks.length &&
+              fwrite(writer.data.str_data, 1, writer.data.length, file)
+                == writer.data.length;
+    written = fclose(file) == 0 && written &&
+              rename(temp_name, filename) == 0;
+    if (!written) {
+      remove(temp_name);
+    }
+  }
+
+  free_map(&writer.symbol_nums);
+  free(writer.symbols);
+  free(writer.tokens.indices);
+  free(writer.blocks.indices);
+  free_string(&writer.data);
+  free(codes);
+  free(list.codes);
+  return written;
+}
+
+// Returns whether the given span of a file is inside it
+static bool in_file(uint64_t offset, uint64_t length, uint64_t file_size) {
+  return offset <= file_size && length <= file_size - offset;
+}
+
+// Loads a program from a .gsc file into the code cache, returning its
+// compiled code, to be given back with release_code. If a source is given,
+// the file has to be of that source. Returns NULL if the file can't be read,
+// is out of date, or isn't a .gsc file at all
+Code *load_bytecode(const char *filename, const String *source) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat file_info;
+  if (fstat(fd, &file_info) != 0 ||
+      (uint64_t) file_info.st_size < sizeof(BytecodeHeader))
+  {
+    close(fd);
+    return NULL;
+  }
+  uint64_t size = file_info.st_size;
+  void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return NULL;
+  }
+
+  const BytecodeHeader *header = mapped;
+  const BytecodeSymbol *symbols = (const BytecodeSymbol *) (header + 1);
+  const BytecodeCode *codes = (const BytecodeCode *) (symbols +
+                                                      header->num_symbols);
+  const uint32_t *tokens = (const uint32_t *) (codes + header->num_codes);
+  const uint32_t *blocks = tokens + header->num_tokens;
+  const unsigned char *data = (const unsigned char *) (blocks +
+                                                       header->num_blocks);
+  uint64_t data_offset = sizeof(BytecodeHeader) +
+                         (uint64_t) header->num_symbols *
+                           sizeof(BytecodeSymbol) +
+                         (uint64_t) header->num_codes * sizeof(BytecodeCode) +
+                         ((uint64_t) header->num_tokens + header->num_blocks) *
+                           sizeof(uint32_t);
+
+  // Everything is checked to be inside the file, and each piece of code to
+  // have as many blocks as block literals, before anything's used
+  bool valid = memcmp(header->magic, bytecode_magic, 4) == 0 &&
+               header->version == BYTECODE_VERSION &&
+               header->num_codes > 0 && header->program < header->num_symbols &&
+               in_file(data_offset, header->data_length, size);
+  for (uint32_t i = 0; valid && i < header->num_symbols; i++) {
+    valid = in_file(symbols[i].offset, symbols[i].length,
+                    header->data_length);
+  }
+  for (uint32_t i = 0; valid && i < header->num_codes; i++) {
+    const BytecodeCode *code = &codes[i];
+    valid = in_file(code->source_offset, code->source_length,
+                    header->data_length) &&
+            in_file(code->first_token, code->num_tokens,
+                    header->num_tokens) &&
+            in_file(code->first_block, code->num_blocks,
+                    header->num_blocks);
+    uint32_t num_block_literals = 0;
+    for (uint32_t j = 0; valid && j < code->num_tokens; j++) {
+      uint32_t symbol = tokens[code->first_token + j];
+      // A program can be empty, but none of its tokens can be
+      valid = symbol < header->num_symbols && symbols[symbol].length > 0;
+      num_block_literals += valid && data[symbols[symbol].offset] == '{';
+    }
+    for (uint32_t j = 0; valid && j < code->num_blocks; j++) {
+      valid = blocks[code->first_block + j] < i;
+    }
+    valid = valid && num_block_literals == code->num_blocks;
+  }
+  if (valid && source != NULL) {
+    const BytecodeSymbol *program = &symbols[header->program];
+    valid = header->source_hash == string_hash(source) &&
+            program->length == source->length &&
+            memcmp(data + program->offset, source->str_data,
+                   source->length) == 0;
+  }
+  if (!valid) {
+    munmap(mapped, size);
+    return NULL;
+  }
+
+  // Each piece of code is compiled after the blocks in it, and handed their
+  // compiled code, which each piece it's handed to holds on to
+  Code **loaded = malloc(sizeof(Code *) * header->num_codes);
+  if (loaded == NULL) {
+    error("Unable to allocate space for compiled code!");
+  }
+  Code *program = NULL;
+  for (uint32_t i = 0; i < header->num_codes; i++) {
+    const BytecodeCode *code = &codes[i];
+    String code_source = string_from_chars(data + code->source_offset,
+                                           code->source_length);
+    String *code_tokens = malloc(sizeof(String) * max(code->num_tokens, 1));
+    Code **code_blocks = malloc(sizeof(Code *) * max(code->num_blocks, 1));
+    if (code_tokens == NULL || code_blocks == NULL) {
+      error("Unable to allocate space for compiled code!");
+    }
+    for (uint32_t j = 0; j < code->num_tokens; j++) {
+      const BytecodeSymbol *symbol = &symbols[tokens[code->first_token + j]];
+      code_tokens[j] = string_from_chars(data + symbol->offset,
+                                         symbol->length);
+    }
+    for (uint32_t j = 0; j < code->num_blocks; j++) {
+      code_blocks[j] = retain_code(loaded[blocks[code->first_block + j]]);
+    }
+    program = compile_tokens(&code_source, code_tokens, code->num_tokens,
+                             code_blocks);
+    loaded[i] = program;
+    free(code_tokens);
+    free(code_blocks);
+    free_string(&code_source);
+  }
+
+  for (uint32_t i = 0; i + 1 < header->num_codes; i++) {
+    release_code(loaded[i]);
+  }
+  free(loaded);
+  munmap(mapped, size);
+  return program;
+}
+
+// Returns where the cached bytecode for a script goes, which is in a
+// __golfcache__ directory next to the script, creating the directory if it
+// doesn't exist yet
+static String cache_filename(const char *filename) {
+  const char *base = strrchr(filename, '/');
+  base = base == NULL ? filename : base + 1;
+
+  String path = new_string();
+  for (const char *c = filename; c < base; c++) {
+    string_add_char(&path, *c);
+  }
+  string_add_c_str(&path, "__golfcache__");
+  string_add_char(&path, '\0');
+  mkdir((const char *) path.str_data, 0777);
+  path.length--;
+
+  string_add_char(&path, '/');
+  string_add_c_str(&path, base);
+  string_add_c_str(&path, ".gsc");
+  string_add_char(&path, '\0');
+  return path;
+}
+
+// Returns the compiled code of a script with --cache, loading it from the
+// script's cached bytecode if that's up to date, or compiling it and caching
+// its bytecode if not
+Code *get_cached_code(const String *source, const char *filename) {
+  String path = cache_filename(filename);
+  Code *code = load_bytecode((const char *) path.str_data, source);
+  if (code == NULL) {
+    code = get_code(source);
+    write_bytecode(code, (const char *) path.str_data);
+  }
+  free_string(&path);
+  return code;
+}
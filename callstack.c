@@ -0,0 +1,101 @@
+// callstack.c
+// Contains the stack that code runs on once it's recursed deeper than the
+// C stack can safely go. Code that would start running too deep carries on
+// at the bottom of a segment of stack allocated from the heap instead, and
+// the segments are kept on a stack of their own, so a program can recurse
+// as deep as there's memory for
+
+// For the ucontext functions
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <ucontext.h>
+#include "golf.h"
+
+// How much of the C stack code can use before it moves on to a segment,
+// which leaves plenty of room below it even with a small stack limit
+#define NATIVE_STACK_BUDGET (1 << 20)
+
+// How big each segment is, and how much room is left at the bottom of it
+// for whatever code that starts running there uses before it's checked again
+#define SEGMENT_SIZE (8 << 20)
+#define SEGMENT_MARGIN (256 << 10)
+
+typedef struct Segment {
+  ucontext_t context;
+  unsigned char *memory;
+} Segment;
+
+// The lowest address code can start running at on the stack it's on, or 0
+// when nothing's been set up to check against
+_Thread_local uintptr_t stack_limit;
+
+// Every segment that's been allocated, the ones in use at the bottom, which
+// are kept around for whenever code goes that deep again
+static _Thread_local Segment **segments;
+static _Thread_local uint32_t num_segments, segments_in_use;
+
+// The code the segment that's just been switched to starts off running
+static _Thread_local Code *segment_code;
+
+// Sets the limit for the C stack of the current thread, which is assumed to
+// have room for NATIVE_STACK_BUDGET below wherever this is called from
+void init_call_stack() {
+  unsigned char here;
+  stack_limit = (uintptr_t) &here - NATIVE_STACK_BUDGET;
+}
+
+static void segment_entry() {
+  execute_code(segment_code);
+}
+
+// Runs code at the bottom of the next segment, going back to the stack it
+// was called on once it's done. Code in a sandbox can't leave the stack it's
+// on, since it may be unwound back out of it, so it leaves the sandbox instead
+void execute_on_new_segment(Code *code) {
+  if (sandbox_escape != NULL) {
+    error("Recursed too deeply inside a sandbox!");
+  }
+  if (segments_in_use == num_segments) {
+    Segment **new_segments = realloc(segments,
+                                     sizeof(Segment *) * (num_segments + 1));
+    Segment *segment = malloc(sizeof(Segment));
+    unsigned char *memory = malloc(SEGMENT_SIZE);
+    if (new_segments == NULL || segment == NULL || memory == NULL) {
+      error("Unable to allocate space for the call stack!");
+    }
+    segment->memory = memory;
+    segments = new_segments;
+    segments[num_segments++] = segment;
+  }
+
+  Segment *segment = segments[segments_in_use];
+  ucontext_t caller;
+  if (getcontext(&segment->context) != 0) {
+    error("Unable to switch to a new stack segment!");
+  }
+  segment->context.uc_stack.ss_sp = segment->memory;
+  segment->context.uc_stack.ss_size = SEGMENT_SIZE;
+  segment->context.uc_link = &caller;
+  makecontext(&segment->context, segment_entry, 0);
+
+  uintptr_t outer_limit = stack_limit;
+  stack_limit = (uintptr_t) segment->memory + SEGMENT_MARGIN;
+  segment_code = code;
+  segments_in_use++;
+  if (swapcontext(&caller, &segment->context) != 0) {
+    error("Unable to switch to a new stack segment!");
+  }
+  segments_in_use--;
+  stack_limit = outer_limit;
+}
+
+void free_call_stack() {
+  for (uint32_t i = 0; i < num_segments; i++) {
+    free(segments[i]->memory);
+    free(segments[i]);
+  }
+  free(segments);
+  segments = NULL;
+  num_segments = segments_in_use = 0;
+}
@@ -0,0 +1,584 @@
+// compile.c
+// Contains functions for turning golfscript code into instructions, and the
+// cache that keeps compiled code around so it only has to be tokenized once
+
+#include <ctype.h>
+#include <stdlib.h>
+#include "golf.h"
+
+#define CODE_CACHE_INIT_SIZE 256
+#define CODE_CACHE_MAX_LOAD_FACTOR 0.6
+
+// Past this many pieces of code, code that nothing holds on to is evicted
+// to make room for new code, so evaluating generated strings can't use up
+// all the memory. If everything in the cache is held, new code is compiled
+// each time it's run instead
+#define CODE_CACHE_MAX_ITEMS 4096
+
+static Code **code_cache;
+static uint32_t code_cache_items, code_cache_size;
+
+// Where the search for code to evict carries on from, which sweeps around
+// the cache like a clock hand, giving recently used code a second chance
+static uint32_t eviction_hand;
+
+// String and block literals by their tokens, so that identical literals all
+// over the program share their characters. Like the code cache, it stops
+// growing at some point, and only the main thread adds to it
+#define LITERALS_MAX_ITEMS 4096
+
+static Map literals;
+
+static int hex_digit_val(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  else if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  else if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  else
+    return -1;
+}
+
+static bool is_octal_digit(char c) {
+  return c >= '0' && c <= '7';
+}
+
+// The functions below all read a token from the code, setting error_msg
+// instead of returning early if the token is malformed
+
+static String get_number(const String *str, String *cur_tok,
+                         uint32_t *code_pos)
+{
+  while (++(*code_pos) < str->length && isdigit(str->str_data[*code_pos])) {
+    string_add_char(cur_tok, str->str_data[*code_pos]);
+  }
+  return *cur_tok;
+}
+
+static String get_raw_string(const String *str, String *cur_tok,
+                             uint32_t *code_pos, const char **error_msg)
+{
+  while (++(*code_pos) < str->length) {
+    char c = str->str_data[*code_pos];
+    if (c == '\\' && *code_pos + 1 < str->length) {
+      if (str->str_data[*code_pos + 1] == '\\' ||
+          str->str_data[*code_pos + 1] == '\'')
+      {
+        c = str->str_data[++(*code_pos)];
+      }
+    }
+    else if (c == '\'') {
+      ++(*code_pos);
+      return *cur_tok;
+    }
+    string_add_char(cur_tok, c);
+  }
+
+  *error_msg = "Unmatched ' encountered in the code!";
+  return *cur_tok;
+}
+
+static String get_escaped_string(const String *str, String *cur_tok,
+                                 uint32_t *code_pos, const char **error_msg)
+{
+  while (++(*code_pos) < str->length) {
+    unsigned char c = str->str_data[*code_pos];
+    if (c == '"') {
+      ++*code_pos;
+      return *cur_tok;
+    }
+    else if (c == '\\') {
+      if (++(*code_pos) >= str->length) {
+        break;
+      }
+      else {
+        c = str->str_data[*code_pos];
+        switch (c) {
+          case 'a': c = '\a';   break;
+          case 'b': c = '\b';   break;
+          case 'e': c = '\x1b'; break;
+          case 'f': c = '\f';   break;
+          case 'n': c = '\n';   break;
+          case 'r': c = '\r';   break;
+          case 's': c =  ' ';   break;
+          case 't': c = '\t';   break;
+          case 'v': c = '\v';   break;
+          case 'x':
+            // Hexadecimal literal
+            if (++(*code_pos) >= str->length) {
+              *error_msg = "Unmatched \" encountered in the code!";
+              return *cur_tok;
+            }
+            if (hex_digit_val(str->str_data[*code_pos]) < 0) {
+              *error_msg = "Invalid hex literal!";
+              return *cur_tok;
+            }
+            c = hex_digit_val(str->str_data[*code_pos]);
+            if (*code_pos + 1 < str->length &&
+                hex_digit_val(str->str_data[*code_pos + 1]) >= 0)
+            {
+              c <<= 4;
+              c += hex_digit_val(str->str_data[++(*code_pos)]);
+            }
+            break;
+          default:
+            // Octal literals
+            if (is_octal_digit(c)) {
+              c = 0;
+              for (int i = 0; i < 3; i++) {
+                c = c << 3 | (str->str_data[*code_pos] - '0');
+                if (*code_pos + 1 >= str->length) {
+                  *error_msg = "Unmatched \" encountered in the code!";
+                  return *cur_tok;
+                }
+                if (i < 2 && is_octal_digit(str->str_data[*code_pos + 1])) {
+                  *code_pos += 1;
+                }
+                else {
+                  break;
+                }
+              }
+            }
+            break;
+        }
+      }
+    }
+    string_add_char(cur_tok, c);
+  }
+
+  *error_msg = "Unmatched \" encountered in the code!";
+  return *cur_tok;
+}
+
+static String get_identifier(const String *str, String *cur_tok,
+                             uint32_t *code_pos)
+{
+  while (++(*code_pos) < str->length) {
+    char c = str->str_data[*code_pos];
+    if (isalnum(c) || c == '_')
+      string_add_char(cur_tok, c);
+    else
+      break;
+  }
+  return *cur_tok;
+}
+
+static String get_block(const String *str, String *cur_tok,
+                        uint32_t *code_pos, const char **error_msg)
+{
+  int brace_level = 1;
+  while (++(*code_pos) < str->length && brace_level > 0) {
+    char c = str->str_data[*code_pos];
+    if (c == '{')
+      brace_level++;
+    else if (c == '}')
+      brace_level--;
+    if (brace_level > 0)
+      string_add_char(cur_tok, str->str_data[*code_pos]);
+  }
+
+  if (*code_pos > str->length)
+    *error_msg = "Unmatched { encountered in the code!";
+
+  return *cur_tok;
+}
+
+static String get_comment(const String *str, String *cur_tok,
+                          uint32_t *code_pos)
+{
+  while (++(*code_pos) < str->length && str->str_data[*code_pos] != '\n') {
+    string_add_char(cur_tok, str->str_data[*code_pos]);
+  }
+  return *cur_tok;
+}
+
+// Return the next token in the string from the given code position
+static String next_token(const String *str, uint32_t *code_pos,
+                         const char **error_msg)
+{
+  String token = new_string();
+
+  if (*code_pos >= str->length)
+    return token;
+
+  char c = str->str_data[*code_pos];
+  string_add_char(&token, c);
+
+  if (c == '"')
+    return get_escaped_string(str, &token, code_pos, error_msg);
+  else if (c == '\'')
+    return get_raw_string(str, &token, code_pos, error_msg);
+  else if (isdigit(c) || c == '-')
+    return get_number(str, &token, code_pos);
+  else if (isalpha(c) || c == '_')
+    return get_identifier(str, &token, code_pos);
+  else if (c == '{')
+    return get_block(str, &token, code_pos, error_msg);
+  else if (c == '#')
+    return get_comment(str, &token, code_pos);
+  else {
+    *code_pos += 1;
+    return token;
+  }
+}
+
+static void add_instruction(Code *code, Instruction instr) {
+  if (code->length == code->allocated) {
+    code->allocated = code->allocated == 0 ? 8 : code->allocated * 2;
+    code->instructions = realloc(code->instructions,
+                                 sizeof(Instruction) * code->allocated);
+    if (code->instructions == NULL) {
+      error("Unable to allocate space for compiled code!");
+    }
+  }
+  code->instructions[code->length++] = instr;
+}
+
+// Makes a string or block literal's characters shared, so that pushing it
+// only copies a reference, and shares them with any identical literal
+// compiled before
+static Item share_literal(const String *tok, Item literal) {
+  if (is_worker_thread) {
+    string_share(literal.str_val);
+    return literal;
+  }
+  if (literals.keys == NULL) {
+    literals = new_map();
+  }
+  Item *found = map_get(&literals, tok);
+  if (found != NULL) {
+    free_item(&literal);
+    return make_copy(found);
+  }
+  string_share(literal.str_val);
+  if (literals.num_items < LITERALS_MAX_ITEMS) {
+    map_set(&literals, copy_string(tok), make_copy(&literal));
+  }
+  return literal;
+}
+
+// Turns a token into the instruction that runs it when it isn't defined,
+// given the compiled code of a block literal if it's already been compiled
+static Instruction compile_token(String tok, Code *block) {
+  Instruction instr = {
+    .op = OP_TOKEN, .token = tok, .block = NULL,
+    .definition = NULL, .definitions_version = 0
+  };
+  Bigint one = bigint_from_int64(1);
+
+  if (tok.str_data[0] == ':') {
+    instr.op = OP_ASSIGN;
+  }
+  else if (isdigit(tok.str_data[0]) ||
+           (tok.str_data[0] == '-' && tok.length > 1))
+  {
+    instr.op = OP_LITERAL;
+    instr.literal.type = TYPE_INTEGER;
+    instr.literal.int_val = bigint_from_string(&tok);
+  }
+  else if (tok.str_data[0] == '"' || tok.str_data[0] == '\'') {
+    String str = copy_string(&tok);
+    string_remove_from_front(&str, one);
+    instr.op = OP_LITERAL;
+    instr.literal = share_literal(&tok, make_string_from(str));
+  }
+  else if (tok.str_data[0] == '{') {
+    String body = copy_string(&tok);
+    string_remove_from_front(&body, one);
+    instr.op = OP_LITERAL;
+    instr.literal = share_literal(&tok, make_block(body));
+    instr.block = block != NULL ? block : get_code(instr.literal.str_val);
+  }
+  else if (find_builtin(&tok) != NULL) {
+    instr.op = find_builtin(&tok)->op;
+  }
+
+  free_bigint(&one);
+  return instr;
+}
+
+static Code *new_code(const String *source) {
+  Code *code = malloc(sizeof(Code));
+  if (code == NULL) {
+    error("Unable to allocate space for compiled code!");
+  }
+  // Cached code lives for the whole program, so it mustn't hold on to a view
+  // of some much larger string
+  code->source = copy_string(source);
+  string_unshare(&code->source);
+  code->instructions = NULL;
+  code->length = code->allocated = 0;
+  code->cached = false;
+  code->refs = 1;
+  code->recently_used = false;
+  code->times_run = 0;
+  code->native = NULL;
+  code->native_size = 0;
+  code->native_version = 0;
+  return code;
+}
+
+static Code *compile(const String *source) {
+  Code *code = new_code(source);
+
+  uint32_t code_pos = 0;
+  while (code_pos < source->length) {
+    const char *error_msg = NULL;
+    String tok = next_token(source, &code_pos, &error_msg);
+
+    // Nothing after a malformed token can be tokenized, so the error is the
+    // last instruction, raised if the code ever gets that far
+    if (error_msg != NULL) {
+      Instruction instr = {
+        .op = OP_ERROR, .token = tok, .error_msg = error_msg, .block = NULL,
+        .definition = NULL, .definitions_version = 0
+      };
+      add_instruction(code, instr);
+      break;
+    }
+    add_instruction(code, compile_token(tok, NULL));
+  }
+
+  fuse_pipelines(code);
+  fuse_instructions(code);
+  return code;
+}
+
+static void free_code(Code *code) {
+  for (uint32_t i = 0; i < code->length; i++) {
+    Instruction *instr = &code->instructions[i];
+    free_string(&instr->token);
+    if (instr->op == OP_LITERAL)
+      free_item(&instr->literal);
+    else if (instr->op == OP_PIPELINE)
+      free_pipeline(instr->pipeline);
+    else if (instr->op == OP_FUSED)
+      free_fused(instr->fused);
+    if (instr->block != NULL)
+      release_code(instr->block);
+  }
+  free_native(code);
+  free(code->instructions);
+  free_string(&code->source);
+  free(code);
+}
+
+// Doubles the size of the code cache, rehashing all the code in it
+static void code_cache_increase_size() {
+  Code **old_cache = code_cache;
+  uint32_t old_size = code_cache_size;
+
+  code_cache_size = old_size == 0 ? CODE_CACHE_INIT_SIZE : old_size * 2;
+  code_cache = calloc(code_cache_size, sizeof(Code *));
+  if (code_cache == NULL) {
+    error("Unable to allocate space for the code cache!");
+  }
+
+  for (uint32_t i = 0; i < old_size; i++) {
+    if (old_cache[i] != NULL) {
+      uint32_t slot = string_hash(&old_cache[i]->source) & (code_cache_size - 1);
+      while (code_cache[slot] != NULL) {
+        slot = (slot + 1) & (code_cache_size - 1);
+      }
+      code_cache[slot] = old_cache[i];
+    }
+  }
+
+  free(old_cache);
+}
+
+// Returns the cached compiled form of some code, retained for the caller,
+// or NULL if it isn't cached
+static Code *find_code(const String *source) {
+  if (code_cache_size > 0) {
+    uint32_t slot = string_hash(source) & (code_cache_size - 1);
+    while (code_cache[slot] != NULL) {
+      if (string_compare(&code_cache[slot]->source, source) == 0) {
+        return retain_code(code_cache[slot]);
+      }
+      slot = (slot + 1) & (code_cache_size - 1);
+    }
+  }
+  return NULL;
+}
+
+// Takes code out of the cache, moving back any code after it that would no
+// longer be found past the gap left behind
+static void remove_from_cache(uint32_t slot) {
+  uint32_t mask = code_cache_size - 1;
+  code_cache[slot] = NULL;
+  code_cache_items--;
+  for (uint32_t next = (slot + 1) & mask; code_cache[next] != NULL;
+       next = (next + 1) & mask)
+  {
+    uint32_t home = string_hash(&code_cache[next]->source) & mask;
+    if (((next - home) & mask) >= ((next - slot) & mask)) {
+      code_cache[slot] = code_cache[next];
+      code_cache[next] = NULL;
+      slot = next;
+    }
+  }
+}
+
+// Evicts the least recently used code that nothing holds on to, returning
+// whether there was any
+static bool evict_code() {
+  for (uint32_t i = 0; i < code_cache_size * 2; i++) {
+    uint32_t slot = eviction_hand;
+    eviction_hand = (eviction_hand + 1) & (code_cache_size - 1);
+    Code *code = code_cache[slot];
+    if (code == NULL || code->refs > 0) {
+      continue;
+    }
+    if (code->recently_used) {
+      code->recently_used = false;
+      continue;
+    }
+    remove_from_cache(slot);
+    free_code(code);
+    return true;
+  }
+  return false;
+}
+
+// Adds newly compiled code to the cache, if there's still room for it or
+// room can be made for it
+static Code *cache_code(Code *code) {
+  // Worker threads only ever read the cache
+  if (is_worker_thread ||
+      (code_cache_items >= CODE_CACHE_MAX_ITEMS && !evict_code()))
+  {
+    return code;
+  }
+
+  if (code_cache_items + 1 >= code_cache_size * CODE_CACHE_MAX_LOAD_FACTOR) {
+    code_cache_increase_size();
+  }
+  uint32_t slot = string_hash(&code->source) & (code_cache_size - 1);
+  while (code_cache[slot] != NULL) {
+    slot = (slot + 1) & (code_cache_size - 1);
+  }
+  code_cache[slot] = code;
+  code_cache_items++;
+  code->cached = true;
+  return code;
+}
+
+// Returns the compiled form of some code, which has to be given back with
+// release_code once it's finished running
+Code *get_code(const String *source) {
+  Code *code = find_code(source);
+  if (code != NULL) {
+    return code;
+  }
+  // Compiled code can outlive any sandbox, so it's never put in the region.
+  // Compiling may have cached code of its own, so it's only cached after
+  bool was_allocating = region_pause();
+  code = cache_code(compile(source));
+  region_resume(was_allocating);
+  return code;
+}
+
+// Compiles code from tokens it's already been split into, as get_code would
+// compile the code itself, taking ownership of the tokens. Block literals
+// are given their compiled code in order, which is taken ownership of too,
+// with NULL for any that still have to be compiled
+Code *compile_tokens(const String *source, String *tokens,
+                     uint32_t num_tokens, Code **blocks)
+{
+  Code *code = find_code(source);
+  if (code != NULL) {
+    for (uint32_t i = 0; i < num_tokens; i++) {
+      if (tokens[i].str_data[0] == '{' && *blocks != NULL) {
+        release_code(*blocks);
+      }
+      blocks += tokens[i].str_data[0] == '{';
+      free_string(&tokens[i]);
+    }
+    return code;
+  }
+  code = new_code(source);
+  for (uint32_t i = 0; i < num_tokens; i++) {
+    Code *block = tokens[i].str_data[0] == '{' ? *blocks++ : NULL;
+    add_instruction(code, compile_token(tokens[i], block));
+  }
+  fuse_pipelines(code);
+  fuse_instructions(code);
+  return cache_code(code);
+}
+
+// Adds code and the code of every block literal in it to the list, each only
+// once, with the blocks in code always coming before it
+void collect_code(CodeList *list, Code *code) {
+  for (uint32_t i = 0; i < list->length; i++) {
+    if (list->codes[i] == code) {
+      return;
+    }
+  }
+  for (uint32_t i = 0; i < code->length; i++) {
+    if (code->instructions[i].block != NULL) {
+      collect_code(list, code->instructions[i].block);
+    }
+  }
+
+  if (list->length == list->allocated) {
+    list->allocated = list->allocated == 0 ? 8 : list->allocated * 2;
+    list->codes = realloc(list->codes, sizeof(Code *) * list->allocated);
+    if (list->codes == NULL) {
+      error("Unable to allocate space for compiled code!");
+    }
+  }
+  list->codes[list->length++] = code;
+}
+
+// Holds on to code for another holder. Worker threads leave cached code's
+// holders alone, since nothing's evicted while they're running
+Code *retain_code(Code *code) {
+  if (!is_worker_thread || !code->cached) {
+    code->refs++;
+  }
+  if (!is_worker_thread) {
+    code->recently_used = true;
+  }
+  return code;
+}
+
+// Lets go of code, freeing it once nothing holds it unless it's cached, in
+// which case it stays until it's evicted
+void release_code(Code *code) {
+  if (is_worker_thread && code->cached) {
+    return;
+  }
+  if (--code->refs == 0 && !code->cached) {
+    free_code(code);
+  }
+}
+
+void free_code_cache() {
+  // Cached code can be shared by several blocks, so nothing is freed until
+  // every reference to cached code has been dropped
+  for (uint32_t i = 0; i < code_cache_size; i++) {
+    Code *code = code_cache[i];
+    for (uint32_t j = 0; code != NULL && j < code->length; j++) {
+      if (code->instructions[j].block != NULL &&
+          code->instructions[j].block->cached)
+      {
+        code->instructions[j].block = NULL;
+      }
+    }
+  }
+  for (uint32_t i = 0; i < code_cache_size; i++) {
+    if (code_cache[i] != NULL) {
+      free_code(code_cache[i]);
+    }
+  }
+  free(code_cache);
+  code_cache = NULL;
+  code_cache_items = code_cache_size = eviction_hand = 0;
+
+  if (literals.keys != NULL) {
+    free_map(&literals);
+    literals.keys = NULL;
+  }
+}
@@ -0,0 +1,511 @@
+// emit.c
+// Contains --emit-c, which translates a program into C that runs it with the
+// interpreter's runtime, and run_emitted, which that C starts the program
+// with. The program and every block literal in it each become a function
+// that stands in for interpreting that code whenever it's run, along with
+// the tokens the code was split into, which it's compiled from again without
+// going through its source
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "golf.h"
+
+// The C name of the builtin a token is defined as, or NULL if it isn't
+// defined as one that can be called directly, which leaves out the ones
+// that can't be called inside a sandbox
+static const char *builtin_name(const String *token) {
+  const BuiltinDefinition *builtin = find_builtin(token);
+  if (builtin == NULL || get_definition(token) != &builtin->item ||
+      !block_is_pure(&builtin->item))
+  {
+    return NULL;
+  }
+  return builtin->name;
+}
+
+// Collects every token the code in the list assigns to
+static void collect_assigned(const CodeList *list, Map *assigned) {
+  for (uint32_t i = 0; i < list->length; i++) {
+    Code *code = list->codes[i];
+    for (uint32_t j = 0; j + 1 < code->length; j++) {
+      if (code->instructions[j].op == OP_ASSIGN) {
+        map_set(assigned, copy_string(&code->instructions[j + 1].token),
+                make_integer(1));
+      }
+    }
+  }
+}
+
+// Writes characters as the inside of a C string literal, starting a new line
+// after each newline
+static void emit_chars(FILE *file, const unsigned char *chars,
+                       uint32_t length)
+{
+  for (uint32_t i = 0; i < length; i++) {
+    if (chars[i] == '\n')
+      fprintf(file, "\\n\"\n  \"");
+    else if (chars[i] == '"' || chars[i] == '\\' || chars[i] == '?')
+      fprintf(file, "\\%c", chars[i]);
+    else if (chars[i] < ' ' || chars[i] > '~')
+      fprintf(file, "\\%03o", chars[i]);
+    else
+      fputc(chars[i], file);
+  }
+}
+
+// Returns where in the list a piece of code is, which is the number it's
+// translated under
+static uint32_t code_number(const CodeList *list, const Code *code) {
+  uint32_t i = 0;
+  while (list->codes[i] != code) {
+    i++;
+  }
+  return i;
+}
+
+// Returns whether an instruction calls the given builtin, with its token
+// never assigned anything else by the program
+static bool calls_builtin(const Instruction *instr, Map *assigned,
+                          void (*builtin)(void))
+{
+  if (!is_token_op(instr->op) || map_get(assigned, &instr->token) != NULL) {
+    return false;
+  }
+  const Item *defined = get_definition(&instr->token);
+  return defined != NULL && defined->type == TYPE_FUNCTION &&
+         defined->function == builtin;
+}
+
+// Returns whether an instruction pushes a block literal whose token is never
+// assigned to, so that the code it pushes is known when it's translated
+static bool is_known_block(const Instruction *instr, Map *assigned) {
+  return instr->op == OP_LITERAL && instr->literal.type == TYPE_BLOCK &&
+         map_get(assigned, &instr->token) == NULL;
+}
+
+// Returns the next instruction after the given one that isn't blank, or the
+// length of the code if there isn't one, or if a blank instruction in between
+// might be assigned to or jumped to
+static uint32_t next_instruction(const Code *code, uint32_t i,
+                                 Map *assigned, const bool *is_target)
+{
+  uint32_t next = skip_blanks(code->instructions, code->length, i + 1);
+  for (uint32_t j = i + 1; j < next && j < code->length; j++) {
+    if (is_target[j] ||
+        map_get(assigned, &code->instructions[j].token) != NULL)
+    {
+      return code->length;
+    }
+  }
+  return next < code->length && !is_target[next] ? next : code->length;
+}
+
+// Writes C for a stack builtin that's run in place when there are enough
+// items on the stack and no brackets open that they could be moved past,
+// and called otherwise. Returns false if the instruction isn't one
+static bool emit_stack_op(FILE *file, const Instruction *instr,
+                          Map *assigned)
+{
+  static const struct {
+    void (*builtin)(void);
+    const char *name;
+    uint32_t needed;
+    const char *in_place;
+  } stack_ops[] = {
+    {builtin_period, "builtin_period", 1,
+     "stack_push(make_copy(&stack.items[stack.length - 1]));"},
+    {builtin_semicolon, "builtin_semicolon", 1,
+     "free_item(&stack.items[--stack.length]);"},
+    {builtin_backslash, "builtin_backslash", 2,
+     "swap_items(&stack.items[stack.length - 1], "
+     "&stack.items[stack.length - 2]);"},
+    {builtin_at, "builtin_at", 3,
+     "swap_items(&stack.items[stack.length - 3], "
+     "&stack.items[stack.length - 2]);\n"
+     "    swap_items(&stack.items[stack.length - 2], "
+     "&stack.items[stack.length - 1]);"}
+  };
+  for (uint32_t i = 0; i < sizeof(stack_ops) / sizeof(*stack_ops); i++) {
+    if (calls_builtin(instr, assigned, stack_ops[i].builtin)) {
+      fprintf(file, "  count_steps(1);\n");
+      fprintf(file, "  if (stack.length >= %u && ", stack_ops[i].needed);
+      fprintf(file, "bracket_stack.length == 0) {\n");
+      fprintf(file, "    %s\n", stack_ops[i].in_place);
+      fprintf(file, "  }\n");
+      fprintf(file, "  else {\n");
+      fprintf(file, "    %s();\n", stack_ops[i].name);
+      fprintf(file, "  }\n");
+      return true;
+    }
+  }
+  return false;
+}
+
+// Writes C for if, while, until, do or * run on block literals right before
+// them, which runs the code of the blocks directly instead of pushing them.
+// Returns the last instruction it covers, or the one it starts at if the
+// instructions there aren't like that
+static uint32_t emit_control_flow(FILE *file, const Code *code, uint32_t i,
+                                  const CodeList *list, Map *assigned,
+                                  const bool *is_target)
+{
+  const Instruction *instrs = code->instructions;
+  if (!is_known_block(&instrs[i], assigned)) {
+    return i;
+  }
+  uint32_t first = code_number(list, instrs[i].block);
+  uint32_t next = next_instruction(code, i, assigned, is_target);
+  if (next == code->length) {
+    return i;
+  }
+
+  uint32_t last = next;
+  uint32_t steps = count_non_blank(&instrs[i], last - i + 1);
+  if (calls_builtin(&instrs[next], assigned, builtin_do)) {
+    fprintf(file, "  count_steps(%u);\n", steps);
+    fprintf(file, "  do {\n");
+    fprintf(file, "    execute_code(codes[%u]);\n", first);
+    fprintf(file, "  } while (pop_boolean());\n");
+  }
+  else if (calls_builtin(&instrs[next], assigned, builtin_asterisk)) {
+    fprintf(file, "  count_steps(%u);\n", steps);
+    fprintf(file, "  if (stack.length > 0 && "
+                  "stack.items[stack.length - 1].type == TYPE_INTEGER) {\n");
+    fprintf(file, "    repeat_code(codes[%u], stack_pop_lazy().int_val);\n",
+            first);
+    fprintf(file, "  }\n");
+    fprintf(file, "  else {\n");
+    fprintf(file, "    stack_push(make_copy(&instrs[%u].literal));\n", i);
+    fprintf(file, "    builtin_asterisk();\n");
+    fprintf(file, "  }\n");
+  }
+  else if (is_known_block(&instrs[next], assigned)) {
+    uint32_t second = code_number(list, instrs[next].block);
+    last = next_instruction(code, next, assigned, is_target);
+    if (last == code->length) {
+      return i;
+    }
+    steps = count_non_blank(&instrs[i], last - i + 1);
+    if (calls_builtin(&instrs[last], assigned, builtin_if)) {
+      fprintf(file, "  count_steps(%u);\n", steps);
+      fprintf(file, "  execute_code(codes[pop_boolean() ? %u : %u]);\n",
+              first, second);
+    }
+    else if (calls_builtin(&instrs[last], assigned, builtin_while) ||
+             calls_builtin(&instrs[last], assigned, builtin_until))
+    {
+      bool is_while = calls_builtin(&instrs[last], assigned, builtin_while);
+      fprintf(file, "  count_steps(%u);\n", steps);
+      fprintf(file, "  execute_code(codes[%u]);\n", first);
+      fprintf(file, "  while (%spop_boolean()) {\n", is_while ? "" : "!");
+      fprintf(file, "    execute_code(codes[%u]);\n", second);
+      fprintf(file, "    execute_code(codes[%u]);\n", first);
+      fprintf(file, "  }\n");
+    }
+    else {
+      return i;
+    }
+  }
+  else {
+    return i;
+  }
+  return last;
+}
+
+// Writes the function that runs the given code, which is the same as
+// compiling it with --jit, except that the definitions it's compiled with
+// are the ones the program starts with. Tokens the program assigns to are
+// still looked up as it runs, and it goes back to the interpreter if
+// anything else is ever assigned to
+static void emit_code(FILE *file, Code *code, const CodeList *list,
+                      Map *assigned)
+{
+  uint32_t code_num = code_number(list, code);
+  bool *is_target = calloc(code->length + 1, sizeof(bool));
+  if (is_target == NULL) {
+    error("Unable to allocate space for compiled code!");
+  }
+  for (uint32_t i = 0; i < code->length; i++) {
+    uint32_t length = max_step_length(&code->instructions[i]);
+    if (length > 1) {
+      is_target[min(i + length, code->length)] = true;
+    }
+  }
+
+  fprintf(file, "static void run_%u(void) {\n", code_num);
+  fprintf(file, "  Instruction *instrs = codes[%u]->instructions;\n", code_num);
+  fprintf(file, "  const Instruction *end = instrs + codes[%u]->length;\n",
+          code_num);
+  fprintf(file, "  (void) instrs, (void) end;\n");
+
+  bool called = true;
+  for (uint32_t i = 0; i < code->length; i++) {
+    Instruction *instr = &code->instructions[i];
+    if (is_target[i]) {
+      fprintf(file, "i%u:\n", i);
+    }
+    if (called || is_target[i]) {
+      fprintf(file, "  if (emitted_code_stale) {\n");
+      fprintf(file, "    execute_code_from(codes[%u], %u);\n", code_num, i);
+      fprintf(file, "    return;\n");
+      fprintf(file, "  }\n");
+      called = false;
+    }
+
+    uint32_t last = emit_control_flow(file, code, i, list, assigned,
+                                      is_target);
+    if (last != i) {
+      i = last;
+      called = true;
+      continue;
+    }
+    if (emit_stack_op(file, instr, assigned)) {
+      continue;
+    }
+    if ((is_token_op(instr->op) || instr->op == OP_LITERAL) &&
+        map_get(assigned, &instr->token) == NULL)
+    {
+      const char *name = builtin_name(&instr->token);
+      if (get_definition(&instr->token) == NULL && is_token_op(instr->op)) {
+        continue;
+      }
+      else if (get_definition(&instr->token) == NULL &&
+               instr->literal.type == TYPE_INTEGER &&
+               bigint_fits_in_int64(&instr->literal.int_val) &&
+               bigint_to_int64(&instr->literal.int_val) != INT64_MIN)
+      {
+        fprintf(file, "  count_steps(1);\n");
+        fprintf(file, "  stack_push(make_integer(INT64_C(%" PRId64 ")));\n",
+                bigint_to_int64(&instr->literal.int_val));
+        continue;
+      }
+      else if (get_definition(&instr->token) == NULL) {
+        fprintf(file, "  count_steps(1);\n");
+        fprintf(file, "  stack_push(make_copy(&instrs[%u].literal));\n", i);
+        continue;
+      }
+      else if (name != NULL) {
+        fprintf(file, "  count_steps(1);\n");
+        fprintf(file, "  %s();\n", name);
+        called = true;
+        continue;
+      }
+    }
+
+    static const char *op_names[] = {
+      [OP_TOKEN] = "OP_TOKEN", [OP_LITERAL] = "OP_LITERAL",
+      [OP_ASSIGN] = "OP_ASSIGN", [OP_PIPELINE] = "OP_PIPELINE",
+      [OP_FUSED] = "OP_FUSED"
+    };
+    enum Opcode op = is_token_op(instr->op) ? OP_TOKEN : instr->op;
+    uint32_t length = max_step_length(instr);
+    if (length > 1) {
+      fprintf(file, "  if (instruction_steps[%s](&instrs[%u], end) != 1) ",
+              op_names[op], i);
+      fprintf(file, "goto i%u;\n", min(i + length, code->length));
+    }
+    else {
+      fprintf(file, "  instruction_steps[%s](&instrs[%u], end);\n",
+              op_names[op], i);
+    }
+    called = true;
+  }
+
+  if (is_target[code->length]) {
+    fprintf(file, "i%u:;\n", code->length);
+  }
+  fprintf(file, "}\n\n");
+  free(is_target);
+}
+
+// Returns how many tokens the code was compiled from
+static uint32_t count_tokens(const Code *code) {
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < code->length; i++) {
+    enum Opcode op = code->instructions[i].op;
+    count += op != OP_FUSED && op != OP_PIPELINE;
+  }
+  return count;
+}
+
+// Returns how many block literals are in the code
+static uint32_t count_blocks(const Code *code) {
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < code->length; i++) {
+    count += code->instructions[i].block != NULL;
+  }
+  return count;
+}
+
+// Writes the tokens a piece of code was split into, and which code each block
+// literal among them is, for run_emitted to compile the code from. Fused
+// instructions and pipelines stand in for instructions kept after them, so
+// they're left out, the same as in a .gsc file
+static void emit_tokens(FILE *file, const Code *code, const CodeList *list) {
+  uint32_t code_num = code_number(list, code);
+  if (count_tokens(code) == 0) {
+    return;
+  }
+
+  fprintf(file, "static const char *const tokens_%u[] = {\n", code_num);
+  for (uint32_t i = 0; i < code->length; i++) {
+    const Instruction *instr = &code->instructions[i];
+    if (instr->op != OP_FUSED && instr->op != OP_PIPELINE) {
+      fprintf(file, "  \"");
+      emit_chars(file, instr->token.str_data, instr->token.length);
+      fprintf(file, "\",\n");
+    }
+  }
+  fprintf(file, "};\n");
+
+  fprintf(file, "static const uint32_t lengths_%u[] = {", code_num);
+  for (uint32_t i = 0, j = 0; i < code->length; i++) {
+    const Instruction *instr = &code->instructions[i];
+    if (instr->op != OP_FUSED && instr->op != OP_PIPELINE) {
+      fprintf(file, "%s%s%u", j == 0 ? "" : ",", j % 16 == 0 ? "\n  " : " ",
+              instr->token.length);
+      j++;
+    }
+  }
+  fprintf(file, "\n};\n");
+
+  if (count_blocks(code) > 0) {
+    fprintf(file, "static const uint32_t blocks_%u[] = {", code_num);
+    for (uint32_t i = 0, j = 0; i < code->length; i++) {
+      const Instruction *instr = &code->instructions[i];
+      if (instr->block != NULL) {
+        fprintf(file, "%s%s%u", j == 0 ? "" : ",",
+                j % 16 == 0 ? "\n  " : " ", code_number(list, instr->block));
+        j++;
+      }
+    }
+    fprintf(file, "\n};\n");
+  }
+  fprintf(file, "\n");
+}
+
+// Writes a C translation of a program to a file. The C is linked with every
+// object file but main.o, and runs the program the same way the interpreter
+// would, with the definitions of the builtins it never redefines built in
+void emit_c(const String *source, const char *filename) {
+  init_definitions();
+  Code *program = get_code(source);
+  CodeList list = {NULL, 0, 0};
+  Map assigned = new_map();
+  collect_code(&list, program);
+  collect_assigned(&list, &assigned);
+  for (uint32_t i = 0; i < list.length; i++) {
+    Code *code = list.codes[i];
+    if (code->length > 0 &&
+        code->instructions[code->length - 1].op == OP_ERROR)
+    {
+      error("Unable to translate a program with a malformed token!");
+    }
+  }
+
+  FILE *file = fopen(filename, "w");
+  if (file == NULL) {
+    error("Unable to open '%s'!", filename);
+  }
+  fprintf(file, "// Compiled from golfscript by golf --emit-c\n\n");
+  fprintf(file, "#include \"golf.h\"\n\n");
+  fprintf(file, "static Code *codes[%u];\n\n", list.length);
+  fprintf(file, "static inline bool pop_boolean(void) {\n");
+  fprintf(file, "  Item cond = stack_pop_lazy();\n");
+  fprintf(file, "  bool is_true = item_boolean(&cond);\n");
+  fprintf(file, "  free_item(&cond);\n");
+  fprintf(file, "  return is_true;\n");
+  fprintf(file, "}\n\n");
+  for (uint32_t i = 0; i < list.length; i++) {
+    emit_code(file, list.codes[i], &list, &assigned);
+  }
+  for (uint32_t i = 0; i < list.length; i++) {
+    emit_tokens(file, list.codes[i], &list);
+  }
+
+  fprintf(file, "static const EmittedCode emitted[] = {\n");
+  for (uint32_t i = 0; i < list.length; i++) {
+    Code *code = list.codes[i];
+    uint32_t num_tokens = count_tokens(code);
+    fprintf(file, "  {\"");
+    emit_chars(file, code->source.str_data, code->source.length);
+    fprintf(file, "\", %u,\n", code->source.length);
+    if (num_tokens > 0)
+      fprintf(file, "   tokens_%u, lengths_%u, %u, ", i, i, num_tokens);
+    else
+      fprintf(file, "   NULL, NULL, 0, ");
+    if (count_blocks(code) > 0)
+      fprintf(file, "blocks_%u, ", i);
+    else
+      fprintf(file, "NULL, ");
+    fprintf(file, "%u, run_%u},\n", code->length, i);
+  }
+  fprintf(file, "};\n\n");
+
+  fprintf(file, "int main(void) {\n");
+  fprintf(file, "  run_emitted(emitted, codes, %u);\n", list.length);
+  fprintf(file, "  return 0;\n");
+  fprintf(file, "}\n");
+  fclose(file);
+
+  release_code(program);
+  free(list.codes);
+  free_map(&assigned);
+  free_definitions();
+  free_code_cache();
+}
+
+// Runs a program translated by --emit-c, given the tokens and function of
+// each piece of code in it. The code is numbered the same way as it was when
+// it was translated, with blocks before the code they're in and the program
+// last, so each piece is compiled from its tokens after its blocks are
+void run_emitted(const EmittedCode emitted[], Code *codes[],
+                 uint32_t num_codes)
+{
+  init_interpreter();
+  for (uint32_t i = 0; i < num_codes; i++) {
+    const EmittedCode *code = &emitted[i];
+    String source = string_from_chars((const unsigned char *) code->source,
+                                      code->source_length);
+    String *tokens = malloc(sizeof(String) * max(code->num_tokens, 1));
+    Code **blocks = malloc(sizeof(Code *) * max(code->num_tokens, 1));
+    if (tokens == NULL || blocks == NULL) {
+      error("Unable to allocate space for compiled code!");
+    }
+    uint32_t num_blocks = 0;
+    for (uint32_t j = 0; j < code->num_tokens; j++) {
+      tokens[j] = string_from_chars((const unsigned char *) code->tokens[j],
+                                    code->token_lengths[j]);
+      if (tokens[j].str_data[0] == '{') {
+        blocks[num_blocks] = retain_code(codes[code->blocks[num_blocks]]);
+        num_blocks++;
+      }
+    }
+    codes[i] = compile_tokens(&source, tokens, code->num_tokens, blocks);
+    free(tokens);
+    free(blocks);
+    free_string(&source);
+
+    if (codes[i]->length != code->length) {
+      error("Compiled program doesn't match the interpreter's runtime!");
+    }
+    codes[i]->native = code->native;
+    codes[i]->native_size = 0;
+    codes[i]->native_version = NATIVE_CHECKED;
+  }
+
+  CodeList list = {codes, num_codes, num_codes};
+  Map assigned = new_map();
+  collect_assigned(&list, &assigned);
+  assigned_tokens = &assigned;
+
+  execute_code(codes[num_codes - 1]);
+  for (uint32_t i = 0; i < num_codes; i++) {
+    release_code(codes[i]);
+  }
+  end_interpreter();
+  assigned_tokens = NULL;
+  free_map(&assigned);
+}
@@ -5,14 +5,42 @@
 #include <stdlib.h>
 #include "golf.h"
 
-noreturn void error(const char *msg, ...) {
-  va_list ap;
+// While speculative work is running in a sandbox, errors unwind back to the
+// sandbox instead of ending the program, so the work can be redone normally
+_Thread_local jmp_buf *sandbox_escape;
+
+// Prints the error message
+static void report_error(const char *msg, va_list ap) {
+  // Whatever was output before the error is written out first
+  output_flush();
 
-  va_start(ap, msg);
   fprintf(stderr, "Error! ");
   vfprintf(stderr, msg, ap);
   fprintf(stderr, "\n");
-  va_end(ap);
+}
+
+noreturn void error(const char *msg, ...) {
+  va_list ap;
 
+  if (sandbox_escape != NULL) {
+    longjmp(*sandbox_escape, 1);
+  }
+  va_start(ap, msg);
+  report_error(msg, ap);
+  va_end(ap);
   exit(1);
 }
+
+// Ends the program the same way as error, but with an exit status of its own
+// for the program's caller to tell the error apart by
+noreturn void error_with_status(int status, const char *msg, ...) {
+  va_list ap;
+
+  if (sandbox_escape != NULL) {
+    longjmp(*sandbox_escape, 1);
+  }
+  va_start(ap, msg);
+  report_error(msg, ap);
+  va_end(ap);
+  exit(status);
+}
@@ -2,104 +2,170 @@
 // Contains functions for executing golfscript code, and for starting/ending
 // the interpreter
 
-#include <ctype.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include "golf.h"
 
-Array stack;
-Array bracket_stack;
+_Thread_local Array stack;
+_Thread_local Array bracket_stack;
 
-static Map definitions;
+// What every token that's been assigned to is defined as, which shadows
+// whatever it started off defined as
+Map definitions;
+
+// How many times code has to be run with --jit before it's compiled into
+// machine code
+#define JIT_THRESHOLD 64
+
+// Bumped whenever anything is assigned, so that instructions know when the
+// definition they last looked up could have changed
+uint64_t definitions_version = 1;
+
+// For a program compiled ahead of time with --emit-c, the tokens it assigns
+// to itself, and whether anything else has been assigned to since, which
+// leaves the definitions built into its functions out of date
+Map *assigned_tokens;
+bool emitted_code_stale;
 
 void init_interpreter() {
-  // Initializes the program's stack
-  stack = new_array();
+  init_interpreter_without_input();
 
-  // Pushes the input onto the stack
+  // Pushes the input onto the stack, which is only read as it's needed
   // If input is not being piped into the program, it pushes an empty string
   if (isatty(STDIN_FILENO)) {
     stack_push(empty_string());
   }
   else {
-    Item first_item = {TYPE_STRING, .str_val = read_file_to_string(stdin)};
-    stack_push(first_item);
+    stack_push(make_input());
   }
+}
+
+// Starts the interpreter with nothing on the stack, for when the input is
+// pushed some other way
+void init_interpreter_without_input() {
+  // Initializes the program's stack
+  stack = new_array();
 
   // Initializes the array used to keep track of the size of the stack
   // after a left bracket is executed
   bracket_stack = new_array();
 
-  // Initializes the built-in functions
-  definitions = new_map();
-  map_set(&definitions, create_string("&"), make_builtin(builtin_ampersand));
-  map_set(&definitions, create_string("*"), make_builtin(builtin_asterisk));
-  map_set(&definitions, create_string("@"), make_builtin(builtin_at));
-  map_set(&definitions, create_string("\\"), make_builtin(builtin_backslash));
-  map_set(&definitions, create_string("`"), make_builtin(builtin_backtick));
-  map_set(&definitions, create_string("|"), make_builtin(builtin_bar));
-  map_set(&definitions, create_string("^"), make_builtin(builtin_caret));
-  map_set(&definitions, create_string(","), make_builtin(builtin_comma));
-  map_set(&definitions, create_string("$"), make_builtin(builtin_dollar_sign));
-  map_set(&definitions, create_string("="), make_builtin(builtin_equal));
-  map_set(&definitions, create_string("!"), make_builtin(builtin_exclamation));
-  map_set(&definitions, create_string(">"), make_builtin(builtin_greater_than));
-  map_set(&definitions, create_string("["), make_builtin(builtin_lbracket));
-  map_set(&definitions, create_string("<"), make_builtin(builtin_less_than));
-  map_set(&definitions, create_string("("), make_builtin(builtin_lparen));
-  map_set(&definitions, create_string("-"), make_builtin(builtin_minus));
-  map_set(&definitions, create_string("%"), make_builtin(builtin_percent));
-  map_set(&definitions, create_string("."), make_builtin(builtin_period));
-  map_set(&definitions, create_string("+"), make_builtin(builtin_plus));
-  map_set(&definitions, create_string("?"), make_builtin(builtin_question));
-  map_set(&definitions, create_string("]"), make_builtin(builtin_rbracket));
-  map_set(&definitions, create_string(")"), make_builtin(builtin_rparen));
-  map_set(&definitions, create_string(";"), make_builtin(builtin_semicolon));
-  map_set(&definitions, create_string("/"), make_builtin(builtin_slash));
-  map_set(&definitions, create_string("~"), make_builtin(builtin_tilde));
-  map_set(&definitions, create_string("abs"), make_builtin(builtin_abs));
-  map_set(&definitions, create_string("base"), make_builtin(builtin_base));
-  map_set(&definitions, create_string("do"), make_builtin(builtin_do));
-  map_set(&definitions, create_string("if"), make_builtin(builtin_if));
-  map_set(&definitions, create_string("print"), make_builtin(builtin_print));
-  map_set(&definitions, create_string("rand"), make_builtin(builtin_rand));
-  map_set(&definitions, create_string("until"), make_builtin(builtin_until));
-  map_set(&definitions, create_string("while"), make_builtin(builtin_while));
-  map_set(&definitions, create_string("zip"), make_builtin(builtin_zip));
-
-  map_set(&definitions, create_string("n"),
-          make_block(create_string("\"\n\"")));
-
-  map_set(&definitions, create_string("puts"),
-          make_block(create_string("print n print")));
-
-  map_set(&definitions, create_string("p"),
-          make_block(create_string("`puts")));
-
-  map_set(&definitions, create_string("and"),
-          make_block(create_string("1$if")));
-
-  map_set(&definitions, create_string("or"),
-          make_block(create_string("1$\\if")));
-
-  map_set(&definitions, create_string("xor"),
-          make_block(create_string("\\!!{!}*")));
+  init_definitions();
 
   // Initializes random number generator for the rand function
   init_rng();
+
+  init_call_stack();
+}
+
+// The definitions every token starts off with, placed by BUILTIN_HASH, so
+// that nothing has to be set up for them when the interpreter starts. A
+// definition that collides with another is an error, since -Wextra warns
+// about initializing the same element twice. Builtins with opcodes of their
+// own are compiled into those
+#define FUNCTION(token, first, last, f) \
+  [BUILTIN_HASH(first, last, sizeof(token) - 1)] = \
+    {token, #f, {TYPE_FUNCTION, .function = f}, OP_TOKEN}
+#define OPCODE(token, c, f, op) \
+  [BUILTIN_HASH(c, c, 1)] = \
+    {token, #f, {TYPE_FUNCTION, .function = f}, op}
+
+const BuiltinDefinition builtins[BUILTIN_SLOTS] = {
+  FUNCTION("&", '&', '&', builtin_ampersand),
+  OPCODE("*", '*', builtin_asterisk, OP_ASTERISK),
+  OPCODE("@", '@', builtin_at, OP_AT),
+  OPCODE("\\", '\\', builtin_backslash, OP_BACKSLASH),
+  FUNCTION("`", '`', '`', builtin_backtick),
+  FUNCTION("|", '|', '|', builtin_bar),
+  FUNCTION("^", '^', '^', builtin_caret),
+  OPCODE(",", ',', builtin_comma, OP_COMMA),
+  OPCODE("$", '$', builtin_dollar_sign, OP_DOLLAR_SIGN),
+  OPCODE("=", '=', builtin_equal, OP_EQUAL),
+  OPCODE("!", '!', builtin_exclamation, OP_EXCLAMATION),
+  OPCODE(">", '>', builtin_greater_than, OP_GREATER_THAN),
+  OPCODE("[", '[', builtin_lbracket, OP_LBRACKET),
+  OPCODE("<", '<', builtin_less_than, OP_LESS_THAN),
+  OPCODE("(", '(', builtin_lparen, OP_LPAREN),
+  OPCODE("-", '-', builtin_minus, OP_MINUS),
+  OPCODE("%", '%', builtin_percent, OP_PERCENT),
+  OPCODE(".", '.', builtin_period, OP_PERIOD),
+  OPCODE("+", '+', builtin_plus, OP_PLUS),
+  FUNCTION("?", '?', '?', builtin_question),
+  OPCODE("]", ']', builtin_rbracket, OP_RBRACKET),
+  OPCODE(")", ')', builtin_rparen, OP_RPAREN),
+  OPCODE(";", ';', builtin_semicolon, OP_SEMICOLON),
+  OPCODE("/", '/', builtin_slash, OP_SLASH),
+  FUNCTION("~", '~', '~', builtin_tilde),
+  FUNCTION("abs", 'a', 's', builtin_abs),
+  FUNCTION("base", 'b', 'e', builtin_base),
+  FUNCTION("do", 'd', 'o', builtin_do),
+  FUNCTION("if", 'i', 'f', builtin_if),
+  FUNCTION("print", 'p', 't', builtin_print),
+  FUNCTION("rand", 'r', 'd', builtin_rand),
+  FUNCTION("until", 'u', 'l', builtin_until),
+  FUNCTION("while", 'w', 'e', builtin_while),
+  FUNCTION("zip", 'z', 'p', builtin_zip),
+  FUNCTION("n", 'n', 'n', builtin_n),
+  FUNCTION("puts", 'p', 's', builtin_puts),
+  FUNCTION("p", 'p', 'p', builtin_p),
+  FUNCTION("and", 'a', 'd', builtin_and),
+  FUNCTION("or", 'o', 'r', builtin_or),
+  FUNCTION("xor", 'x', 'r', builtin_xor)
+};
+
+// Returns what a token starts off defined as, or NULL if it isn't a builtin
+const BuiltinDefinition *find_builtin(const String *token) {
+  if (token->length == 0) {
+    return NULL;
+  }
+  const BuiltinDefinition *builtin = &builtins[BUILTIN_HASH(
+    token->str_data[0], token->str_data[token->length - 1], token->length)];
+  if (builtin->token == NULL || strlen(builtin->token) != token->length ||
+      memcmp(builtin->token, token->str_data, token->length) != 0)
+  {
+    return NULL;
+  }
+  return builtin;
+}
+
+// Everything assigned to is defined in a map in front of the builtins, which
+// starts off empty
+void init_definitions() {
+  definitions = new_map();
+}
+
+void free_definitions() {
+  free_map(&definitions);
 }
 
 void end_interpreter() {
-  Item stack_as_item = {TYPE_ARRAY, .arr_val = stack};
+  output_stack();
+  free_interpreter();
+}
+
+// Outputs everything on the stack with puts, as is done once a program ends
+void output_stack() {
+  for (uint32_t i = 0; i < stack.length; i++) {
+    item_expand(&stack.items[i]);
+  }
+  Item stack_as_item = make_array_from(stack);
   stack = new_array();
   stack_push(stack_as_item);
   String puts_str = create_string("puts");
-  Item *puts_function = map_get(&definitions, &puts_str);
+  Item *puts_function = get_definition(&puts_str);
   execute_item(puts_function);
   free_string(&puts_str);
+}
+
+// Frees everything the interpreter has, without outputting the stack
+void free_interpreter() {
   free_array(&stack);
-  free_map(&definitions);
+  free_definitions();
+  free_input();
+  free_code_cache();
+  free_call_stack();
 }
 
 // Pushes an item to the stack
@@ -107,7 +173,15 @@ void stack_push(Item item) {
   array_push(&stack, item);
 }
 
+// Pops an item, turning lazy items like ranges into the items they stand for
 Item stack_pop() {
+  Item item = stack_pop_lazy();
+  item_expand(&item);
+  return item;
+}
+
+// Pops an item as it is, for builtins that know how to handle lazy items
+Item stack_pop_lazy() {
   if (stack.length == 0) {
     error("Cannot pop from empty stack!");
   }
@@ -123,223 +197,372 @@ Item stack_pop() {
   return stack.items[stack.length];
 }
 
-int hex_digit_val(char c) {
-  if (c >= '0' && c <= '9')
-    return c - '0';
-  else if (c >= 'a' && c <= 'f')
-    return c - 'a' + 10;
-  else if (c >= 'A' && c <= 'F')
-    return c - 'A' + 10;
+// Returns what a token is currently defined as, or NULL if it isn't defined
+Item *get_definition(const String *name) {
+  Item *defined_item = definitions.num_items > 0
+                     ? map_get(&definitions, name) : NULL;
+  if (defined_item != NULL) {
+    return defined_item;
+  }
+  // The builtin definitions are never changed through what's returned
+  const BuiltinDefinition *builtin = find_builtin(name);
+  return builtin != NULL ? (Item *) &builtin->item : NULL;
+}
+
+// Returns what an instruction's token is defined as, or NULL if it isn't
+Item *instruction_definition(Instruction *instr) {
+  if (instr->definitions_version == definitions_version) {
+    return instr->definition;
+  }
+  Item *defined_item = get_definition(&instr->token);
+
+  // Worker threads share the code they run, so they leave it alone
+  if (!is_worker_thread) {
+    instr->definition = defined_item;
+    instr->definitions_version = definitions_version;
+  }
+  return defined_item;
+}
+
+// Set while if or ~ is run as the last instruction of its code, so that
+// whatever block it runs can be run in the code's place
+_Thread_local bool in_tail_position;
+
+// Code that the code that's just been run left to be run in its place, so
+// that a block called at the end of a block doesn't go any deeper
+static _Thread_local Code *tail_code;
+
+// Runs an item as the last thing the code being run does, leaving a block
+// for execute_code to run once that code is done with
+void execute_tail_item(Item *item) {
+  if (item->type == TYPE_BLOCK)
+    tail_code = get_code(item->str_val);
   else
-    return -1;
+    execute_item(item);
 }
 
-bool is_octal_digit(char c) {
-  return c >= '0' && c <= '7';
+// Runs a definition in place of the instruction it was found for, which is
+// the last of its code if is_last is set
+static inline void run_definition(Item *defined_item, bool is_last) {
+  if (sandbox_escape != NULL) {
+    sandbox_check(defined_item);
+  }
+  if (defined_item->type == TYPE_FUNCTION) {
+    in_tail_position = is_last &&
+                       (defined_item->function == builtin_if ||
+                        defined_item->function == builtin_tilde);
+    defined_item->function();
+  }
+  else if (is_last) {
+    execute_tail_item(defined_item);
+  }
+  else {
+    execute_item(defined_item);
+  }
 }
 
-String get_number(String *str, String *cur_tok, uint32_t *code_pos) {
-  while (++(*code_pos) < str->length && isdigit(str->str_data[*code_pos])) {
-    string_add_char(cur_tok, str->str_data[*code_pos]);
+// The steps that run each kind of instruction, shared by the interpreter and
+// by native code. Each returns how many instructions it used, with end being
+// the end of the instructions it's in. Every instruction that does something
+// counts as a step toward --max-steps, so tokens that aren't defined, like
+// whitespace, don't
+
+static uint32_t step_token(Instruction *instr, const Instruction *end) {
+  Item *defined_item = instruction_definition(instr);
+  if (defined_item != NULL) {
+    count_steps(1);
+    run_definition(defined_item, instr + 1 == end);
   }
-  return *cur_tok;
+  return 1;
 }
 
-String get_raw_string(String *str, String *cur_tok, uint32_t *code_pos) {
-  while (++(*code_pos) < str->length) {
-    char c = str->str_data[*code_pos];
-    if (c == '\\' && *code_pos + 1 < str->length) {
-      if (str->str_data[*code_pos + 1] == '\\' ||
-          str->str_data[*code_pos + 1] == '\'')
-      {
-        c = str->str_data[++(*code_pos)];
-      }
-    }
-    else if (c == '\'') {
-      ++(*code_pos);
-      return *cur_tok;
-    }
-    string_add_char(cur_tok, c);
+// Calls the builtin an instruction has the opcode of, unless its token has
+// been given another definition since. Those builtins can all be run inside
+// a sandbox, and none of them look at whether they're in tail position
+static inline uint32_t step_builtin(Instruction *instr, const Instruction *end,
+                                    void (*builtin)(void))
+{
+  Item *defined_item = instruction_definition(instr);
+  if (defined_item == NULL || defined_item->type != TYPE_FUNCTION ||
+      defined_item->function != builtin)
+  {
+    return step_token(instr, end);
   }
+  count_steps(1);
+  builtin();
+  return 1;
+}
 
-  error("Unmatched ' encountered in the code!");
+static uint32_t step_literal(Instruction *instr, const Instruction *end) {
+  count_steps(1);
+  Item *defined_item = instruction_definition(instr);
+  if (defined_item != NULL)
+    run_definition(defined_item, instr + 1 == end);
+  else
+    stack_push(make_copy(&instr->literal));
+  return 1;
 }
 
-String get_escaped_string(String *str, String *cur_tok, uint32_t *code_pos) {
-  while (++(*code_pos) < str->length) {
-    unsigned char c = str->str_data[*code_pos];
-    if (c == '"') {
-      ++*code_pos;
-      return *cur_tok;
-    }
-    else if (c == '\\') {
-      if (++(*code_pos) >= str->length) {
-        break;
-      }
-      else {
-        c = str->str_data[*code_pos];
-        switch (c) {
-          case 'a': c = '\a';   break;
-          case 'b': c = '\b';   break;
-          case 'e': c = '\x1b'; break;
-          case 'f': c = '\f';   break;
-          case 'n': c = '\n';   break;
-          case 'r': c = '\r';   break;
-          case 's': c =  ' ';   break;
-          case 't': c = '\t';   break;
-          case 'v': c = '\v';   break;
-          case 'x':
-            // Hexadecimal literal
-            if (++(*code_pos) >= str->length)
-              error("Unmatched \" encountered in the code!");
-            if (hex_digit_val(str->str_data[*code_pos]) < 0)
-              error("Invalid hex literal!");
-            c = hex_digit_val(str->str_data[*code_pos]);
-            if (*code_pos + 1 < str->length &&
-                hex_digit_val(str->str_data[*code_pos + 1]) >= 0)
-            {
-              c <<= 4;
-              c += hex_digit_val(str->str_data[++(*code_pos)]);
-            }
-            break;
-          default:
-            // Octal literals
-            if (is_octal_digit(c)) {
-              c = 0;
-              for (int i = 0; i < 3; i++) {
-                c = c << 3 | (str->str_data[*code_pos] - '0');
-                if (*code_pos + 1 >= str->length)
-                  error("Unmatched \" encountered in the code!");
-                if (i < 2 && is_octal_digit(str->str_data[*code_pos + 1])) {
-                  *code_pos += 1;
-                }
-                else {
-                  break;
-                }
-              }
-            }
-            break;
-        }
-      }
-    }
-    string_add_char(cur_tok, c);
+static uint32_t step_assign(Instruction *instr, const Instruction *end) {
+  count_steps(1);
+  Item *defined_item = instruction_definition(instr);
+  if (defined_item != NULL) {
+    run_definition(defined_item, instr + 1 == end);
+    return 1;
   }
-
-  error("Unmatched \" encountered in the code!");
+  if (sandbox_escape != NULL) {
+    error("Cannot define inside a sandbox!");
+  }
+  if (stack.length == 0) {
+    error("Unable to define from empty stack!");
+  }
+  if (instr + 1 >= end) {
+    error("No token to assign to!");
+  }
+  Instruction *to_define = instr + 1;
+  if (to_define->op == OP_ERROR) {
+    error("%s", to_define->error_msg);
+  }
+  Item top_item = make_copy(&stack.items[stack.length - 1]);
+  map_set(&definitions, copy_string(&to_define->token), top_item);
+  definitions_version++;
+  if (assigned_tokens != NULL &&
+      map_get(assigned_tokens, &to_define->token) == NULL)
+  {
+    emitted_code_stale = true;
+  }
+  return 2;
 }
 
-String get_identifier(String *str, String *cur_tok, uint32_t *code_pos) {
-  while (++(*code_pos) < str->length) {
-    char c = str->str_data[*code_pos];
-    if (isalnum(c) || c == '_')
-      string_add_char(cur_tok, c);
-    else
-      break;
+static uint32_t step_pipeline(Instruction *instr, const Instruction *end) {
+  (void) end;
+  if (run_pipeline(instr->pipeline, instr + 1)) {
+    count_steps(instr->pipeline->num_steps);
+    return 1 + instr->pipeline->num_instructions;
   }
-  return *cur_tok;
+  return 1;
 }
 
-String get_block(String *str, String *cur_tok, uint32_t *code_pos) {
-  int brace_level = 1;
-  while (++(*code_pos) < str->length && brace_level > 0) {
-    char c = str->str_data[*code_pos];
-    if (c == '{')
-      brace_level++;
-    else if (c == '}')
-      brace_level--;
-    if (brace_level > 0)
-      string_add_char(cur_tok, str->str_data[*code_pos]);
+static uint32_t step_fused(Instruction *instr, const Instruction *end) {
+  (void) end;
+  if (run_fused(instr->fused, instr + 1)) {
+    count_steps(instr->fused->num_steps);
+    return 1 + instr->fused->num_instructions;
   }
+  return 1;
+}
 
-  if (*code_pos > str->length)
-    error("Unmatched { encountered in the code!");
+static uint32_t step_error(Instruction *instr, const Instruction *end) {
+  (void) end;
+  error("%s", instr->error_msg);
+}
 
-  return *cur_tok;
+// Returns how many instructions an instruction's step can use at most
+uint32_t max_step_length(const Instruction *instr) {
+  if (instr->op == OP_PIPELINE)
+    return 1 + instr->pipeline->num_instructions;
+  else if (instr->op == OP_FUSED)
+    return 1 + instr->fused->num_instructions;
+  else if (instr->op == OP_ASSIGN)
+    return 2;
+  return 1;
 }
 
-String get_comment(String *str, String *cur_tok, uint32_t *code_pos) {
-  while (++(*code_pos) < str->length && str->str_data[*code_pos] != '\n') {
-    string_add_char(cur_tok, str->str_data[*code_pos]);
+const Step instruction_steps[] = {
+  [OP_TOKEN]    = step_token,
+  [OP_LITERAL]  = step_literal,
+  [OP_ASSIGN]   = step_assign,
+  [OP_PIPELINE] = step_pipeline,
+  [OP_FUSED]    = step_fused,
+  [OP_ERROR]    = step_error
+};
+
+// Each kind of instruction has a handler of its own. Compilers with computed
+// gotos jump from the end of each handler straight to the next one, so that
+// every handler has its own indirect jump for the branch predictor to learn
+// from, and other compilers make the handlers the cases of a switch
+#ifdef __GNUC__
+#define COMPUTED_GOTO
+#endif
+
+#ifdef COMPUTED_GOTO
+#define HANDLER(op) handle_##op
+#define NEXT(n) do {                                  \
+    instr += (n);                                     \
+    if (instr >= end) {                               \
+      return;                                         \
+    }                                                 \
+    __extension__ ({ goto *handlers[instr->op]; });   \
+  } while (0)
+#else
+#define HANDLER(op) case op
+#define NEXT(n) instr += (n); continue
+#endif
+
+#define BUILTIN_HANDLER(op, builtin) \
+  HANDLER(op): NEXT(step_builtin(instr, end, builtin))
+
+// Runs code with the interpreter, from the given instruction onwards
+void execute_code_from(Code *code, uint32_t start) {
+  // Compiled code never changes once it's running, so the instructions can
+  // be walked through directly
+  Instruction *instr = code->instructions + start;
+  Instruction *end = code->instructions + code->length;
+
+#ifdef COMPUTED_GOTO
+  static const void *const handlers[] = {
+    [OP_TOKEN]        = __extension__ &&HANDLER(OP_TOKEN),
+    [OP_LITERAL]      = __extension__ &&HANDLER(OP_LITERAL),
+    [OP_ASSIGN]       = __extension__ &&HANDLER(OP_ASSIGN),
+    [OP_PIPELINE]     = __extension__ &&HANDLER(OP_PIPELINE),
+    [OP_FUSED]        = __extension__ &&HANDLER(OP_FUSED),
+    [OP_ERROR]        = __extension__ &&HANDLER(OP_ERROR),
+    [OP_PLUS]         = __extension__ &&HANDLER(OP_PLUS),
+    [OP_MINUS]        = __extension__ &&HANDLER(OP_MINUS),
+    [OP_ASTERISK]     = __extension__ &&HANDLER(OP_ASTERISK),
+    [OP_SLASH]        = __extension__ &&HANDLER(OP_SLASH),
+    [OP_PERCENT]      = __extension__ &&HANDLER(OP_PERCENT),
+    [OP_COMMA]        = __extension__ &&HANDLER(OP_COMMA),
+    [OP_PERIOD]       = __extension__ &&HANDLER(OP_PERIOD),
+    [OP_SEMICOLON]    = __extension__ &&HANDLER(OP_SEMICOLON),
+    [OP_BACKSLASH]    = __extension__ &&HANDLER(OP_BACKSLASH),
+    [OP_AT]           = __extension__ &&HANDLER(OP_AT),
+    [OP_DOLLAR_SIGN]  = __extension__ &&HANDLER(OP_DOLLAR_SIGN),
+    [OP_EQUAL]        = __extension__ &&HANDLER(OP_EQUAL),
+    [OP_LESS_THAN]    = __extension__ &&HANDLER(OP_LESS_THAN),
+    [OP_GREATER_THAN] = __extension__ &&HANDLER(OP_GREATER_THAN),
+    [OP_LPAREN]       = __extension__ &&HANDLER(OP_LPAREN),
+    [OP_RPAREN]       = __extension__ &&HANDLER(OP_RPAREN),
+    [OP_EXCLAMATION]  = __extension__ &&HANDLER(OP_EXCLAMATION),
+    [OP_LBRACKET]     = __extension__ &&HANDLER(OP_LBRACKET),
+    [OP_RBRACKET]     = __extension__ &&HANDLER(OP_RBRACKET)
+  };
+  NEXT(0);
+#else
+  while (instr < end) switch (instr->op)
+#endif
+  {
+    HANDLER(OP_TOKEN):    NEXT(step_token(instr, end));
+    HANDLER(OP_LITERAL):  NEXT(step_literal(instr, end));
+    HANDLER(OP_ASSIGN):   NEXT(step_assign(instr, end));
+    HANDLER(OP_PIPELINE): NEXT(step_pipeline(instr, end));
+    HANDLER(OP_FUSED):    NEXT(step_fused(instr, end));
+    HANDLER(OP_ERROR):    step_error(instr, end);
+    BUILTIN_HANDLER(OP_PLUS, builtin_plus);
+    BUILTIN_HANDLER(OP_MINUS, builtin_minus);
+    BUILTIN_HANDLER(OP_ASTERISK, builtin_asterisk);
+    BUILTIN_HANDLER(OP_SLASH, builtin_slash);
+    BUILTIN_HANDLER(OP_PERCENT, builtin_percent);
+    BUILTIN_HANDLER(OP_COMMA, builtin_comma);
+    BUILTIN_HANDLER(OP_PERIOD, builtin_period);
+    BUILTIN_HANDLER(OP_SEMICOLON, builtin_semicolon);
+    BUILTIN_HANDLER(OP_BACKSLASH, builtin_backslash);
+    BUILTIN_HANDLER(OP_AT, builtin_at);
+    BUILTIN_HANDLER(OP_DOLLAR_SIGN, builtin_dollar_sign);
+    BUILTIN_HANDLER(OP_EQUAL, builtin_equal);
+    BUILTIN_HANDLER(OP_LESS_THAN, builtin_less_than);
+    BUILTIN_HANDLER(OP_GREATER_THAN, builtin_greater_than);
+    BUILTIN_HANDLER(OP_LPAREN, builtin_lparen);
+    BUILTIN_HANDLER(OP_RPAREN, builtin_rparen);
+    BUILTIN_HANDLER(OP_EXCLAMATION, builtin_exclamation);
+    BUILTIN_HANDLER(OP_LBRACKET, builtin_lbracket);
+    BUILTIN_HANDLER(OP_RBRACKET, builtin_rbracket);
   }
-  return *cur_tok;
 }
 
-// Return the next token in the string from the given code position
-String next_token(String *str, uint32_t *code_pos) {
-  String token = new_string();
-
-  if (*code_pos >= str->length)
-    return token;
-
-  char c = str->str_data[*code_pos];
-  string_add_char(&token, c);
-  
-  if (c == '"')
-    return get_escaped_string(str, &token, code_pos);
-  else if (c == '\'')
-    return get_raw_string(str, &token, code_pos);
-  else if (isdigit(c) || c == '-')
-    return get_number(str, &token, code_pos);
-  else if (isalpha(c) || c == '_')
-    return get_identifier(str, &token, code_pos);
-  else if (c == '{')
-    return get_block(str, &token, code_pos);
-  else if (c == '#')
-    return get_comment(str, &token, code_pos);
-  else {
-    *code_pos += 1;
-    return token;
-  }
+// How many calls into machine code are running on this thread. Machine code
+// that's gone stale is only freed while none is, since it could be the code
+// that's running further up
+static _Thread_local uint32_t native_depth;
+
+static void run_native(Code *code) {
+  native_depth++;
+  code->native();
+  native_depth--;
 }
 
-void execute_string(String *str) {
-  Bigint one = bigint_from_int64(1);
-  uint32_t code_pos = 0;
-
-  while (code_pos < str->length) {
-    String tok = next_token(str, &code_pos);
-    Item *defined_item = map_get(&definitions, &tok);
-    if (defined_item != NULL) {
-      execute_item(defined_item);
-    }
-    else if (tok.str_data[0] == ':') {
-      if (stack.length == 0) {
-        error("Unable to define from empty stack!");
-      }
-      if (code_pos >= str->length) {
-        error("No token to assign to!");
-      }
-      Item top_item = make_copy(&stack.items[stack.length - 1]);
-      String to_define = next_token(str, &code_pos);
-      map_set(&definitions, to_define, top_item);
-    }
-    else if (isdigit(tok.str_data[0]) ||
-             (tok.str_data[0] == '-' && tok.length > 1))
+// Runs code however it's best run
+static void run_code(Code *code) {
+  // Machine code only stays valid while nothing new is defined, while code
+  // compiled ahead of time checks for itself whether it's still valid
+  if (code->native != NULL &&
+      (code->native_version == definitions_version ||
+       code->native_version == NATIVE_CHECKED))
+  {
+    run_native(code);
+    return;
+  }
+
+  // Code is compiled into machine code once it's been run often enough
+  // without anything being defined in between, and compiled again once it
+  // has been. Worker threads share the code they run, so they leave it alone
+  if (jit_enabled && code->cached && !is_worker_thread) {
+    if (code->native_version != definitions_version &&
+        (code->native == NULL || native_depth == 0))
     {
-      Item item = {TYPE_INTEGER, .int_val = bigint_from_string(&tok)};
-      stack_push(item);
+      free_native(code);
+      code->native_version = definitions_version;
+      code->times_run = 0;
     }
-    else if (tok.str_data[0] == '"' || tok.str_data[0] == '\'') {
-      string_remove_from_front(&tok, one);
-      stack_push(make_string(&tok));
+    if (code->native == NULL && ++code->times_run == JIT_THRESHOLD &&
+        jit_compile(code))
+    {
+      run_native(code);
+      return;
     }
-    else if (tok.str_data[0] == '{') {
-      string_remove_from_front(&tok, one);
-      stack_push(make_block(copy_string(&tok)));
+  }
+  execute_code_from(code, 0);
+}
+
+// Runs code, along with any code its last instruction leaves to be run in
+// its place, without going any deeper for it
+void execute_code(Code *code) {
+  Code *to_release = NULL;
+  while (code != NULL) {
+    // Code that would start too deep in the C stack runs on the heap instead
+    unsigned char here;
+    if ((uintptr_t) &here < stack_limit)
+      execute_on_new_segment(code);
+    else
+      run_code(code);
+
+    if (to_release != NULL) {
+      release_code(to_release);
     }
-    free(tok.str_data);
+    code = to_release = tail_code;
+    tail_code = NULL;
   }
+}
 
-  free_bigint(&one);
+#undef HANDLER
+#undef NEXT
+#undef BUILTIN_HANDLER
+
+void execute_string(String *str) {
+  Code *code = get_code(str);
+  execute_code(code);
+  release_code(code);
 }
 
-void repeat_block(Item *block, Bigint times) {
-  if (!times.is_negative) {
+// Runs code a number of times, which does nothing if it's negative
+void repeat_code(Code *code, Bigint times) {
+  if (!bigint_is_negative(&times)) {
     while (!bigint_is_zero(&times)) {
-      execute_string(&block->str_val);
+      execute_code(code);
       bigint_decrement(&times);
     }
   }
+  free_bigint(&times);
+}
+
+void repeat_block(Item *block, Bigint times) {
+  if (bigint_is_negative(&times)) {
+    free_bigint(&times);
+    return;
+  }
+  Code *code = get_code(block->str_val);
+  repeat_code(code, times);
+  release_code(code);
 }
 
 void execute_item(Item *item) {
@@ -347,9 +570,7 @@ void execute_item(Item *item) {
     item->function();
   }
   else if (item->type == TYPE_BLOCK) {
-    String copied_str = copy_string(&item->str_val);
-    execute_string(&copied_str);
-    free_string(&copied_str);
+    execute_string(item->str_val);
   }
   else {
     stack_push(make_copy(item));
@@ -0,0 +1,350 @@
+// fold.c
+// Contains native versions of folds whose block is just one of the builtins
+// + * | & ^ < or >, so that e.g. {+}* doesn't run a block for every element
+
+#include <stdlib.h>
+#include <string.h>
+#include "golf.h"
+
+typedef void (*Builtin)(void);
+
+// Makes an integer item that takes ownership of a bigint
+static Item bigint_item(Bigint num) {
+  Item item = {TYPE_INTEGER, .int_val = num};
+  return item;
+}
+
+// Returns the builtin a block consists of, if it's one that can be folded
+// natively and hasn't been redefined, or NULL otherwise
+static Builtin fold_builtin(Code *code) {
+  if (code->length != 1 || !is_token_op(code->instructions[0].op)) {
+    return NULL;
+  }
+  Item *defined_item = instruction_definition(&code->instructions[0]);
+  if (defined_item == NULL || defined_item->type != TYPE_FUNCTION) {
+    return NULL;
+  }
+
+  Builtin function = defined_item->function;
+  if (function == builtin_plus || function == builtin_asterisk ||
+      function == builtin_bar || function == builtin_ampersand ||
+      function == builtin_caret || function == builtin_less_than ||
+      function == builtin_greater_than)
+  {
+    return function;
+  }
+  return NULL;
+}
+
+// Counts the steps running the block on each element after the first would
+// have taken toward the limits, since a native fold doesn't run it
+static void count_fold_steps(uint32_t length) {
+  if (length > 1) {
+    count_steps((int64_t) length - 1);
+  }
+}
+
+// Applies a builtin to two integers, leaving the result in acc
+static void fold_bigints(Builtin function, Bigint *acc, const Bigint *num) {
+  Bigint result;
+  if (function == builtin_plus) {
+    bigint_add(acc, num);
+    return;
+  }
+  else if (function == builtin_asterisk)
+    result = bigint_multiply(acc, num);
+  else if (function == builtin_bar)
+    result = bigint_or(acc, num);
+  else if (function == builtin_ampersand)
+    result = bigint_and(acc, num);
+  else if (function == builtin_caret)
+    result = bigint_xor(acc, num);
+  else if (function == builtin_less_than)
+    result = bigint_from_int64(bigint_compare(acc, num) < 0);
+  else
+    result = bigint_from_int64(bigint_compare(acc, num) > 0);
+  free_bigint(acc);
+  *acc = result;
+}
+
+// Multiplies a list of integers together in pairs, so that the big
+// multiplications are between numbers of about the same size. Frees the
+// integers, and returns their product
+static Bigint product_tree(Bigint *nums, uint32_t length) {
+  if (length == 0) {
+    return bigint_from_int64(1);
+  }
+  while (length > 1) {
+    uint32_t half = 0;
+    for (uint32_t i = 0; i + 1 < length; i += 2) {
+      Bigint product = bigint_multiply(&nums[i], &nums[i + 1]);
+      free_bigint(&nums[i]);
+      free_bigint(&nums[i + 1]);
+      nums[half++] = product;
+    }
+    if (length % 2 == 1) {
+      nums[half++] = nums[length - 1];
+    }
+    length = half;
+  }
+  return nums[0];
+}
+
+// The elements of a string or a range, which are small enough to be folded
+// with machine integers for everything but multiplication
+typedef struct SmallInts {
+  const unsigned char *chars;   // The string's characters, if it's a string
+  const Range *range;           // The range, if it's a range
+  uint32_t length;
+} SmallInts;
+
+static inline int64_t small_int_at(const SmallInts *ints, uint32_t i) {
+  if (ints->chars != NULL)
+    return ints->chars[i];
+  else
+    return (int64_t) ints->range->start + i;
+}
+
+static Item fold_small_ints(Builtin function, const SmallInts *ints) {
+  if (function == builtin_plus && ints->range != NULL) {
+    // The sum of an arithmetic series, halving whichever factor is even
+    int64_t count = ints->length;
+    int64_t ends = 2 * (int64_t) ints->range->start + count - 1;
+    if (count % 2 == 0)
+      count /= 2;
+    else
+      ends /= 2;
+    Bigint count_int = bigint_from_int64(count);
+    Bigint ends_int = bigint_from_int64(ends);
+    Bigint sum = bigint_multiply(&count_int, &ends_int);
+    free_bigint(&count_int);
+    free_bigint(&ends_int);
+    return bigint_item(sum);
+  }
+  else if (function == builtin_asterisk) {
+    // Runs of elements are multiplied as machine integers for as long as
+    // they can't overflow, and then those products are multiplied together
+    Bigint *products = malloc(sizeof(Bigint) * ints->length);
+    if (products == NULL) {
+      error("Unable to allocate space for product!");
+    }
+    uint32_t num_products = 0;
+    uint64_t product = 1;
+    for (uint32_t i = 0; i < ints->length; i++) {
+      uint64_t val = small_int_at(ints, i);
+      if (val == 0) {
+        product = 0;
+        for (uint32_t j = 0; j < num_products; j++) {
+          free_bigint(&products[j]);
+        }
+        num_products = 0;
+        break;
+      }
+      if (product > UINT64_MAX / val) {
+        products[num_products++] = bigint_from_uint64(product);
+        product = 1;
+      }
+      product *= val;
+    }
+    products[num_products++] = bigint_from_uint64(product);
+    Bigint result = product_tree(products, num_products);
+    free(products);
+    return bigint_item(result);
+  }
+
+  int64_t acc = small_int_at(ints, 0);
+  for (uint32_t i = 1; i < ints->length; i++) {
+    int64_t val = small_int_at(ints, i);
+    if (function == builtin_plus)
+      acc += val;
+    else if (function == builtin_bar)
+      acc |= val;
+    else if (function == builtin_ampersand)
+      acc &= val;
+    else if (function == builtin_caret)
+      acc ^= val;
+    else if (function == builtin_less_than)
+      acc = acc < val;
+    else
+      acc = acc > val;
+  }
+  return make_integer(acc);
+}
+
+// Folds a string's characters natively, returning false if the block isn't
+// one that can be
+bool native_fold_string(const String *str, Item *block) {
+  Code *code = get_code(block->str_val);
+  Builtin function = fold_builtin(code);
+  release_code(code);
+  if (function == NULL) {
+    return false;
+  }
+
+  count_fold_steps(str->length);
+  if (str->length > 0) {
+    SmallInts ints = {str->str_data, NULL, str->length};
+    stack_push(fold_small_ints(function, &ints));
+  }
+  return true;
+}
+
+bool native_fold_range(const Range *range, Item *block) {
+  Code *code = get_code(block->str_val);
+  Builtin function = fold_builtin(code);
+  release_code(code);
+  if (function == NULL) {
+    return false;
+  }
+
+  count_fold_steps(range->length);
+  if (range->length > 0) {
+    SmallInts ints = {NULL, range, range->length};
+    stack_push(fold_small_ints(function, &ints));
+  }
+  return true;
+}
+
+// Folds a packed array natively, returning false if the block isn't one
+// that can be
+bool native_fold_packed(const Packed *packed, Item *block) {
+  Code *code = get_code(block->str_val);
+  Builtin function = fold_builtin(code);
+  release_code(code);
+  if (function == NULL) {
+    return false;
+  }
+
+  count_fold_steps(packed->length);
+  if (packed->length == 0) {
+    return true;
+  }
+  if (!packed->is_wide) {
+    SmallInts ints = {packed->bytes, NULL, packed->length};
+    stack_push(fold_small_ints(function, &ints));
+  }
+  else if (function == builtin_asterisk) {
+    Bigint *nums = malloc(sizeof(Bigint) * packed->length);
+    if (nums == NULL) {
+      error("Unable to allocate space for product!");
+    }
+    for (uint32_t i = 0; i < packed->length; i++) {
+      nums[i] = bigint_from_int64(packed->ints[i]);
+    }
+    Bigint product = product_tree(nums, packed->length);
+    free(nums);
+    stack_push(bigint_item(product));
+  }
+  else {
+    Bigint acc = bigint_from_int64(packed->ints[0]);
+    for (uint32_t i = 1; i < packed->length; i++) {
+      Bigint num = bigint_from_int64(packed->ints[i]);
+      fold_bigints(function, &acc, &num);
+      free_bigint(&num);
+    }
+    stack_push(bigint_item(acc));
+  }
+  return true;
+}
+
+// Folds an array natively if the block is one that can be and the elements
+// are all integers, or all strings or arrays being joined with +
+bool native_fold_array(const Array *array, Item *block) {
+  if (array->length < 2) {
+    return false;
+  }
+  Code *code = get_code(block->str_val);
+  Builtin function = fold_builtin(code);
+  release_code(code);
+  if (function == NULL) {
+    return false;
+  }
+
+  enum Type type = array->items[0].type;
+  for (uint32_t i = 1; i < array->length; i++) {
+    if (array->items[i].type != type) {
+      return false;
+    }
+  }
+  if (type != TYPE_INTEGER &&
+      (function != builtin_plus || (type != TYPE_STRING && type != TYPE_ARRAY)))
+  {
+    return false;
+  }
+  count_fold_steps(array->length);
+
+  if (type == TYPE_INTEGER && function == builtin_asterisk) {
+    Bigint *nums = malloc(sizeof(Bigint) * array->length);
+    if (nums == NULL) {
+      error("Unable to allocate space for product!");
+    }
+    for (uint32_t i = 0; i < array->length; i++) {
+      nums[i] = copy_bigint(&array->items[i].int_val);
+    }
+    Bigint product = product_tree(nums, array->length);
+    free(nums);
+    stack_push(bigint_item(product));
+  }
+  else if (type == TYPE_INTEGER) {
+    Bigint acc = copy_bigint(&array->items[0].int_val);
+    for (uint32_t i = 1; i < array->length; i++) {
+      fold_bigints(function, &acc, &array->items[i].int_val);
+    }
+    stack_push(bigint_item(acc));
+  }
+  else if (type == TYPE_STRING) {
+    // Strings are joined into one buffer that's allocated up front
+    uint64_t total_len = 0;
+    for (uint32_t i = 0; i < array->length; i++) {
+      total_len += array->items[i].str_val->length;
+    }
+    if (total_len > UINT32_MAX) {
+      error("Unable to allocate space for string!");
+    }
+    Item joined = empty_string();
+    string_reserve(joined.str_val, total_len);
+    for (uint32_t i = 0; i < array->length; i++) {
+      const String *str = array->items[i].str_val;
+      memcpy(joined.str_val->str_data + joined.str_val->length, str->str_data,
+             str->length);
+      joined.str_val->length += str->length;
+    }
+    stack_push(joined);
+  }
+  else {
+    uint64_t total_len = 0;
+    for (uint32_t i = 0; i < array->length; i++) {
+      total_len += array->items[i].arr_val->length;
+    }
+    if (total_len > UINT32_MAX) {
+      error("Unable to allocate space for array!");
+    }
+    Item joined = make_array();
+    array_reserve(joined.arr_val, total_len);
+    for (uint32_t i = 0; i < array->length; i++) {
+      const Array *to_join = array->items[i].arr_val;
+      for (uint32_t j = 0; j < to_join->length; j++) {
+        joined.arr_val->items[joined.arr_val->length++] =
+          make_copy(&to_join->items[j]);
+      }
+    }
+    stack_push(joined);
+  }
+  return true;
+}
+
+// Folds an item into an accumulator natively if the block is one that can
+// be and they're both integers, taking ownership of the item
+bool native_fold_step(Code *code, Item *acc, Item *item) {
+  if (acc->type != TYPE_INTEGER || item->type != TYPE_INTEGER) {
+    return false;
+  }
+  Builtin function = fold_builtin(code);
+  if (function == NULL) {
+    return false;
+  }
+  count_steps(1);
+  fold_bigints(function, &acc->int_val, &item->int_val);
+  free_item(item);
+  return true;
+}
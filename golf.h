@@ -5,6 +5,7 @@
 #ifndef GOLF_H
 #define GOLF_H
 
+#include <setjmp.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -22,37 +23,113 @@ enum Type {
 
   // Not usable by golfscript programmers, only used to implement
   // the builtin functions
-  TYPE_FUNCTION
+  TYPE_FUNCTION,
+
+  // A lazy stand-in for an array of consecutive integers. stack_pop() turns
+  // it into a real array, so only builtins that ask for it ever see one
+  TYPE_RANGE,
+
+  // An array of integers stored compactly, which stack_pop() turns into a
+  // real array in the same way as a range
+  TYPE_PACKED,
+
+  // A long string kept as the pieces it was joined from, which stack_pop()
+  // turns into a real string
+  TYPE_ROPE,
+
+  // The program's input, read from stdin only as far as it's been needed.
+  // stack_pop() reads the rest of it and turns it into a real string
+  TYPE_INPUT
 };
 
+// The characters of a string that views have been made into. It's freed once
+// the string and all of its views are gone
+typedef struct StringBuffer {
+  unsigned char *data;
+  uint32_t size;
+  _Atomic uint32_t refs;
+} StringBuffer;
+
+// A string that's a view into a shared buffer has no space of its own, and
+// has to be given its own copy of its characters before they can be changed.
+// Neither do strings of at most one character, which point into a static table
 typedef struct String {
   unsigned char *str_data;
   uint32_t length, allocated;
+  StringBuffer *shared; // The buffer of a view, or NULL for any other string
 } String;
 
 struct Item;
 
+// Elements removed from the front of an array leave their space behind, so
+// that nothing has to be moved until the array next needs to grow
 typedef struct Array {
   struct Item *items;
   uint32_t length, allocated;
+  uint32_t start;   // How far items is from the start of its allocation
 } Array;
 
-typedef struct Bigint {
-  uint64_t *digits;
-  uint32_t length, allocated;
-  bool is_negative;
+struct Digits;
+
+// An arbitrary-sized integer. One that fits in 63 bits is kept inside the
+// bigint, doubled with one added so that its lowest bit is set, while a
+// bigger one points to its digits, whose lowest bit never is
+typedef union Bigint {
+  int64_t small;
+  struct Digits *big;
 } Bigint;
 
+// The integers from start up to, but not including, start + length
+typedef struct Range {
+  uint32_t start, length;
+} Range;
+
+// The elements of an array of integers that all fit in 64 bits, stored as
+// one byte each while they're all in 0..255, and as int64s once any isn't
+typedef struct Packed {
+  union {
+    uint8_t *bytes;
+    int64_t *ints;
+  };
+  uint32_t length, allocated;
+  uint32_t start;   // Elements removed from the front, as with arrays
+  bool is_wide;
+} Packed;
+
+// The chunks of a rope, with free space kept at both ends so that strings
+// can be added to either end without moving the rest
+typedef struct Rope {
+  String *chunks;
+  uint32_t num_chunks, allocated;
+  uint32_t start;   // How far chunks is from the start of its allocation
+  uint32_t length;  // The total length of the chunks
+} Rope;
+
+// What's left of the input from start onwards, which is shared by every
+// item standing in for part of it
+typedef struct Input {
+  uint32_t start;
+} Input;
+
+// An item is kept to a type and one word, so that the stack and arrays hold
+// twice as many of them to a cache line. Integers, ranges and the input fit
+// in the word, and anything bigger is in a box of its own that it points to
 typedef struct Item {
   enum Type type; // The type of the item
   union {
     Bigint int_val;     // Used for integers
-    String str_val;     // Used for strings and blocks
-    Array arr_val;      // Used for arrays
+    String *str_val;    // Used for strings and blocks
+    Array *arr_val;     // Used for arrays
+    Range range_val;    // Used for ranges
+    Packed *packed_val; // Used for packed arrays
+    Rope *rope_val;     // Used for ropes
+    Input input_val;    // Used for the input
     void (*function)(void); // Used for builtin functions
   };
 } Item;
 
+_Static_assert(sizeof(Item) == 16, "An item should be two words");
+
 // A simple hash table
 // Used for assigned values and builtin functions
 typedef struct Map {
@@ -68,20 +145,165 @@ typedef struct TreeNode {
   uint16_t height;
 } TreeNode;
 
-// A set data structure for implementing setwise data operations on arrays
+// A set data structure for implementing setwise data operations on arrays.
+// It doesn't own its items, which have to outlive it, and its nodes are
+// handed out from blocks that are all freed together, so that building a set
+// doesn't allocate or copy anything for every element
 typedef struct Set {
   TreeNode *root;
+  struct NodeBlock *blocks;   // The newest block of nodes, linked to the rest
+  uint32_t block_used;        // How many of the newest block's nodes are used
+  TreeNode *free_nodes;       // Removed nodes, linked through their left
 } Set;
 
-extern Array stack;
-extern Array bracket_stack;
+// The kinds of instructions code is compiled into. Any token can be given a
+// definition with :, which is run in place of the instruction if it exists
+enum Opcode {
+  OP_TOKEN,     // Does nothing unless the token is defined
+  OP_LITERAL,   // Pushes an integer, string or block
+  OP_ASSIGN,    // Assigns the top of the stack to the next instruction's token
+  OP_PIPELINE,  // Runs the instructions after it as one loop, if it can
+  OP_FUSED,     // Runs the instructions after it in one step, if it can
+  OP_ERROR,     // Raises the error found while tokenizing the code
+
+  // The builtins that are run most have opcodes of their own, which call
+  // them directly for as long as their tokens aren't given other
+  // definitions, and are run as OP_TOKEN is once they are
+  OP_PLUS, OP_MINUS, OP_ASTERISK, OP_SLASH, OP_PERCENT, OP_COMMA, OP_PERIOD,
+  OP_SEMICOLON, OP_BACKSLASH, OP_AT, OP_DOLLAR_SIGN, OP_EQUAL, OP_LESS_THAN,
+  OP_GREATER_THAN, OP_LPAREN, OP_RPAREN, OP_EXCLAMATION, OP_LBRACKET,
+  OP_RBRACKET
+};
+
+// Whether instructions with an opcode stand for their token, and run
+// whatever it's defined as
+#define is_token_op(op) ((op) == OP_TOKEN || (op) >= OP_PLUS)
+
+struct Code;
+struct Pipeline;
+struct Fused;
+
+typedef struct Instruction {
+  enum Opcode op;
+  String token;
+  union {
+    Item literal;               // Used for literals
+    struct Pipeline *pipeline;  // Used for pipelines
+    struct Fused *fused;        // Used for fused instructions
+    const char *error_msg;      // Used for errors
+  };
+  struct Code *block;           // The compiled code of a block literal
+
+  // The token's definition as of the last time it was looked up, which is
+  // valid until anything is assigned again
+  Item *definition;
+  uint64_t definitions_version;
+} Instruction;
+
+// A piece of golfscript code, compiled into instructions
+typedef struct Code {
+  String source;
+  Instruction *instructions;
+  uint32_t length, allocated;
+  bool cached;  // Whether the code belongs to the code cache
+
+  // How many holders the code has, whether they're running it or it's the
+  // code of one of their block literals. Cached code with none can be evicted
+  // from the cache, which it's less likely to be while it's recently_used
+  uint32_t refs;
+  bool recently_used;
+
+  // With --jit, how many times the code has been run, and the machine code
+  // it's been compiled into once it's been run often enough, which is only
+  // valid while the definitions are the same as they were then
+  uint32_t times_run;
+  void (*native)(void);
+  size_t native_size;
+  uint64_t native_version;
+} Code;
+
+// The native_version of code compiled ahead of time with --emit-c, which
+// checks whether it's still valid each time it's run
+#define NATIVE_CHECKED 0
+
+// A token along with the builtin function it starts off defined as
+typedef struct BuiltinDefinition {
+  const char *token;
+  const char *name;  // The name of the function, which --emit-c calls
+  Item item;
+  enum Opcode op;  // The builtin's own opcode, if it has one, or OP_TOKEN
+} BuiltinDefinition;
+
+// The builtin definitions are found with a perfect hash of a token's first
+// and last characters and its length, which no two of them share
+#define BUILTIN_SLOTS 128
+#define BUILTIN_HASH(first, last, length) \
+  (((first) + (last) * 4 + (length)) & (BUILTIN_SLOTS - 1))
+
+// Every piece of code in a program, the program itself and the code of each
+// block literal in it
+typedef struct CodeList {
+  Code **codes;
+  uint32_t length, allocated;
+} CodeList;
+
+// Runs an instruction, returning how many instructions it used
+typedef uint32_t (*Step)(Instruction *instr, const Instruction *end);
+
+// The kinds of steps a pipeline can take over each element
+enum StageType {
+  STAGE_MAP,    // {block}%
+  STAGE_FILTER, // {block},
+  STAGE_FOLD    // {block}*, which can only be the last stage
+};
+
+typedef struct Stage {
+  enum StageType type;
+  Code *block;
+} Stage;
+
+// A run of map, filter and fold stages over the same array, which are done
+// together one element at a time rather than creating arrays in between
+typedef struct Pipeline {
+  Stage *stages;
+  uint32_t num_stages;
+  uint32_t num_instructions;  // How many instructions the pipeline covers
+  uint32_t num_steps;         // How many of those aren't blank
+} Pipeline;
+
+// The kinds of short instruction sequences that can be done in one step
+enum FusedType {
+  FUSED_CONSTANT,   // Literals and builtins that always give the same value
+  FUSED_NOTHING,    // A literal that's popped straight away
+  FUSED_SWAP_POP,   // \;
+  FUSED_OVER,       // 1$
+  FUSED_DOUBLE,     // .+ on an integer
+  FUSED_INCREMENT,  // ) on an integer
+  FUSED_DECREMENT,  // ( on an integer
+  FUSED_FIRST       // 0= on an integer or array
+};
+
+// A short run of instructions that's done in one step, rather than by
+// running each of them
+typedef struct Fused {
+  enum FusedType type;
+  Item constant;              // The value pushed by a constant
+  uint32_t num_instructions;  // How many instructions it covers
+  uint32_t num_steps;         // How many of those aren't blank
+} Fused;
+
+extern _Thread_local Array stack;
+extern _Thread_local Array bracket_stack;
 
 // array.c
 Array new_array(void);
 void free_array(Array *array);
+void free_array_buffer(Array *array);
 Array array_from_string(const String *str);
+void array_reserve(Array *arr, uint32_t min_allocated);
 void array_push(Array *arr, Item item);
 void array_remove_from_front(Array *array, Bigint to_remove);
+void array_drop_front(Array *array, uint32_t to_drop);
 int64_t array_find(const Array *arr, const Item *item);
 void array_reverse(Array *array);
 Item join_array(Array *array, const Item *sep);
@@ -104,13 +326,22 @@ void array_xor(Array *array, const Array *to_xor);
 
 // bigint.c
 Bigint new_bigint(void);
-Bigint bigint_with_digits(uint32_t num_digits);
 void free_bigint(Bigint *num);
 Bigint bigint_from_int64(int64_t int_val);
+Bigint bigint_from_uint64(uint64_t int_val);
+Bigint bigint_from_digits(const uint64_t *digits, uint32_t length,
+                          bool is_negative);
+uint32_t bigint_length(const Bigint *num);
+uint64_t bigint_digit(const Bigint *num, uint32_t index);
+bool bigint_is_negative(const Bigint *num);
+void bigint_negate(Bigint *num);
+void bigint_abs(Bigint *num);
 Bigint bigint_from_string(const String *str);
 String bigint_to_string(const Bigint *num);
 bool bigint_fits_in_uint32(const Bigint *num);
 uint32_t bigint_to_uint32(const Bigint *num);
+bool bigint_fits_in_int64(const Bigint *num);
+int64_t bigint_to_int64(const Bigint *num);
 Bigint copy_bigint(const Bigint *to_copy);
 bool bigint_is_zero(const Bigint *num);
 void bigint_increment(Bigint *num);
@@ -129,6 +360,7 @@ Bigint bigint_exponent(const Bigint *base, const Bigint *exponent);
 // builtin.c
 void builtin_abs(void);
 void builtin_ampersand(void);
+void builtin_and(void);
 void builtin_asterisk(void);
 void builtin_at(void);
 void builtin_backslash(void);
@@ -147,10 +379,14 @@ void builtin_lbracket(void);
 void builtin_less_than(void);
 void builtin_lparen(void);
 void builtin_minus(void);
+void builtin_n(void);
+void builtin_or(void);
+void builtin_p(void);
 void builtin_percent(void);
 void builtin_period(void);
 void builtin_plus(void);
 void builtin_print(void);
+void builtin_puts(void);
 void builtin_question(void);
 void builtin_rand(void);
 void builtin_rbracket(void);
@@ -160,10 +396,51 @@ void builtin_slash(void);
 void builtin_until(void);
 void builtin_tilde(void);
 void builtin_while(void);
+void builtin_xor(void);
 void builtin_zip(void);
 
+// bytecode.c
+bool write_bytecode(Code *program, const char *filename);
+Code *load_bytecode(const char *filename, const String *source);
+Code *get_cached_code(const String *source, const char *filename);
+
+// callstack.c
+extern _Thread_local uintptr_t stack_limit;
+void init_call_stack(void);
+void execute_on_new_segment(Code *code);
+void free_call_stack(void);
+
+// compile.c
+Code *get_code(const String *source);
+Code *compile_tokens(const String *source, String *tokens,
+                     uint32_t num_tokens, Code **blocks);
+void collect_code(CodeList *list, Code *code);
+Code *retain_code(Code *code);
+void release_code(Code *code);
+void free_code_cache(void);
+
 // error.c
+extern _Thread_local jmp_buf *sandbox_escape;
 noreturn void error(const char *msg, ...);
+noreturn void error_with_status(int status, const char *msg, ...);
+
+// fold.c
+bool native_fold_array(const Array *array, Item *block);
+bool native_fold_string(const String *str, Item *block);
+bool native_fold_range(const Range *range, Item *block);
+bool native_fold_packed(const Packed *packed, Item *block);
+bool native_fold_step(Code *code, Item *acc, Item *item);
+
+// image.c
+bool save_image(const char *filename);
+void load_image(const char *filename);
+
+// input.c
+Item make_input(void);
+uint32_t input_available(const Input *input, uint32_t wanted);
+const unsigned char *input_data(const Input *input);
+String input_to_string(const Input *input);
+void free_input(void);
 
 // item.c
 Item make_integer(int64_t int_val);
@@ -172,8 +449,17 @@ Item make_string(const String *str_val);
 Item empty_string(void);
 Item make_block(String str_val);
 Item make_array(void);
-Item make_builtin(void (*function)(void));
+Item make_string_from(String str_val);
+Item make_array_from(Array arr_val);
+Item make_packed_from(Packed packed_val);
+Item make_rope_from(Rope rope_val);
+String *box_string(String str_val);
+Array *box_array(Array arr_val);
+Packed *box_packed(Packed packed_val);
+Rope *box_rope(Rope rope_val);
+String take_string(Item *item);
 Item make_copy(const Item *item);
+void item_expand(Item *item);
 String get_literal(const Item *item);
 bool item_boolean(const Item *item);
 int item_compare(const Item *item1, const Item *item2);
@@ -187,23 +473,173 @@ void coerce_types(Item *item1, Item *item2);
 
 // execute.c
 void init_interpreter(void);
+void init_interpreter_without_input(void);
+void init_definitions(void);
+void free_definitions(void);
 void end_interpreter(void);
+void output_stack(void);
+void free_interpreter(void);
 void stack_push(Item item);
 Item stack_pop(void);
+Item stack_pop_lazy(void);
+Item *get_definition(const String *name);
+Item *instruction_definition(Instruction *instr);
+extern Map definitions;
+extern const BuiltinDefinition builtins[BUILTIN_SLOTS];
+const BuiltinDefinition *find_builtin(const String *token);
+extern uint64_t definitions_version;
+extern Map *assigned_tokens;
+extern bool emitted_code_stale;
+uint32_t max_step_length(const Instruction *instr);
+extern const Step instruction_steps[];
+extern _Thread_local bool in_tail_position;
+void execute_tail_item(Item *item);
+void execute_code_from(Code *code, uint32_t start);
+void execute_code(Code *code);
 void execute_string(String *str);
+void repeat_code(Code *code, Bigint times);
 void repeat_block(Item *block, Bigint times);
 void execute_item(Item *item);
 
+// jit.c
+extern bool jit_enabled;
+bool jit_compile(Code *code);
+void free_native(Code *code);
+
+// emit.c
+// A piece of code translated by --emit-c, which is compiled from the tokens
+// it was split into when it was translated. Its block literals are given
+// the code translated before it with the numbers in blocks, in order
+typedef struct EmittedCode {
+  const char *source;
+  uint32_t source_length;
+  const char *const *tokens;
+  const uint32_t *token_lengths;
+  uint32_t num_tokens;
+  const uint32_t *blocks;
+  uint32_t length;  // How many instructions it compiled into
+  void (*native)(void);
+} EmittedCode;
+
+void emit_c(const String *source, const char *filename);
+void run_emitted(const EmittedCode emitted[], Code *codes[],
+                 uint32_t num_codes);
+
+// limits.c
+// The exit status of a program stopped by --max-steps or --timeout, which is
+// the same as timeout(1) uses
+#define LIMIT_EXIT_STATUS 124
+extern _Thread_local int64_t steps_until_check;
+extern bool execution_limited;
+void set_step_limit(uint64_t steps);
+void set_time_limit(uint64_t milliseconds);
+void check_limits(void);
+uint64_t steps_so_far(void);
+void rewind_steps(uint64_t steps);
+
+// Counts instructions that have been run toward the limits
+#define count_steps(n) do {                   \
+    if ((steps_until_check -= (n)) < 0) {     \
+      check_limits();                         \
+    }                                         \
+  } while (0)
+
+// lines.c
+void run_lines(Code *program, int delimiter, bool keep_definitions);
+
 // map.c
 Map new_map(void);
 void free_map(Map *map);
 void map_set(Map *map, String key, Item item);
 Item *map_get(Map *map, const String *key);
 
+// output.c
+void start_async_output(void);
+void output_bytes(const void *bytes, size_t length);
+void output_hand_off(void);
+void output_flush(void);
+
+// packed.c
+Packed new_packed(void);
+void free_packed(Packed *packed);
+Packed copy_packed(const Packed *packed);
+int64_t packed_get(const Packed *packed, uint32_t index);
+void packed_push(Packed *packed, int64_t val);
+void item_pack(Item *item);
+Array packed_to_array(const Packed *packed);
+int64_t packed_find(const Packed *packed, const Item *item);
+int packed_compare(const Packed *packed, const Item *other);
+void packed_truncate(Packed *packed, uint32_t new_len);
+void packed_remove_from_front(Packed *packed, Bigint to_remove);
+void packed_drop_front(Packed *packed, uint32_t to_drop);
+void packed_concat(Packed *packed, const Packed *to_add);
+void packed_sort(Packed *packed);
+Array map_packed(const Packed *packed, Item *block);
+void fold_packed(const Packed *packed, Item *block);
+void filter_packed(Packed *packed, Item *block);
+int64_t find_in_packed(const Packed *packed, Item *block);
+
+// parallel.c
+extern uint32_t thread_count;
+extern _Thread_local bool is_worker_thread;
+bool block_is_pure(const Item *block);
+void sandbox_check(const Item *item);
+bool parallel_filter_array(Array *array, const Item *block);
+bool parallel_filter_string(String *str, const Item *block);
+bool parallel_find_array(const Array *array, const Item *block,
+                         int64_t *index);
+bool parallel_find_string(const String *str, const Item *block,
+                          int64_t *index);
+bool parallel_filter_range(const Range *range, const Item *block,
+                           Array *filtered);
+bool parallel_find_range(const Range *range, const Item *block,
+                         int64_t *index);
+bool parallel_filter_packed(Packed *packed, const Item *block);
+bool parallel_find_packed(const Packed *packed, const Item *block,
+                          int64_t *index);
+
+// peephole.c
+void fuse_instructions(Code *code);
+void free_fused(Fused *fused);
+bool run_fused(const Fused *fused, Instruction *instrs);
+
+// pipeline.c
+uint32_t skip_blanks(const Instruction *instrs, uint32_t length,
+                     uint32_t start);
+uint32_t count_non_blank(const Instruction *instrs, uint32_t length);
+void fuse_pipelines(Code *code);
+void free_pipeline(Pipeline *pipeline);
+bool run_pipeline(const Pipeline *pipeline, Instruction *instrs);
+
+// range.c
+Item make_range(uint32_t start, uint32_t length);
+Array range_to_array(const Range *range);
+int64_t range_find(const Range *range, const Item *item);
+void range_truncate(Range *range, uint32_t new_len);
+void range_remove_from_front(Range *range, Bigint to_remove);
+Array map_range(const Range *range, Item *block);
+void fold_range(const Range *range, Item *block);
+Array filter_range(const Range *range, Item *block);
+int64_t find_in_range(const Range *range, Item *block);
+
 // random.c
 void init_rng(void);
 Bigint get_randint(Bigint max_val);
 
+// region.c
+bool in_region(const void *ptr);
+bool region_in_use(void);
+void *region_malloc(size_t size);
+void *region_realloc(void *ptr, size_t size);
+void region_free(void *ptr);
+bool region_start(void);
+void region_clear(void);
+void region_stop(void);
+bool region_pause(void);
+void region_resume(bool was_allocating);
+void free_region(void);
+Item region_evacuate(Item item);
+
 // set.c
 Set new_set(void);
 void free_set(Set *set);
@@ -211,17 +647,32 @@ bool set_has(const Set *set, const Item *item);
 void set_add(Set *set, const Item *item);
 void set_remove(Set *set, const Item *item);
 
+// rope.c
+void free_rope(Rope *rope);
+Rope copy_rope(const Rope *rope);
+bool rope_add(Item *item1, Item *item2);
+String rope_flatten(Rope *rope);
+void output_rope(const Rope *rope);
+
 // string.c
 String new_string(void);
 void free_string(String *str);
+void string_reserve(String *str, uint32_t min_allocated);
 String copy_string(const String *str);
+void string_share(String *str);
+String string_view(String *str, uint32_t start, uint32_t length);
+void string_unshare(String *str);
 String create_string(const char *str);
+String string_from_chars(const unsigned char *chars, uint32_t length);
+uint32_t string_hash(const String *str);
 int string_compare(const String *str1, const String *str2);
 void string_reverse(String *str);
 void string_add_char(String *str, char c);
 void string_add_str(String *str, const String *to_append);
 void string_add_c_str(String *str, const char *to_append);
 void string_remove_from_front(String *str, Bigint to_remove);
+void string_drop_front(String *str, uint32_t to_drop);
+void string_truncate(String *str, uint32_t new_len);
 Item string_join(String *str, String *sep);
 void map_string(String *str, Item *block);
 void fold_string(String *str, Item *block);
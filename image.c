@@ -0,0 +1,247 @@
+// image.c
+// Contains functions for saving everything a script has defined, along with
+// what it's left on the stack, to an image with --save-image, and for
+// starting from such an image with --image, so that a setup script only has
+// to be run once
+
+// For getpid
+#define _DEFAULT_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "golf.h"
+
+// Bumped whenever the format changes
+#define IMAGE_VERSION 1
+
+static const char image_magic[4] = {'G', 'S', 'I', '\0'};
+
+// An image is made up of the magic number, the version, how many
+// definitions there are and how many items are on the stack, followed by
+// each definition as its token and item, and then the stack from the bottom
+// up. Everything is in the byte order of the machine that saved it, as with
+// bytecode. Lazy items are saved as the items they stand for, and builtins by
+// the token they start off defined as
+
+static void add_bytes(String *image, const void *bytes, uint32_t length) {
+  string_reserve(image, image->length + length);
+  memcpy(image->str_data + image->length, bytes, length);
+  image->length += length;
+}
+
+static void add_uint32(String *image, uint32_t num) {
+  add_bytes(image, &num, sizeof(num));
+}
+
+static void add_string(String *image, const String *str) {
+  add_uint32(image, str->length);
+  string_add_str(image, str);
+}
+
+static void add_item(String *image, const Item *item) {
+  if (item->type == TYPE_RANGE || item->type == TYPE_PACKED ||
+      item->type == TYPE_ROPE || item->type == TYPE_INPUT)
+  {
+    Item expanded = make_copy(item);
+    item_expand(&expanded);
+    add_item(image, &expanded);
+    free_item(&expanded);
+    return;
+  }
+  add_uint32(image, item->type);
+
+  if (item->type == TYPE_INTEGER) {
+    uint32_t length = bigint_length(&item->int_val);
+    add_uint32(image, bigint_is_negative(&item->int_val));
+    add_uint32(image, length);
+    for (uint32_t i = 0; i < length; i++) {
+      uint64_t digit = bigint_digit(&item->int_val, i);
+      add_bytes(image, &digit, sizeof(digit));
+    }
+  }
+  else if (item->type == TYPE_STRING || item->type == TYPE_BLOCK) {
+    add_string(image, item->str_val);
+  }
+  else if (item->type == TYPE_ARRAY) {
+    add_uint32(image, item->arr_val->length);
+    for (uint32_t i = 0; i < item->arr_val->length; i++) {
+      add_item(image, &item->arr_val->items[i]);
+    }
+  }
+  else {
+    uint32_t builtin = 0;
+    while (builtin + 1 < BUILTIN_SLOTS &&
+           (builtins[builtin].item.type != TYPE_FUNCTION ||
+            builtins[builtin].item.function != item->function))
+    {
+      builtin++;
+    }
+    String token = create_string(builtins[builtin].token);
+    add_string(image, &token);
+    free_string(&token);
+  }
+}
+
+// Saves what's been assigned and the stack to an image, returning whether it
+// could be written. As with bytecode, the image is written under another
+// name first, so that nothing ever sees half of it
+bool save_image(const char *filename) {
+  String image = new_string();
+  add_bytes(&image, image_magic, sizeof(image_magic));
+  add_uint32(&image, IMAGE_VERSION);
+  add_uint32(&image, definitions.num_items);
+  add_uint32(&image, stack.length);
+  for (uint32_t i = 0; i < definitions.allocated; i++) {
+    if (definitions.keys[i] != NULL) {
+      add_string(&image, definitions.keys[i]);
+      add_item(&image, &definitions.items[i]);
+    }
+  }
+  for (uint32_t i = 0; i < stack.length; i++) {
+    add_item(&image, &stack.items[i]);
+  }
+
+  char temp_name[4096];
+  snprintf(temp_name, sizeof(temp_name), "%s.%ld", filename, (long) getpid());
+  FILE *file = fopen(temp_name, "wb");
+  bool written = file != NULL;
+  if (file != NULL) {
+    written = fwrite(image.str_data, 1, image.length, file) == image.length;
+    written = fclose(file) == 0 && written &&
+              rename(temp_name, filename) == 0;
+    if (!written) {
+      remove(temp_name);
+    }
+  }
+  free_string(&image);
+  return written;
+}
+
+// An image being read, which raises an error if it's read past its end
+typedef struct ImageReader {
+  const unsigned char *data;
+  uint64_t pos, size;
+  const char *filename;
+} ImageReader;
+
+static const unsigned char *read_bytes(ImageReader *reader, uint64_t length) {
+  if (length > reader->size - reader->pos) {
+    error("The image '%s' is corrupt!", reader->filename);
+  }
+  const unsigned char *bytes = reader->data + reader->pos;
+  reader->pos += length;
+  return bytes;
+}
+
+static uint32_t read_uint32(ImageReader *reader) {
+  uint32_t num;
+  memcpy(&num, read_bytes(reader, sizeof(num)), sizeof(num));
+  return num;
+}
+
+static String read_string(ImageReader *reader) {
+  uint32_t length = read_uint32(reader);
+  return string_from_chars(read_bytes(reader, length), length);
+}
+
+static Item read_item(ImageReader *reader) {
+  Item item = {.type = read_uint32(reader)};
+
+  if (item.type == TYPE_INTEGER) {
+    bool is_negative = read_uint32(reader);
+    uint32_t length = read_uint32(reader);
+    const unsigned char *digits = read_bytes(reader,
+                                             sizeof(uint64_t) * length);
+    if (length == 0) {
+      error("The image '%s' is corrupt!", reader->filename);
+    }
+    uint64_t *raw = malloc(sizeof(uint64_t) * length);
+    memcpy(raw, digits, sizeof(uint64_t) * length);
+    bool corrupt = (length > 1 && raw[length - 1] == 0) ||
+                   (is_negative && length == 1 && raw[0] == 0);
+    if (!corrupt) {
+      item.int_val = bigint_from_digits(raw, length, is_negative);
+    }
+    free(raw);
+    if (corrupt) {
+      error("The image '%s' is corrupt!", reader->filename);
+    }
+  }
+  else if (item.type == TYPE_STRING || item.type == TYPE_BLOCK) {
+    item.str_val = box_string(read_string(reader));
+  }
+  else if (item.type == TYPE_ARRAY) {
+    uint32_t length = read_uint32(reader);
+    item.arr_val = box_array(new_array());
+    for (uint32_t i = 0; i < length; i++) {
+      array_push(item.arr_val, read_item(reader));
+    }
+  }
+  else if (item.type == TYPE_FUNCTION) {
+    String token = read_string(reader);
+    const BuiltinDefinition *builtin = find_builtin(&token);
+    free_string(&token);
+    if (builtin == NULL || builtin->item.type != TYPE_FUNCTION) {
+      error("The image '%s' is corrupt!", reader->filename);
+    }
+    item.function = builtin->item.function;
+  }
+  else {
+    error("The image '%s' is corrupt!", reader->filename);
+  }
+  return item;
+}
+
+// Starts the interpreter off from an image, defining everything it defines
+// and pushing what was on its stack underneath the input. The image is
+// mapped rather than read, so only the pages that are used are ever loaded
+void load_image(const char *filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    error("Unable to open '%s'!", filename);
+  }
+  struct stat file_info;
+  if (fstat(fd, &file_info) != 0) {
+    error("Unable to open '%s'!", filename);
+  }
+  ImageReader reader = {NULL, 0, file_info.st_size, filename};
+  void *mapped = NULL;
+  if (reader.size > 0) {
+    mapped = mmap(NULL, reader.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+      error("Unable to read '%s'!", filename);
+    }
+    reader.data = mapped;
+  }
+  close(fd);
+
+  if (memcmp(read_bytes(&reader, sizeof(image_magic)), image_magic,
+             sizeof(image_magic)) != 0 ||
+      read_uint32(&reader) != IMAGE_VERSION)
+  {
+    error("'%s' isn't an image this version can load!", filename);
+  }
+  uint32_t num_definitions = read_uint32(&reader);
+  uint32_t stack_length = read_uint32(&reader);
+
+  for (uint32_t i = 0; i < num_definitions; i++) {
+    String token = read_string(&reader);
+    map_set(&definitions, token, read_item(&reader));
+  }
+  definitions_version++;
+
+  Item input = stack_pop_lazy();
+  for (uint32_t i = 0; i < stack_length; i++) {
+    stack_push(read_item(&reader));
+  }
+  stack_push(input);
+
+  if (mapped != NULL) {
+    munmap(mapped, reader.size);
+  }
+}
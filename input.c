@@ -0,0 +1,83 @@
+// input.c
+// Contains functions for the lazy input, which stands in for whatever's
+// piped into a program, and reads it from stdin only as far as it's needed,
+// so that a program that looks at the start of its input doesn't have to
+// wait for the rest of it
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "golf.h"
+
+// How much is read from stdin at once
+#define INPUT_CHUNK_SIZE 65536
+
+// Everything read from stdin so far, and whether there's nothing left
+static String input_read;
+static bool input_ended;
+
+Item make_input() {
+  Item item = {TYPE_INPUT, .input_val = {0}};
+  return item;
+}
+
+// Reads from stdin until there's at least the given length read, or until
+// there's nothing left. Once everything's been read, the characters may be
+// shared with strings made from them, so nothing more is ever added
+static void input_read_to(uint64_t length) {
+  // The input's read onto the heap even while a sandbox is running
+  bool was_allocating = region_pause();
+  if (input_read.str_data == NULL) {
+    input_read = new_string();
+  }
+  while (!input_ended && input_read.length < length) {
+    if (input_read.length > UINT32_MAX - INPUT_CHUNK_SIZE) {
+      error("Unable to allocate space for string!");
+    }
+    string_reserve(&input_read, input_read.length + INPUT_CHUNK_SIZE);
+    ssize_t num_read = read(STDIN_FILENO, input_read.str_data +
+                            input_read.length, INPUT_CHUNK_SIZE);
+    if (num_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (num_read <= 0) {
+      input_ended = true;
+    }
+    else {
+      input_read.length += num_read;
+    }
+  }
+  region_resume(was_allocating);
+}
+
+// Returns how much of what's wanted from the start of the input there is,
+// reading it if it hasn't been yet
+uint32_t input_available(const Input *input, uint32_t wanted) {
+  input_read_to((uint64_t) input->start + wanted);
+  if (input->start >= input_read.length) {
+    return 0;
+  }
+  return min(wanted, input_read.length - input->start);
+}
+
+// The characters of the input that have been read, which are only valid
+// until more is read
+const unsigned char *input_data(const Input *input) {
+  return input_read.str_data + input->start;
+}
+
+// Reads the rest of the input, and returns what's left of it as a string
+String input_to_string(const Input *input) {
+  input_read_to(UINT64_MAX);
+  if (input->start >= input_read.length) {
+    return new_string();
+  }
+  return string_view(&input_read, input->start,
+                     input_read.length - input->start);
+}
+
+void free_input() {
+  free_string(&input_read);
+  input_read = new_string();
+  input_ended = false;
+}
@@ -2,10 +2,8 @@
 // Contains functions for manipulating items
 
 #include <assert.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
 #include "golf.h"
 
 Item make_integer(int64_t int_val) {
@@ -18,63 +16,136 @@ Item make_integer_from_bigint(const Bigint *bigint) {
   return item;
 }
 
+// Moves a string, array, packed array or rope into a box of its own, which
+// the item that holds it points to
+String *box_string(String str_val) {
+  String *box = region_malloc(sizeof(String));
+  *box = str_val;
+  return box;
+}
+
+Array *box_array(Array arr_val) {
+  Array *box = region_malloc(sizeof(Array));
+  *box = arr_val;
+  return box;
+}
+
+Packed *box_packed(Packed packed_val) {
+  Packed *box = region_malloc(sizeof(Packed));
+  *box = packed_val;
+  return box;
+}
+
+Rope *box_rope(Rope rope_val) {
+  Rope *box = region_malloc(sizeof(Rope));
+  *box = rope_val;
+  return box;
+}
+
+// Takes the string out of an item, freeing its box, after which the item is
+// no longer valid
+String take_string(Item *item) {
+  String str = *item->str_val;
+  region_free(item->str_val);
+  return str;
+}
+
 Item make_string(const String *str_val) {
-  Item item = {TYPE_STRING, .str_val = copy_string(str_val)};
+  return make_string_from(copy_string(str_val));
+}
+
+Item make_string_from(String str_val) {
+  Item item = {TYPE_STRING, .str_val = box_string(str_val)};
   return item;
 }
 
 Item empty_string() {
-  Item item = {TYPE_STRING, .str_val = new_string()};
-  return item;
+  return make_string_from(new_string());
 }
 
 Item make_block(String str_val) {
-  Item item = {TYPE_BLOCK, .str_val = str_val};
+  Item item = {TYPE_BLOCK, .str_val = box_string(str_val)};
   return item;
 }
 
 Item make_array() {
-  Item item = {TYPE_ARRAY, .arr_val = new_array()};
+  return make_array_from(new_array());
+}
+
+Item make_array_from(Array arr_val) {
+  Item item = {TYPE_ARRAY, .arr_val = box_array(arr_val)};
   return item;
 }
 
-Item make_builtin(void (*function)()) {
-  Item item = {TYPE_FUNCTION, .function = function};
+Item make_packed_from(Packed packed_val) {
+  Item item = {TYPE_PACKED, .packed_val = box_packed(packed_val)};
+  return item;
+}
+
+Item make_rope_from(Rope rope_val) {
+  Item item = {TYPE_ROPE, .rope_val = box_rope(rope_val)};
   return item;
 }
 
 // Returns a copy of an item, duplicating its dynamically allocated contents
 Item make_copy(const Item *item) {
-  Item new_item;
-
-  new_item.type = item->type;
+  Item new_item = *item;
 
   if (item->type == TYPE_INTEGER)
     new_item.int_val = copy_bigint(&item->int_val);
   else if (item->type == TYPE_STRING || item->type == TYPE_BLOCK)
-    new_item.str_val = copy_string(&item->str_val);
+    new_item.str_val = box_string(copy_string(item->str_val));
   else if (item->type == TYPE_ARRAY) {
-    new_item.arr_val = new_array();
-    for (uint32_t i = 0; i < item->arr_val.length; i++) {
-      array_push(&new_item.arr_val, make_copy(&item->arr_val.items[i]));
+    new_item.arr_val = box_array(new_array());
+    for (uint32_t i = 0; i < item->arr_val->length; i++) {
+      array_push(new_item.arr_val, make_copy(&item->arr_val->items[i]));
     }
   }
+  else if (item->type == TYPE_PACKED)
+    new_item.packed_val = box_packed(copy_packed(item->packed_val));
+  else if (item->type == TYPE_ROPE)
+    new_item.rope_val = box_rope(copy_rope(item->rope_val));
 
   return new_item;
 }
 
+// Replaces a lazy item with the ordinary item it stands in for
+void item_expand(Item *item) {
+  if (item->type == TYPE_RANGE) {
+    Array array = range_to_array(&item->range_val);
+    *item = make_array_from(array);
+  }
+  else if (item->type == TYPE_PACKED) {
+    Packed *packed = item->packed_val;
+    Array array = packed_to_array(packed);
+    free_packed(packed);
+    region_free(packed);
+    *item = make_array_from(array);
+  }
+  else if (item->type == TYPE_ROPE) {
+    Rope *rope = item->rope_val;
+    String str = rope_flatten(rope);
+    region_free(rope);
+    *item = make_string_from(str);
+  }
+  else if (item->type == TYPE_INPUT) {
+    String str = input_to_string(&item->input_val);
+    *item = make_string_from(str);
+  }
+}
+
 // Returns a string representation of an item, which returns the original
 // item when evaluated
 String get_literal(const Item *item) {
   String str = new_string();
   if (item->type == TYPE_INTEGER) {
-    free(str.str_data);
+    free_string(&str);
     str = bigint_to_string(&item->int_val);
   }
   else if (item->type == TYPE_STRING) {
     string_add_char(&str, '"');
-    for (uint32_t i = 0; i < item->str_val.length; i++) {
-      unsigned char c = item->str_val.str_data[i];
+    for (uint32_t i = 0; i < item->str_val->length; i++) {
+      unsigned char c = item->str_val->str_data[i];
       switch (c) {
         case '"':    string_add_c_str(&str, "\\\""); break;
         case '\\':   string_add_c_str(&str, "\\\\"); break;
@@ -104,16 +175,23 @@ String get_literal(const Item *item) {
   }
   else if (item->type == TYPE_BLOCK) {
     string_add_char(&str, '{');
-    string_add_str(&str, &item->str_val);
+    string_add_str(&str, item->str_val);
     string_add_char(&str, '}');
   }
+  else if (item->type == TYPE_PACKED) {
+    Item expanded = make_copy(item);
+    item_expand(&expanded);
+    free_string(&str);
+    str = get_literal(&expanded);
+    free_item(&expanded);
+  }
   else if (item->type == TYPE_ARRAY) {
     string_add_char(&str, '[');
-    for (uint32_t i = 0; i < item->arr_val.length; i++) {
-      String item_string = get_literal(&item->arr_val.items[i]);
+    for (uint32_t i = 0; i < item->arr_val->length; i++) {
+      String item_string = get_literal(&item->arr_val->items[i]);
       string_add_str(&str, &item_string);
-      free(item_string.str_data);
-      if (i + 1 < item->arr_val.length) {
+      free_string(&item_string);
+      if (i + 1 < item->arr_val->length) {
         string_add_char(&str, ' ');
       }
     }
@@ -131,10 +209,22 @@ bool item_boolean(const Item *item) {
 
     case TYPE_STRING:
     case TYPE_BLOCK:
-      return item->str_val.length != 0;
+      return item->str_val->length != 0;
 
     case TYPE_ARRAY:
-      return item->arr_val.length != 0;
+      return item->arr_val->length != 0;
+
+    case TYPE_RANGE:
+      return item->range_val.length != 0;
+
+    case TYPE_PACKED:
+      return item->packed_val->length != 0;
+
+    case TYPE_ROPE:
+      return item->rope_val->length != 0;
+
+    case TYPE_INPUT:
+      return input_available(&item->input_val, 1) != 0;
 
     default:
       assert(false);
@@ -154,6 +244,13 @@ bool types_compatible(enum Type type1, enum Type type2) {
 // than item2, a negative value if item2 is greater, and 0 if the two
 // items are the same
 int item_compare(const Item *item1, const Item *item2) {
+  // Packed arrays nested in arrays are compared without expanding them
+  if (item1->type == TYPE_PACKED) {
+    return packed_compare(item1->packed_val, item2);
+  }
+  else if (item2->type == TYPE_PACKED) {
+    return -packed_compare(item2->packed_val, item1);
+  }
   if (!types_compatible(item1->type, item2->type)) {
     return item1->type - item2->type;
   }
@@ -166,38 +263,39 @@ int item_compare(const Item *item1, const Item *item2) {
 
     case TYPE_ARRAY:
       if (item2->type == TYPE_ARRAY) {
-        for (uint32_t i = 0; i < item1->arr_val.length; i++) {
-          if (i >= item2->arr_val.length)
+        for (uint32_t i = 0; i < item1->arr_val->length; i++) {
+          if (i >= item2->arr_val->length)
             return 1;
-          int result = item_compare(&item1->arr_val.items[i],
-                                    &item2->arr_val.items[i]);
+          int result = item_compare(&item1->arr_val->items[i],
+                                    &item2->arr_val->items[i]);
           if (result != 0)
             return result;
         }
-        return item1->arr_val.length - item2->arr_val.length;
+        return item1->arr_val->length - item2->arr_val->length;
       }
       else {
-        for (uint32_t i = 0; i < item1->arr_val.length; i++) {
-          if (i >= item2->str_val.length)
+        for (uint32_t i = 0; i < item1->arr_val->length; i++) {
+          if (i >= item2->str_val->length)
             return 1;
-          if (item1->arr_val.items[i].type != TYPE_INTEGER)
+          if (item1->arr_val->items[i].type != TYPE_INTEGER)
             return 1;
-          if (!bigint_fits_in_uint32(&item1->arr_val.items[i].int_val))
+          if (!bigint_fits_in_uint32(&item1->arr_val->items[i].int_val))
             return 1;
-          uint32_t int_val = bigint_to_uint32(&item1->arr_val.items[i].int_val);
-          if (int_val != item2->str_val.str_data[i]) {
-            if (int_val > item2->str_val.str_data[i])
+          uint32_t int_val =
+            bigint_to_uint32(&item1->arr_val->items[i].int_val);
+          if (int_val != item2->str_val->str_data[i]) {
+            if (int_val > item2->str_val->str_data[i])
               return 1;
             else
               return -1;
           }
         }
-        return item1->arr_val.length - item2->str_val.length;
+        return item1->arr_val->length - item2->str_val->length;
       }
 
     case TYPE_STRING:
     case TYPE_BLOCK:
-      return string_compare(&item1->str_val, &item2->str_val);
+      return string_compare(item1->str_val, item2->str_val);
 
     default:
       assert(false);
@@ -217,15 +315,15 @@ void items_add(Item *item1, Item *item2) {
     bigint_add(&item1->int_val, &item2->int_val);
   }
   else if (item1->type == TYPE_STRING) {
-    string_add_str(&item1->str_val, &item2->str_val);
+    string_add_str(item1->str_val, item2->str_val);
   }
   else if (item1->type == TYPE_BLOCK) {
-    string_add_char(&item1->str_val, ' ');
-    string_add_str(&item1->str_val, &item2->str_val);
+    string_add_char(item1->str_val, ' ');
+    string_add_str(item1->str_val, item2->str_val);
   }
   else if (item1->type == TYPE_ARRAY) {
-    for (uint32_t i = 0; i < item2->arr_val.length; i++) {
-      array_push(&item1->arr_val, make_copy(&item2->arr_val.items[i]));
+    for (uint32_t i = 0; i < item2->arr_val->length; i++) {
+      array_push(item1->arr_val, make_copy(&item2->arr_val->items[i]));
     }
   }
 }
@@ -239,36 +337,56 @@ void swap_items(Item *a, Item *b) {
 // Frees the dynamically allocated contents of an item
 void free_item(Item *item) {
   if (item->type == TYPE_STRING || item->type == TYPE_BLOCK) {
-    free(item->str_val.str_data);
+    free_string(item->str_val);
+    region_free(item->str_val);
   }
   else if (item->type == TYPE_ARRAY) {
-    for (uint32_t i = 0; i < item->arr_val.length; i++) {
-      free_item(&item->arr_val.items[i]);
+    for (uint32_t i = 0; i < item->arr_val->length; i++) {
+      free_item(&item->arr_val->items[i]);
     }
-    free(item->arr_val.items);
+    free_array_buffer(item->arr_val);
+    region_free(item->arr_val);
   }
   else if (item->type == TYPE_INTEGER) {
     free_bigint(&item->int_val);
   }
+  else if (item->type == TYPE_PACKED) {
+    free_packed(item->packed_val);
+    region_free(item->packed_val);
+  }
+  else if (item->type == TYPE_ROPE) {
+    free_rope(item->rope_val);
+    region_free(item->rope_val);
+  }
 }
 
 void output_item(const Item *item) {
   if (item->type == TYPE_INTEGER) {
     String str = bigint_to_string(&item->int_val);
-    write(STDOUT_FILENO, str.str_data, str.length);
+    output_bytes(str.str_data, str.length);
     free_string(&str);
   }
   else if (item->type == TYPE_STRING) {
-    write(STDOUT_FILENO, item->str_val.str_data, item->str_val.length);
+    output_bytes(item->str_val->str_data, item->str_val->length);
+  }
+  else if (item->type == TYPE_ROPE) {
+    output_rope(item->rope_val);
   }
   else if (item->type == TYPE_BLOCK) {
-    putchar('{');
-    write(STDOUT_FILENO, item->str_val.str_data, item->str_val.length);
-    putchar('}');
+    output_bytes("{", 1);
+    output_bytes(item->str_val->str_data, item->str_val->length);
+    output_bytes("}", 1);
   }
   else if (item->type == TYPE_ARRAY) {
-    for (uint32_t i = 0; i < item->arr_val.length; i++) {
-      output_item(&item->arr_val.items[i]);
+    for (uint32_t i = 0; i < item->arr_val->length; i++) {
+      output_item(&item->arr_val->items[i]);
+    }
+  }
+  else if (item->type == TYPE_PACKED) {
+    for (uint32_t i = 0; i < item->packed_val->length; i++) {
+      Item element = make_integer(packed_get(item->packed_val, i));
+      output_item(&element);
+      free_item(&element);
     }
   }
 }
@@ -277,18 +395,26 @@ void output_item(const Item *item) {
 // Note that integers are converted to their ascii equivalents
 String array_to_string(const Item *array) {
   String str = new_string();
-  for (uint32_t i = 0; i < array->arr_val.length; i++) {
-    Item *cur_item = &array->arr_val.items[i];
+  if (array->type == TYPE_PACKED) {
+    for (uint32_t i = 0; i < array->packed_val->length; i++) {
+      int64_t val = packed_get(array->packed_val, i);
+      uint64_t magnitude = val < 0 ? 0 - (uint64_t) val : (uint64_t) val;
+      string_add_char(&str, magnitude & 0xFF);
+    }
+    return str;
+  }
+  for (uint32_t i = 0; i < array->arr_val->length; i++) {
+    Item *cur_item = &array->arr_val->items[i];
     if (cur_item->type == TYPE_INTEGER)
-      string_add_char(&str, cur_item->int_val.digits[0] & 0xFF);
+      string_add_char(&str, bigint_digit(&cur_item->int_val, 0) & 0xFF);
     else if (cur_item->type == TYPE_STRING)
-      string_add_str(&str, &cur_item->str_val);
+      string_add_str(&str, cur_item->str_val);
     else if (cur_item->type == TYPE_BLOCK)
-      string_add_str(&str, &cur_item->str_val);
-    else if (cur_item->type == TYPE_ARRAY) {
+      string_add_str(&str, cur_item->str_val);
+    else if (cur_item->type == TYPE_ARRAY || cur_item->type == TYPE_PACKED) {
       String array_str = array_to_string(cur_item);
       string_add_str(&str, &array_str);
-      free(array_str.str_data);
+      free_string(&array_str);
     }
   }
   return str;
@@ -299,6 +425,9 @@ String array_to_string(const Item *array) {
 // is converted to other item's type
 // The priority from smallest to largest is integer, array, string, block
 void coerce_types(Item *item1, Item *item2) {
+  // Elements of arrays that are added can be packed arrays
+  item_expand(item1);
+  item_expand(item2);
   if (item1->type == item2->type) {
     return;
   }
@@ -313,55 +442,52 @@ void coerce_types(Item *item1, Item *item2) {
     }
     else if (item2->type == TYPE_ARRAY) {
       String block_str = new_string();
-      for (uint32_t i = 0; i < item2->arr_val.length; i++) {
-        Item *cur_item = &item2->arr_val.items[i];
+      for (uint32_t i = 0; i < item2->arr_val->length; i++) {
+        Item *cur_item = &item2->arr_val->items[i];
         if (cur_item->type == TYPE_STRING ||cur_item->type == TYPE_BLOCK) {
-          string_add_str(&block_str, &cur_item->str_val);
+          string_add_str(&block_str, cur_item->str_val);
         }
-        else if (cur_item->type == TYPE_ARRAY) {
+        else if (cur_item->type == TYPE_ARRAY ||
+                 cur_item->type == TYPE_PACKED)
+        {
           String arr_str = array_to_string(cur_item);
           string_add_str(&block_str, &arr_str);
-          free(arr_str.str_data);
+          free_string(&arr_str);
         }
         else if (cur_item->type == TYPE_INTEGER) {
           String int_str = bigint_to_string(&cur_item->int_val);
           string_add_str(&block_str, &int_str);
           free_string(&int_str);
         }
-        if (i + 1 < item2->arr_val.length)
+        if (i + 1 < item2->arr_val->length)
           string_add_char(&block_str, ' ');
       }
       free_item(item2);
-      item2->type = TYPE_BLOCK;
-      item2->str_val = block_str;
+      *item2 = make_block(block_str);
     }
     else if (item2->type == TYPE_INTEGER) {
-      item2->type = TYPE_BLOCK;
-      Bigint int_temp = item2->int_val;
-      item2->str_val = bigint_to_string(&item2->int_val);
-      free_bigint(&int_temp);
+      String str = bigint_to_string(&item2->int_val);
+      free_bigint(&item2->int_val);
+      *item2 = make_block(str);
     }
   }
   else if (item1->type == TYPE_STRING) {
     if (item2->type == TYPE_ARRAY) {
       String str = array_to_string(item2);
       free_item(item2);
-      item2->type = TYPE_STRING;
-      item2->str_val = str;
+      *item2 = make_string_from(str);
     }
     else if (item2->type == TYPE_INTEGER) {
-      item2->type = TYPE_STRING;
-      Bigint int_temp = item2->int_val;
-      item2->str_val = bigint_to_string(&item2->int_val);
-      free_bigint(&int_temp);
+      String str = bigint_to_string(&item2->int_val);
+      free_bigint(&item2->int_val);
+      *item2 = make_string_from(str);
     }
   }
   else if (item1->type == TYPE_ARRAY) {
     if (item2->type == TYPE_INTEGER) {
       Array coerced_array = new_array();
       array_push(&coerced_array, *item2);
-      item2->type = TYPE_ARRAY;
-      item2->arr_val = coerced_array;
+      *item2 = make_array_from(coerced_array);
     }
   }
 }
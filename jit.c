@@ -0,0 +1,230 @@
+// jit.c
+// Contains a compiler from compiled code into x86-64 machine code, used with
+// --jit for code that's run often. The definitions of its tokens are looked
+// up while compiling rather than each time they're run, and the machine code
+// calls builtins and the interpreter's steps directly, so that nothing is
+// left to dispatch at run time
+
+// For MAP_ANONYMOUS
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include "golf.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define JIT_SUPPORTED
+#endif
+
+// Set by --jit
+bool jit_enabled;
+
+#ifdef JIT_SUPPORTED
+
+// Machine code being written, before it's copied into executable memory
+typedef struct Emitter {
+  uint8_t *bytes;
+  size_t length, allocated;
+} Emitter;
+
+static void emit_bytes(Emitter *emitter, const void *bytes, size_t length) {
+  if (emitter->length + length > emitter->allocated) {
+    emitter->allocated = max(emitter->allocated * 2, emitter->length + length);
+    emitter->bytes = realloc(emitter->bytes, emitter->allocated);
+    if (emitter->bytes == NULL) {
+      error("Unable to allocate space for machine code!");
+    }
+  }
+  memcpy(emitter->bytes + emitter->length, bytes, length);
+  emitter->length += length;
+}
+
+// Emits an instruction that moves a 64-bit value into a register, given the
+// instruction's opcode
+static void emit_move(Emitter *emitter, uint8_t opcode, const void *value,
+                      size_t size)
+{
+  uint8_t move[10] = {0x48, opcode};
+  memcpy(move + 2, value, size);
+  emit_bytes(emitter, move, sizeof(move));
+}
+
+// A jump whose offset is filled in once every instruction's position is known
+typedef struct Jump {
+  size_t offset_pos;
+  uint32_t target;
+} Jump;
+
+static void push_literal(Instruction *instr) {
+  count_steps(1);
+  stack_push(make_copy(&instr->literal));
+}
+
+// Returns whether running a definition can't do anything but call a builtin
+// that's allowed in a sandbox, so that it can be called directly. Builtins
+// are only called directly without limits, as the call doesn't count steps
+static bool is_pure_builtin(const Item *defined_item) {
+  return !execution_limited && defined_item->type == TYPE_FUNCTION &&
+         defined_item->function != builtin_print &&
+         defined_item->function != builtin_puts &&
+         defined_item->function != builtin_p &&
+         defined_item->function != builtin_rand;
+}
+
+// Emits a check that nothing has been defined since the code was compiled,
+// which goes back to the interpreter from the given instruction if anything
+// has, as the definitions compiled into what follows could be out of date
+static void emit_guard(Emitter *emitter, Code *code, uint32_t instr_num) {
+  uint64_t *version = &definitions_version;
+  void (*resume)(Code *, uint32_t) = execute_code_from;
+
+  // movabs rax, &definitions_version; movabs rcx, version;
+  // cmp [rax], rcx; je past the rest
+  emit_move(emitter, 0xb8, &version, sizeof(version));
+  emit_move(emitter, 0xb9, &definitions_version, sizeof(uint64_t));
+  emit_bytes(emitter, "\x48\x39\x08\x74\x1d", 5);
+
+  // movabs rdi, code; mov esi, instr_num; movabs rax, execute_code_from;
+  // call rax; pop rbx; ret
+  emit_move(emitter, 0xbf, &code, sizeof(code));
+  emit_bytes(emitter, "\xbe", 1);
+  emit_bytes(emitter, &instr_num, sizeof(instr_num));
+  emit_move(emitter, 0xb8, &resume, sizeof(resume));
+  emit_bytes(emitter, "\xff\xd0\x5b\xc3", 4);
+}
+
+// Compiles code into a function that does what its instructions do with the
+// definitions as they are now, which mustn't be run once they've changed.
+// Tokens that aren't defined compile to nothing, literals to pushing a copy
+// and tokens defined as builtins to calling the builtin. Everything else
+// calls the instruction's step, which returns how many instructions it used,
+// followed by a jump past them if it could use more than one. Anything
+// called could define something, so the definitions are checked after each
+// call. Returns false, leaving the code to be interpreted, if there isn't
+// memory for it
+bool jit_compile(Code *code) {
+  Emitter emitter = {malloc(64), 0, 64};
+  size_t *starts = malloc(sizeof(size_t) * (code->length + 1));
+  Jump *jumps = malloc(sizeof(Jump) * (code->length + 1));
+  bool *is_target = calloc(code->length + 1, sizeof(bool));
+  uint32_t num_jumps = 0;
+  if (emitter.bytes == NULL || starts == NULL || jumps == NULL ||
+      is_target == NULL)
+  {
+    error("Unable to allocate space for machine code!");
+  }
+  for (uint32_t i = 0; i < code->length; i++) {
+    uint32_t length = max_step_length(&code->instructions[i]);
+    if (length > 1) {
+      is_target[min(i + length, code->length)] = true;
+    }
+  }
+
+  // push rbx, which keeps the stack aligned for the calls
+  emit_bytes(&emitter, "\x53", 1);
+
+  Instruction *end = code->instructions + code->length;
+  bool called = false;
+  for (uint32_t i = 0; i < code->length; i++) {
+    Instruction *instr = &code->instructions[i];
+    starts[i] = emitter.length;
+    if (called || is_target[i]) {
+      emit_guard(&emitter, code, i);
+      called = false;
+    }
+
+    Item *defined_item = instruction_definition(instr);
+    if (defined_item == NULL && is_token_op(instr->op)) {
+      continue;
+    }
+    else if (defined_item == NULL && instr->op == OP_LITERAL) {
+      // movabs rdi, instr; movabs rax, push_literal; call rax
+      void (*push)(Instruction *) = push_literal;
+      emit_move(&emitter, 0xbf, &instr, sizeof(instr));
+      emit_move(&emitter, 0xb8, &push, sizeof(push));
+      emit_bytes(&emitter, "\xff\xd0", 2);
+      continue;
+    }
+    else if (defined_item != NULL && is_pure_builtin(defined_item)) {
+      // movabs rax, builtin; call rax
+      emit_move(&emitter, 0xb8, &defined_item->function,
+                sizeof(defined_item->function));
+      emit_bytes(&emitter, "\xff\xd0", 2);
+      called = true;
+      continue;
+    }
+
+    // movabs rdi, instr; movabs rsi, end; movabs rax, step; call rax
+    Step step = instruction_steps[is_token_op(instr->op) ? OP_TOKEN
+                                                          : instr->op];
+    emit_move(&emitter, 0xbf, &instr, sizeof(instr));
+    emit_move(&emitter, 0xbe, &end, sizeof(end));
+    emit_move(&emitter, 0xb8, &step, sizeof(step));
+    emit_bytes(&emitter, "\xff\xd0", 2);
+    called = true;
+
+    if (max_step_length(instr) > 1) {
+      // cmp eax, 1; jne to wherever the step would have moved on to
+      emit_bytes(&emitter, "\x83\xf8\x01\x0f\x85", 5);
+      jumps[num_jumps].offset_pos = emitter.length;
+      jumps[num_jumps].target = min(i + max_step_length(instr), code->length);
+      num_jumps++;
+      emit_bytes(&emitter, "\0\0\0\0", 4);
+    }
+  }
+
+  // pop rbx; ret
+  starts[code->length] = emitter.length;
+  emit_bytes(&emitter, "\x5b\xc3", 2);
+
+  for (uint32_t i = 0; i < num_jumps; i++) {
+    int32_t offset = starts[jumps[i].target] - (jumps[i].offset_pos + 4);
+    memcpy(emitter.bytes + jumps[i].offset_pos, &offset, sizeof(offset));
+  }
+  free(starts);
+  free(jumps);
+  free(is_target);
+
+  void *native = mmap(NULL, emitter.length, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (native == MAP_FAILED) {
+    free(emitter.bytes);
+    return false;
+  }
+  memcpy(native, emitter.bytes, emitter.length);
+  free(emitter.bytes);
+  if (mprotect(native, emitter.length, PROT_READ | PROT_EXEC) != 0) {
+    munmap(native, emitter.length);
+    return false;
+  }
+
+  // ISO C has no conversion from a data pointer to a function pointer
+  memcpy(&code->native, &native, sizeof(native));
+  code->native_size = emitter.length;
+  code->native_version = definitions_version;
+  return true;
+}
+
+void free_native(Code *code) {
+  // Code compiled ahead of time isn't in memory of its own
+  if (code->native != NULL && code->native_size > 0) {
+    void *native;
+    memcpy(&native, &code->native, sizeof(native));
+    munmap(native, code->native_size);
+    code->native = NULL;
+  }
+}
+
+#else
+
+bool jit_compile(Code *code) {
+  (void) code;
+  return false;
+}
+
+void free_native(Code *code) {
+  (void) code;
+}
+
+#endif
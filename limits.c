@@ -0,0 +1,150 @@
+// limits.c
+// Contains --max-steps and --timeout, which stop a program that's run for
+// too long. Each instruction that's run counts off a countdown, and
+// the limits are only looked at once that runs out. A timer ends the
+// countdown once the time limit's passed, and ends the program itself if a
+// builtin's still running a little while after that
+
+// For sigaction, setitimer and write
+#define _DEFAULT_SOURCE
+
+#include <signal.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "golf.h"
+
+// How many steps are taken between checks of whether the time limit's
+// passed, in case the timer couldn't end the countdown itself
+#define STEPS_BETWEEN_TIME_CHECKS 65536
+
+// How long a builtin that's still running once the time limit's passed gets
+// to finish before the program's ended in the middle of it
+#define GRACE_MILLISECONDS 50
+
+// How many more steps can be taken before the limits are next checked.
+// Nothing's run on worker threads while there are limits, so theirs never
+// run out
+_Thread_local int64_t steps_until_check = INT64_MAX;
+
+// Whether there's a limit on how long a program can run for
+bool execution_limited;
+
+static bool has_step_limit, has_time_limit;
+static uint64_t max_steps, steps_taken;
+static uint64_t time_limit;
+
+// Set by the timer once the time limit's passed
+static volatile sig_atomic_t time_expired;
+
+// The main thread's countdown, which the timer ends from whatever thread
+// it interrupts
+static int64_t *volatile main_countdown;
+
+// What's written when the program's ended in the middle of a builtin, which
+// has to be made ahead of time
+static char expired_message[96];
+static size_t expired_message_length;
+
+// What steps_until_check was last set to, to tell how many steps were taken
+static int64_t countdown_start = INT64_MAX;
+
+// Counts the steps taken since the last check, and sets the countdown to
+// however many can be taken before the next one
+static void restart_countdown() {
+  steps_taken += countdown_start - steps_until_check;
+  uint64_t countdown = INT64_MAX;
+  if (has_step_limit) {
+    countdown = steps_taken < max_steps ? max_steps - steps_taken : 0;
+  }
+  if (has_time_limit) {
+    countdown = min(countdown, STEPS_BETWEEN_TIME_CHECKS);
+  }
+  countdown_start = steps_until_check = min(countdown, INT64_MAX);
+}
+
+// Ends the program after at most the given number of steps, where a step is
+// an instruction of code that's run, however it's run
+void set_step_limit(uint64_t steps) {
+  restart_countdown();
+  max_steps = steps_taken + steps;
+  has_step_limit = execution_limited = true;
+  restart_countdown();
+}
+
+// Called by the timer once the time limit's passed, which has the next step
+// that's counted end the program. The timer goes off again a little later,
+// which means it's stuck in a builtin, so it's ended right then, without
+// writing out any output that's still buffered
+static void time_limit_passed(int signal) {
+  (void) signal;
+  if (!time_expired) {
+    time_expired = 1;
+    *main_countdown = 0;
+  }
+  else {
+    write(STDERR_FILENO, expired_message, expired_message_length);
+    _exit(LIMIT_EXIT_STATUS);
+  }
+}
+
+// Ends the program once the given number of milliseconds have passed
+void set_time_limit(uint64_t milliseconds) {
+  time_limit = milliseconds;
+  int length = snprintf(expired_message, sizeof(expired_message),
+                        "Error! Exceeded the time limit of %llu "
+                        "milliseconds!\n", (unsigned long long) milliseconds);
+  expired_message_length = min((size_t) length, sizeof(expired_message) - 1);
+  main_countdown = &steps_until_check;
+
+  struct sigaction action = {.sa_handler = time_limit_passed};
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGALRM, &action, NULL);
+
+  // A timer that's all zeros is turned off, so no time at all is a moment
+  struct itimerval timer = {
+    .it_interval = {0, GRACE_MILLISECONDS * 1000},
+    .it_value = {milliseconds / 1000, milliseconds % 1000 * 1000}
+  };
+  if (milliseconds == 0) {
+    timer.it_value.tv_usec = 1;
+  }
+  if (setitimer(ITIMER_REAL, &timer, NULL) != 0) {
+    error("Unable to set a timer for the time limit!");
+  }
+  has_time_limit = execution_limited = true;
+  restart_countdown();
+}
+
+// Returns how many steps have been taken in all
+uint64_t steps_so_far() {
+  return steps_taken + (countdown_start - steps_until_check);
+}
+
+// Goes back to having taken the given number of steps, for work that's given
+// up on and redone
+void rewind_steps(uint64_t steps) {
+  steps_taken = steps;
+  countdown_start = steps_until_check;
+  restart_countdown();
+}
+
+// Called once the countdown has run out, ending the program if it's gone
+// past either of its limits. The time limit's checked first, since the timer
+// ending the countdown early counts steps that weren't taken. A sandbox that unwinds takes its steps back, so
+// the limit is hit again once its work is redone
+void check_limits() {
+  steps_taken += countdown_start - steps_until_check;
+  countdown_start = steps_until_check = 0;
+  if (has_time_limit && time_expired) {
+    error_with_status(LIMIT_EXIT_STATUS,
+                      "Exceeded the time limit of %llu milliseconds!",
+                      (unsigned long long) time_limit);
+  }
+  if (has_step_limit && steps_taken > max_steps) {
+    error_with_status(LIMIT_EXIT_STATUS, "Exceeded the limit of %llu steps!",
+                      (unsigned long long) max_steps);
+  }
+  restart_countdown();
+}
@@ -0,0 +1,49 @@
+// lines.c
+// Contains --lines, which runs a program once for each line of its input,
+// like awk, with the line as the only item on the stack. Each line's stack
+// is output as soon as the program is done with it, so input is streamed
+// through rather than read all at once
+
+// For getdelim
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "golf.h"
+
+// Empties the stack and the brackets left over from the last record
+static void clear_stack() {
+  free_array(&stack);
+  stack = new_array();
+  free_array(&bracket_stack);
+  bracket_stack = new_array();
+}
+
+// Runs the program on each record of the input, which are separated by the
+// delimiter, and don't include it. A delimiter after the last record doesn't
+// start another one. What's been assigned is forgotten after each record,
+// unless it's to be kept
+void run_lines(Code *program, int delimiter, bool keep_definitions) {
+  char *record = NULL;
+  size_t size = 0;
+  ssize_t length;
+
+  while ((length = getdelim(&record, &size, delimiter, stdin)) >= 0) {
+    if (length > 0 && record[length - 1] == delimiter) {
+      length--;
+    }
+    stack_push(make_string_from(string_from_chars((unsigned char *) record,
+                                                  length)));
+    execute_code(program);
+    output_stack();
+    output_hand_off();
+    clear_stack();
+
+    if (!keep_definitions && definitions.num_items > 0) {
+      free_definitions();
+      init_definitions();
+      definitions_version++;
+    }
+  }
+  free(record);
+}
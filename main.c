@@ -1,17 +1,84 @@
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "golf.h"
 
 void print_help(const char *exe_name) {
-  printf("Usage: %s [--run script | file | --help]\n", exe_name);
+  printf("Usage: %s [--threads n] [--jit] [--cache] [--emit-c out.c]\n"
+         "       [--compile out.gsc] [--image file] [--save-image file]\n"
+         "       [--lines] [--delimiter c] [--keep-definitions]\n"
+         "       [--async-output] [--max-steps n] [--timeout ms]\n"
+         "       [--run script | file | --help]\n", exe_name);
   printf("--help           display this help message\n");
   printf("--run script     execute script passed in as string on the command line\n");
+  printf("--threads n      use up to n threads for filtering and finding with\n");
+  printf("                 side-effect-free blocks (default: one per processor)\n");
+  printf("--jit            compile code that's run often into machine code, on\n");
+  printf("                 x86-64 Linux\n");
+  printf("--emit-c out.c   translate the script into C instead of running it,\n");
+  printf("                 to be built with libgolf.a from make lib\n");
+  printf("--compile out.gsc\n");
+  printf("                 compile the script into bytecode instead of running\n");
+  printf("                 it, which can then be run in its place\n");
+  printf("--cache          keep the file's bytecode in __golfcache__ next to it,\n");
+  printf("                 and run that for as long as the file doesn't change\n");
+  printf("--save-image file\n");
+  printf("                 save what the script defines and leaves on the\n");
+  printf("                 stack to an image, instead of outputting the stack\n");
+  printf("--image file     start from an image, with its stack underneath the\n");
+  printf("                 input\n");
+  printf("--lines          run the script once for each line of the input,\n");
+  printf("                 outputting the stack after each\n");
+  printf("--delimiter c    with --lines, split the input on the character c\n");
+  printf("                 instead, where \\n, \\t and \\0 can be used too\n");
+  printf("--keep-definitions\n");
+  printf("                 with --lines, keep what's assigned from one line\n");
+  printf("                 to the next\n");
+  printf("--async-output   write output from a thread of its own, so that the\n");
+  printf("                 script doesn't wait on a slow reader\n");
+  printf("--max-steps n    stop the script once it's run n instructions\n");
+  printf("--timeout ms     stop the script once it's run for ms milliseconds\n");
+}
+
+// Reads the number given with --max-steps or --timeout
+static uint64_t parse_limit(const char *arg) {
+  char *end;
+  unsigned long long limit = strtoull(arg, &end, 10);
+  if (!isdigit((unsigned char) arg[0]) || *end != '\0' || limit > INT64_MAX) {
+    error("Invalid limit '%s'!", arg);
+  }
+  return limit;
+}
+
+// Reads the character given with --delimiter
+static int parse_delimiter(const char *arg) {
+  if (arg[0] != '\0' && arg[1] == '\0') {
+    return (unsigned char) arg[0];
+  }
+  else if (strcmp(arg, "\\n") == 0) {
+    return '\n';
+  }
+  else if (strcmp(arg, "\\t") == 0) {
+    return '\t';
+  }
+  else if (strcmp(arg, "\\0") == 0) {
+    return '\0';
+  }
+  error("Invalid delimiter '%s'!", arg);
 }
 
 int main(int argc, char *argv[]) {
   const char *filename = NULL;
   const char *command_text = NULL;
+  const char *emit_filename = NULL;
+  const char *compile_filename = NULL;
+  const char *image_filename = NULL;
+  const char *save_image_filename = NULL;
+  bool use_cache = false;
+  bool lines = false;
+  bool keep_definitions = false;
+  int delimiter = '\n';
 
   for (int i = 1; i < argc; i++) {
     if (argv[i][0] != '-') {
@@ -29,6 +96,75 @@ int main(int argc, char *argv[]) {
       }
       command_text = argv[i];
     }
+    else if (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--threads") == 0) {
+      if (++i == argc) {
+        error("No thread count given!");
+      }
+      char *end;
+      long count = strtol(argv[i], &end, 10);
+      if (*end != '\0' || count < 1 || count > 1024) {
+        error("Invalid thread count '%s'!", argv[i]);
+      }
+      thread_count = count;
+    }
+    else if (strcmp(argv[i], "--jit") == 0) {
+      jit_enabled = true;
+    }
+    else if (strcmp(argv[i], "--emit-c") == 0) {
+      if (++i == argc) {
+        error("No file given to write C to!");
+      }
+      emit_filename = argv[i];
+    }
+    else if (strcmp(argv[i], "--compile") == 0) {
+      if (++i == argc) {
+        error("No file given to write bytecode to!");
+      }
+      compile_filename = argv[i];
+    }
+    else if (strcmp(argv[i], "--image") == 0) {
+      if (++i == argc) {
+        error("No image given to start from!");
+      }
+      image_filename = argv[i];
+    }
+    else if (strcmp(argv[i], "--save-image") == 0) {
+      if (++i == argc) {
+        error("No file given to save the image to!");
+      }
+      save_image_filename = argv[i];
+    }
+    else if (strcmp(argv[i], "--cache") == 0) {
+      use_cache = true;
+    }
+    else if (strcmp(argv[i], "--lines") == 0) {
+      lines = true;
+    }
+    else if (strcmp(argv[i], "--delimiter") == 0) {
+      if (++i == argc) {
+        error("No delimiter given!");
+      }
+      delimiter = parse_delimiter(argv[i]);
+      lines = true;
+    }
+    else if (strcmp(argv[i], "--keep-definitions") == 0) {
+      keep_definitions = true;
+    }
+    else if (strcmp(argv[i], "--async-output") == 0) {
+      start_async_output();
+    }
+    else if (strcmp(argv[i], "--max-steps") == 0) {
+      if (++i == argc) {
+        error("No step limit given!");
+      }
+      set_step_limit(parse_limit(argv[i]));
+    }
+    else if (strcmp(argv[i], "--timeout") == 0) {
+      if (++i == argc) {
+        error("No time limit given!");
+      }
+      set_time_limit(parse_limit(argv[i]));
+    }
     else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
       print_help(argv[0]);
       return 0;
@@ -44,13 +180,27 @@ int main(int argc, char *argv[]) {
   else if (filename != NULL && command_text != NULL) {
     error("Can only run either a command-line script or file, not both!");
   }
+  else if (lines && (image_filename != NULL || save_image_filename != NULL)) {
+    error("Images can't be used with --lines!");
+  }
 
   String code;
+  Code *loaded = NULL;
+  size_t filename_len = filename != NULL ? strlen(filename) : 0;
+  bool is_bytecode = filename_len > 4 &&
+                     strcmp(filename + filename_len - 4, ".gsc") == 0;
 
-  if (filename) {
-    FILE *file = fopen(argv[1], "r");
+  if (is_bytecode) {
+    loaded = load_bytecode(filename, NULL);
+    if (loaded == NULL) {
+      error("'%s' isn't bytecode this version can run!", filename);
+    }
+    code = copy_string(&loaded->source);
+  }
+  else if (filename) {
+    FILE *file = fopen(filename, "r");
     if (file == NULL) {
-      error("Unable to open '%s'!", argv[1]);
+      error("Unable to open '%s'!", filename);
     }
     code = read_file_to_string(file);
     fclose(file);
@@ -59,10 +209,56 @@ int main(int argc, char *argv[]) {
     code = create_string(command_text);
   }
 
-  init_interpreter();
-  execute_string(&code);
-  end_interpreter();
-  free(code.str_data);
+  // Loaded bytecode is used as the program's compiled code, since it may be
+  // too big for the code cache to find it again
+  if (emit_filename != NULL) {
+    if (loaded != NULL) {
+      release_code(loaded);
+    }
+    emit_c(&code, emit_filename);
+  }
+  else if (compile_filename != NULL) {
+    Code *program = loaded != NULL ? loaded : get_code(&code);
+    if (!write_bytecode(program, compile_filename)) {
+      error("Unable to write bytecode to '%s'!", compile_filename);
+    }
+    release_code(program);
+    free_code_cache();
+  }
+  else if (lines) {
+    init_interpreter_without_input();
+    Code *program = loaded;
+    if (program == NULL) {
+      program = use_cache && filename != NULL
+              ? get_cached_code(&code, filename) : get_code(&code);
+    }
+    run_lines(program, delimiter, keep_definitions);
+    release_code(program);
+    free_interpreter();
+  }
+  else {
+    init_interpreter();
+    if (image_filename != NULL) {
+      load_image(image_filename);
+    }
+    Code *program = loaded;
+    if (program == NULL) {
+      program = use_cache && filename != NULL
+              ? get_cached_code(&code, filename) : get_code(&code);
+    }
+    execute_code(program);
+    release_code(program);
+    if (save_image_filename == NULL) {
+      end_interpreter();
+    }
+    else if (save_image(save_image_filename)) {
+      free_interpreter();
+    }
+    else {
+      error("Unable to save the image to '%s'!", save_image_filename);
+    }
+  }
+  free_string(&code);
 
   return 0;
 }
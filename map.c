@@ -9,19 +9,10 @@
 #define MAP_INIT_SIZE 64
 #define MAP_MAX_LOAD_FACTOR 0.6
 
-// Implements the djb2 hash function over a key
-static uint32_t hash(const String *key) {
-  uint32_t hash_val = 5381;
-  for (uint32_t i = 0; i < key->length; i++) {
-    hash_val = ((hash_val << 5) + hash_val) + key->str_data[i];
-  }
-  return hash_val;
-}
-
 // Gets the appropriate slot for a given key in a given map
 static uint32_t get_slot(Map *map, const String *key) {
   uint32_t mask = map->allocated - 1;
-  return hash(key) & mask;
+  return string_hash(key) & mask;
 }
 
 Map new_map() {
@@ -0,0 +1,152 @@
+// output.c
+// Contains the function everything a program outputs goes through. Output
+// is normally written as soon as it's made, but with --async-output it's
+// collected into a ring of buffers that a writer thread of its own drains,
+// so that the interpreter only waits on a slow reader once the ring is full
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "golf.h"
+
+#define OUTPUT_BUFFER_SIZE 65536
+#define OUTPUT_NUM_BUFFERS 8
+
+// The buffers waiting to be written are the count of them from head onwards,
+// and the one after those, filling, is being filled. The lock covers head,
+// count and stopping, while filling belongs to the interpreter alone
+static struct {
+  unsigned char *buffers[OUTPUT_NUM_BUFFERS];
+  uint32_t lengths[OUTPUT_NUM_BUFFERS];
+  uint32_t head, count, filling;
+  bool stopping;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  pthread_t writer;
+} ring = {
+  .lock = PTHREAD_MUTEX_INITIALIZER, .changed = PTHREAD_COND_INITIALIZER
+};
+
+static bool async_output;
+
+// Writes all of the bytes, however many calls it takes
+static void write_all(const unsigned char *bytes, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(STDOUT_FILENO, bytes, length);
+    if (written <= 0) {
+      return;
+    }
+    bytes += written;
+    length -= written;
+  }
+}
+
+static void *output_writer(void *arg) {
+  (void) arg;
+  pthread_mutex_lock(&ring.lock);
+  while (true) {
+    while (ring.count == 0 && !ring.stopping) {
+      pthread_cond_wait(&ring.changed, &ring.lock);
+    }
+    if (ring.count == 0) {
+      break;
+    }
+    uint32_t head = ring.head;
+    pthread_mutex_unlock(&ring.lock);
+    write_all(ring.buffers[head], ring.lengths[head]);
+    pthread_mutex_lock(&ring.lock);
+    ring.head = (ring.head + 1) % OUTPUT_NUM_BUFFERS;
+    ring.count--;
+    pthread_cond_broadcast(&ring.changed);
+  }
+  pthread_mutex_unlock(&ring.lock);
+  return NULL;
+}
+
+// Queues the buffer being filled to be written, waiting for the writer to
+// finish with one if the rest are all queued
+static void queue_buffer() {
+  pthread_mutex_lock(&ring.lock);
+  while (ring.count == OUTPUT_NUM_BUFFERS - 1) {
+    pthread_cond_wait(&ring.changed, &ring.lock);
+  }
+  ring.count++;
+  ring.filling = (ring.filling + 1) % OUTPUT_NUM_BUFFERS;
+  ring.lengths[ring.filling] = 0;
+  pthread_cond_broadcast(&ring.changed);
+  pthread_mutex_unlock(&ring.lock);
+}
+
+static void stop_async_output() {
+  output_flush();
+  pthread_mutex_lock(&ring.lock);
+  ring.stopping = true;
+  pthread_cond_broadcast(&ring.changed);
+  pthread_mutex_unlock(&ring.lock);
+  pthread_join(ring.writer, NULL);
+  async_output = false;
+}
+
+// Starts the writer thread for --async-output, leaving output to be written
+// straight away if it can't be started. Anything left is written at exit
+void start_async_output() {
+  for (uint32_t i = 0; i < OUTPUT_NUM_BUFFERS; i++) {
+    ring.buffers[i] = malloc(OUTPUT_BUFFER_SIZE);
+    if (ring.buffers[i] == NULL) {
+      error("Unable to allocate space for output!");
+    }
+  }
+  if (pthread_create(&ring.writer, NULL, output_writer, NULL) == 0) {
+    async_output = true;
+    atexit(stop_async_output);
+  }
+}
+
+void output_bytes(const void *bytes, size_t length) {
+  if (!async_output) {
+    write_all(bytes, length);
+    return;
+  }
+  const unsigned char *next = bytes;
+  while (length > 0) {
+    uint32_t buffer = ring.filling;
+    size_t to_copy = min(length, OUTPUT_BUFFER_SIZE - ring.lengths[buffer]);
+    memcpy(ring.buffers[buffer] + ring.lengths[buffer], next, to_copy);
+    ring.lengths[buffer] += to_copy;
+    next += to_copy;
+    length -= to_copy;
+    if (ring.lengths[buffer] == OUTPUT_BUFFER_SIZE) {
+      queue_buffer();
+    }
+  }
+}
+
+// Hands what's been output on to the writer if it has nothing else to do,
+// so that output keeps streaming out without each piece being written on
+// its own while the reader is behind
+void output_hand_off() {
+  if (async_output && ring.lengths[ring.filling] > 0) {
+    pthread_mutex_lock(&ring.lock);
+    bool idle = ring.count == 0;
+    pthread_mutex_unlock(&ring.lock);
+    if (idle) {
+      queue_buffer();
+    }
+  }
+}
+
+// Waits for everything that's been output to be written
+void output_flush() {
+  if (!async_output) {
+    return;
+  }
+  if (ring.lengths[ring.filling] > 0) {
+    queue_buffer();
+  }
+  pthread_mutex_lock(&ring.lock);
+  while (ring.count > 0) {
+    pthread_cond_wait(&ring.changed, &ring.lock);
+  }
+  pthread_mutex_unlock(&ring.lock);
+}
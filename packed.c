@@ -0,0 +1,354 @@
+// packed.c
+// Contains functions for packed arrays, which stand in for arrays of integers
+// with one byte or one int64 per element instead of a whole item each
+
+#include <stdlib.h>
+#include <string.h>
+#include "golf.h"
+
+#define PACKED_INIT_SIZE 16
+
+// Arrays shorter than this aren't worth packing, since they're often about
+// to be taken apart again
+#define PACKED_MIN_LENGTH 16
+
+Packed new_packed() {
+  Packed packed = {
+    .bytes = region_malloc(PACKED_INIT_SIZE), .length = 0,
+    .allocated = PACKED_INIT_SIZE, .start = 0, .is_wide = false
+  };
+  if (packed.bytes == NULL) {
+    error("Unable to allocate space for packed array!");
+  }
+  return packed;
+}
+
+static inline size_t element_size(const Packed *packed) {
+  return packed->is_wide ? sizeof(int64_t) : sizeof(uint8_t);
+}
+
+// Returns the start of a packed array's allocation
+static inline uint8_t *packed_buffer(const Packed *packed) {
+  return packed->bytes - packed->start * element_size(packed);
+}
+
+void free_packed(Packed *packed) {
+  region_free(packed_buffer(packed));
+}
+
+// Moves a packed array's elements back to the start of its allocation
+static void packed_compact(Packed *packed) {
+  uint8_t *buffer = packed_buffer(packed);
+  memmove(buffer, packed->bytes, element_size(packed) * packed->length);
+  packed->bytes = buffer;
+  packed->allocated += packed->start;
+  packed->start = 0;
+}
+
+Packed copy_packed(const Packed *packed) {
+  Packed new_packed = *packed;
+  new_packed.start = 0;
+  new_packed.bytes = region_malloc(element_size(packed) * packed->allocated);
+  if (new_packed.bytes == NULL) {
+    error("Unable to allocate space for packed array!");
+  }
+  memcpy(new_packed.bytes, packed->bytes,
+         element_size(packed) * packed->length);
+  return new_packed;
+}
+
+int64_t packed_get(const Packed *packed, uint32_t index) {
+  return packed->is_wide ? packed->ints[index] : packed->bytes[index];
+}
+
+// Switches a packed array from bytes to int64s, for a value that isn't a byte
+static void packed_widen(Packed *packed) {
+  int64_t *ints = region_malloc(sizeof(int64_t) * packed->allocated);
+  if (ints == NULL) {
+    error("Unable to allocate space for packed array!");
+  }
+  for (uint32_t i = 0; i < packed->length; i++) {
+    ints[i] = packed->bytes[i];
+  }
+  region_free(packed_buffer(packed));
+  packed->ints = ints;
+  packed->start = 0;
+  packed->is_wide = true;
+}
+
+void packed_push(Packed *packed, int64_t val) {
+  if (!packed->is_wide && (val < 0 || val > UINT8_MAX)) {
+    packed_widen(packed);
+  }
+  if (packed->length >= packed->allocated && packed->start > 0) {
+    packed_compact(packed);
+  }
+  if (packed->length >= packed->allocated) {
+    packed->allocated <<= 1;
+    packed->bytes = region_realloc(packed->bytes,
+                                   element_size(packed) * packed->allocated);
+    if (packed->bytes == NULL) {
+      error("Unable to allocate additional space for packed array!");
+    }
+  }
+  if (packed->is_wide)
+    packed->ints[packed->length++] = val;
+  else
+    packed->bytes[packed->length++] = val;
+}
+
+// Turns an array into a packed array, if it's long enough to be worth it and
+// all its elements are integers that fit
+void item_pack(Item *item) {
+  if (item->type != TYPE_ARRAY || item->arr_val->length < PACKED_MIN_LENGTH) {
+    return;
+  }
+  Array *array = item->arr_val;
+  for (uint32_t i = 0; i < array->length; i++) {
+    if (array->items[i].type != TYPE_INTEGER ||
+        !bigint_fits_in_int64(&array->items[i].int_val))
+    {
+      return;
+    }
+  }
+
+  Packed packed = new_packed();
+  for (uint32_t i = 0; i < array->length; i++) {
+    packed_push(&packed, bigint_to_int64(&array->items[i].int_val));
+  }
+  free_array(array);
+  region_free(array);
+  *item = make_packed_from(packed);
+}
+
+// Creates the array of integers a packed array stands in for
+Array packed_to_array(const Packed *packed) {
+  Array array = new_array();
+  array_reserve(&array, packed->length);
+  for (uint32_t i = 0; i < packed->length; i++) {
+    array.items[i] = make_integer(packed_get(packed, i));
+  }
+  array.length = packed->length;
+  return array;
+}
+
+// Returns the index of an integer in a packed array, or -1 if it isn't in it
+int64_t packed_find(const Packed *packed, const Item *item) {
+  if (item->type != TYPE_INTEGER || !bigint_fits_in_int64(&item->int_val)) {
+    return -1;
+  }
+  int64_t val = bigint_to_int64(&item->int_val);
+  if (!packed->is_wide) {
+    if (val < 0 || val > UINT8_MAX) {
+      return -1;
+    }
+    uint8_t *found = memchr(packed->bytes, val, packed->length);
+    return found == NULL ? -1 : found - packed->bytes;
+  }
+  for (uint32_t i = 0; i < packed->length; i++) {
+    if (packed->ints[i] == val) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Compares an element of a packed array with an item, the same way as the
+// integer it stands in for would be compared
+static int compare_element(int64_t val, const Item *item) {
+  if (item->type != TYPE_INTEGER) {
+    return -1;
+  }
+  if (!bigint_fits_in_int64(&item->int_val)) {
+    return bigint_is_negative(&item->int_val) ? 1 : -1;
+  }
+  int64_t other = bigint_to_int64(&item->int_val);
+  return (val > other) - (val < other);
+}
+
+static int compare_lengths(uint32_t length1, uint32_t length2) {
+  return (length1 > length2) - (length1 < length2);
+}
+
+// Compares a packed array with another item the same way as item_compare
+// would compare the array it stands in for
+int packed_compare(const Packed *packed, const Item *other) {
+  if (other->type == TYPE_PACKED) {
+    const Packed *packed2 = other->packed_val;
+    for (uint32_t i = 0; i < packed->length && i < packed2->length; i++) {
+      int64_t val1 = packed_get(packed, i), val2 = packed_get(packed2, i);
+      if (val1 != val2) {
+        return val1 > val2 ? 1 : -1;
+      }
+    }
+    return compare_lengths(packed->length, packed2->length);
+  }
+  else if (other->type == TYPE_ARRAY) {
+    const Array *array = other->arr_val;
+    for (uint32_t i = 0; i < packed->length && i < array->length; i++) {
+      int result = compare_element(packed_get(packed, i), &array->items[i]);
+      if (result != 0) {
+        return result;
+      }
+    }
+    return compare_lengths(packed->length, array->length);
+  }
+  else if (other->type == TYPE_STRING || other->type == TYPE_BLOCK) {
+    const String *str = other->str_val;
+    for (uint32_t i = 0; i < packed->length; i++) {
+      int64_t val = packed_get(packed, i);
+      if (i >= str->length || val < 0 || val > UINT32_MAX) {
+        return 1;
+      }
+      if (val != str->str_data[i]) {
+        return val > str->str_data[i] ? 1 : -1;
+      }
+    }
+    return compare_lengths(packed->length, str->length);
+  }
+  // Integers come before arrays
+  return 1;
+}
+
+// Keeps only the first new_len elements of a packed array
+void packed_truncate(Packed *packed, uint32_t new_len) {
+  packed->length = min(packed->length, new_len);
+}
+
+// Removes a number of elements from the packed array's front
+void packed_remove_from_front(Packed *packed, Bigint to_remove) {
+  if (bigint_is_negative(&to_remove) || bigint_is_zero(&to_remove))
+    return;
+
+  uint32_t to_remove_int;
+  if (!bigint_fits_in_uint32(&to_remove))
+    to_remove_int = packed->length;
+  else
+    to_remove_int = min(bigint_to_uint32(&to_remove), packed->length);
+
+  packed_drop_front(packed, to_remove_int);
+}
+
+// Removes the first elements of a packed array in constant time, by leaving
+// the rest where they are
+void packed_drop_front(Packed *packed, uint32_t to_drop) {
+  packed->bytes += element_size(packed) * to_drop;
+  packed->start += to_drop;
+  packed->allocated -= to_drop;
+  packed->length -= to_drop;
+}
+
+// Adds the elements of another packed array to the end of a packed array
+void packed_concat(Packed *packed, const Packed *to_add) {
+  if (to_add->is_wide && !packed->is_wide) {
+    packed_widen(packed);
+  }
+  for (uint32_t i = 0; i < to_add->length; i++) {
+    packed_push(packed, packed_get(to_add, i));
+  }
+}
+
+static int int64_compare(const void *a, const void *b) {
+  int64_t int_a = *(const int64_t *) a;
+  int64_t int_b = *(const int64_t *) b;
+  return (int_a > int_b) - (int_a < int_b);
+}
+
+void packed_sort(Packed *packed) {
+  if (packed->is_wide) {
+    qsort(packed->ints, packed->length, sizeof(int64_t), int64_compare);
+    return;
+  }
+
+  // Bytes can just be counted
+  uint32_t counts[UINT8_MAX + 1] = {0};
+  for (uint32_t i = 0; i < packed->length; i++) {
+    counts[packed->bytes[i]]++;
+  }
+  uint32_t pos = 0;
+  for (uint32_t c = 0; c <= UINT8_MAX; c++) {
+    memset(packed->bytes + pos, c, counts[c]);
+    pos += counts[c];
+  }
+}
+
+// Returns the array made by running a block over each element
+Array map_packed(const Packed *packed, Item *block) {
+  Array mapped_array = new_array();
+  Code *code = get_code(block->str_val);
+  for (uint32_t i = 0; i < packed->length; i++) {
+    uint32_t start_stack_size = stack.length;
+    stack_push(make_integer(packed_get(packed, i)));
+    execute_code(code);
+    for (uint32_t j = start_stack_size; j < stack.length; j++) {
+      item_expand(&stack.items[j]);
+      array_push(&mapped_array, stack.items[j]);
+    }
+    stack.length = min(stack.length, start_stack_size);
+  }
+  release_code(code);
+  return mapped_array;
+}
+
+void fold_packed(const Packed *packed, Item *block) {
+  if (native_fold_packed(packed, block)) {
+    return;
+  }
+  if (packed->length > 0) {
+    stack_push(make_integer(packed_get(packed, 0)));
+    Code *code = get_code(block->str_val);
+    for (uint32_t i = 1; i < packed->length; i++) {
+      stack_push(make_integer(packed_get(packed, i)));
+      execute_code(code);
+    }
+    release_code(code);
+  }
+}
+
+// Keeps the elements of a packed array that a block is true for
+void filter_packed(Packed *packed, Item *block) {
+  if (parallel_filter_packed(packed, block)) {
+    return;
+  }
+
+  uint32_t kept = 0;
+  Code *code = get_code(block->str_val);
+  for (uint32_t i = 0; i < packed->length; i++) {
+    int64_t val = packed_get(packed, i);
+    stack_push(make_integer(val));
+    execute_code(code);
+    Item mapped_item = stack_pop();
+    if (item_boolean(&mapped_item)) {
+      if (packed->is_wide)
+        packed->ints[kept++] = val;
+      else
+        packed->bytes[kept++] = val;
+    }
+    free_item(&mapped_item);
+  }
+  release_code(code);
+  packed->length = kept;
+}
+
+// Returns the index of the first element a block is true for, or -1 if
+// there isn't one
+int64_t find_in_packed(const Packed *packed, Item *block) {
+  int64_t index;
+  if (parallel_find_packed(packed, block, &index)) {
+    return index;
+  }
+
+  index = -1;
+  Code *code = get_code(block->str_val);
+  for (uint32_t i = 0; i < packed->length && index < 0; i++) {
+    stack_push(make_integer(packed_get(packed, i)));
+    execute_code(code);
+    Item item_bool = stack_pop();
+    if (item_boolean(&item_bool)) {
+      index = i;
+    }
+    free_item(&item_bool);
+  }
+  release_code(code);
+  return index;
+}
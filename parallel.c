@@ -0,0 +1,435 @@
+// parallel.c
+// Contains functions for evaluating side-effect-free blocks over the elements
+// of an array or string on several threads at once
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "golf.h"
+
+// Below this many elements, starting threads costs more than it saves
+#define PARALLEL_MIN_ELEMENTS 1024
+
+// How deeply user-defined blocks are followed when checking for purity
+#define PURITY_MAX_DEPTH 16
+
+// The number of threads used for parallel evaluation, with 0 meaning one
+// per online processor
+uint32_t thread_count;
+
+static uint32_t get_thread_count() {
+  if (thread_count == 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = online > 0 ? online : 1;
+  }
+  return thread_count;
+}
+
+// Set on the threads started here, which must not change anything shared
+_Thread_local bool is_worker_thread;
+
+// Returns whether executing an item can have effects beyond the stack.
+// Blocks are followed into, so that e.g. puts is caught through its print
+static bool item_is_pure(const Item *item, int depth);
+
+static bool code_is_pure(Code *code, int depth) {
+  if (depth > PURITY_MAX_DEPTH) {
+    return false;
+  }
+
+  // Malformed code is treated as impure, so that the error is raised by the
+  // sequential path at the right moment
+  for (uint32_t i = 0; i < code->length; i++) {
+    Instruction *instr = &code->instructions[i];
+    if (instr->op == OP_ERROR) {
+      return false;
+    }
+    else if (instr->op == OP_PIPELINE || instr->op == OP_FUSED) {
+      continue;
+    }
+
+    Item *defined_item = instruction_definition(instr);
+    if (defined_item != NULL) {
+      if (!item_is_pure(defined_item, depth + 1))
+        return false;
+    }
+    else if (instr->op == OP_ASSIGN) {
+      return false;
+    }
+    else if (instr->block != NULL && !code_is_pure(instr->block, depth + 1)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool item_is_pure(const Item *item, int depth) {
+  if (item->type == TYPE_FUNCTION) {
+    return item->function != builtin_print && item->function != builtin_puts &&
+           item->function != builtin_p && item->function != builtin_rand;
+  }
+  else if (item->type == TYPE_BLOCK) {
+    Code *code = get_code(item->str_val);
+    bool pure = code_is_pure(code, depth);
+    release_code(code);
+    return pure;
+  }
+  // The lazy input reads more of itself into a buffer shared by everything,
+  // which only the main thread can do
+  return item->type != TYPE_INPUT;
+}
+
+// Returns whether a block can be run with a private stack on another thread
+// without anyone being able to tell
+bool block_is_pure(const Item *block) {
+  return item_is_pure(block, 0);
+}
+
+// Called before executing a defined item inside a sandbox, unwinding the
+// sandbox if the item would have an effect outside of it. Code that's only
+// found while it runs, like a string run with ~, can still reach the input
+// on a worker thread
+void sandbox_check(const Item *item) {
+  if (item->type == TYPE_FUNCTION && !item_is_pure(item, 0)) {
+    error("Impure function called inside a sandbox!");
+  }
+  if (item->type == TYPE_INPUT && is_worker_thread) {
+    error("Input used on a worker thread!");
+  }
+}
+
+// The state shared between the threads working on one parallel operation
+typedef struct ParallelJob {
+  const Item *block;
+  Code *code;           // The block's compiled code, shared by every thread
+  const Array *array;   // The array being worked on, if any
+  const String *str;    // The string being worked on, if any
+  const Range *range;   // The range being worked on, if any
+  const Packed *packed; // The packed array being worked on, if any
+  bool *results;        // For filtering, the predicate's value per element
+  atomic_int_fast64_t first_match;  // For finding, the lowest matching index
+  atomic_int_fast64_t first_escape; // The lowest index that left the sandbox
+} ParallelJob;
+
+typedef struct ParallelChunk {
+  ParallelJob *job;
+  uint32_t start, end;
+  bool stop_at_match;
+} ParallelChunk;
+
+static void atomic_lower(atomic_int_fast64_t *val, int64_t new_val) {
+  int_fast64_t old_val = atomic_load(val);
+  while (new_val < old_val &&
+         !atomic_compare_exchange_weak(val, &old_val, new_val));
+}
+
+// Runs the block over one element on this thread's private stack, returning
+// the truthiness of its result
+static bool run_predicate(const ParallelJob *job, uint32_t index) {
+  if (job->array != NULL)
+    stack_push(make_copy(&job->array->items[index]));
+  else if (job->str != NULL)
+    stack_push(make_integer(job->str->str_data[index]));
+  else if (job->range != NULL)
+    stack_push(make_integer((int64_t) job->range->start + index));
+  else
+    stack_push(make_integer(packed_get(job->packed, index)));
+
+  execute_code(job->code);
+
+  // Anything other than exactly one result means the block reached past
+  // the element it was given, which the sandbox can't reproduce
+  if (stack.length != 1 || bracket_stack.length != 0) {
+    error("Block left the sandbox!");
+  }
+  Item result = stack_pop();
+  bool truthy = item_boolean(&result);
+  free_item(&result);
+  return truthy;
+}
+
+static void *chunk_worker(void *arg) {
+  ParallelChunk *chunk = arg;
+  ParallelJob *job = chunk->job;
+  volatile uint32_t i = chunk->start;
+  jmp_buf escape;
+
+  is_worker_thread = true;
+  stack = new_array();
+  bracket_stack = new_array();
+  init_call_stack();
+
+  // Everything made for an element comes from the region, so that whatever
+  // was in flight when the sandbox was left is thrown away along with it
+  region_start();
+  if (setjmp(escape) == 0) {
+    sandbox_escape = &escape;
+    for (; i < chunk->end; i++) {
+      if (chunk->stop_at_match && i >= atomic_load(&job->first_match)) {
+        break;
+      }
+      bool truthy = run_predicate(job, i);
+      region_clear();
+      if (job->results != NULL) {
+        job->results[i] = truthy;
+      }
+      if (truthy && chunk->stop_at_match) {
+        atomic_lower(&job->first_match, i);
+        break;
+      }
+    }
+  }
+  else {
+    atomic_lower(&job->first_escape, i);
+  }
+  sandbox_escape = NULL;
+
+  free_array(&stack);
+  free_array(&bracket_stack);
+  free_region();
+  return NULL;
+}
+
+// Splits the elements of a job into one chunk per thread and waits for
+// every thread to finish with its chunk
+static void run_job(ParallelJob *job, uint32_t length, bool stop_at_match) {
+  uint32_t num_threads = min(get_thread_count(), length);
+  uint32_t chunk_len = (length + num_threads - 1) / num_threads;
+  pthread_t *threads = malloc(sizeof(pthread_t) * num_threads);
+  ParallelChunk *chunks = malloc(sizeof(ParallelChunk) * num_threads);
+  if (threads == NULL || chunks == NULL) {
+    error("Unable to allocate space for worker threads!");
+  }
+
+  // The block was compiled and cached when checking it was pure, so the
+  // threads all run the same code without having to compile it themselves
+  job->code = get_code(job->block->str_val);
+  atomic_init(&job->first_match, length);
+  atomic_init(&job->first_escape, length);
+
+  for (uint32_t i = 0; i < num_threads; i++) {
+    chunks[i].job = job;
+    chunks[i].start = min(i * chunk_len, length);
+    chunks[i].end = min(chunks[i].start + chunk_len, length);
+    chunks[i].stop_at_match = stop_at_match;
+    if (pthread_create(&threads[i], NULL, chunk_worker, &chunks[i]) != 0) {
+      error("Unable to start worker thread!");
+    }
+  }
+  for (uint32_t i = 0; i < num_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  release_code(job->code);
+  free(threads);
+  free(chunks);
+}
+
+// Worker threads don't count toward --max-steps or --timeout, so nothing is
+// run on them while there are limits
+static bool worth_parallelizing(uint32_t length, const Item *block) {
+  return sandbox_escape == NULL && !execution_limited &&
+         length >= PARALLEL_MIN_ELEMENTS &&
+         get_thread_count() > 1 && block_is_pure(block);
+}
+
+// Filters an array on several threads, keeping the original order
+// Returns false without touching the array if it has to be done sequentially
+bool parallel_filter_array(Array *array, const Item *block) {
+  if (!worth_parallelizing(array->length, block)) {
+    return false;
+  }
+
+  ParallelJob job = {
+    .block = block, .array = array, .str = NULL, .range = NULL,
+    .packed = NULL, .results = malloc(sizeof(bool) * array->length)
+  };
+  if (job.results == NULL) {
+    error("Unable to allocate space for filter results!");
+  }
+  run_job(&job, array->length, false);
+
+  bool succeeded = atomic_load(&job.first_escape) == array->length;
+  if (succeeded) {
+    uint32_t items_removed = 0;
+    for (uint32_t i = 0; i < array->length; i++) {
+      if (job.results[i]) {
+        array->items[i - items_removed] = array->items[i];
+      }
+      else {
+        free_item(&array->items[i]);
+        items_removed++;
+      }
+    }
+    array->length -= items_removed;
+  }
+
+  free(job.results);
+  return succeeded;
+}
+
+// Filters a string on several threads, keeping the original order
+// Returns false without touching the string if it has to be done sequentially
+bool parallel_filter_string(String *str, const Item *block) {
+  if (!worth_parallelizing(str->length, block)) {
+    return false;
+  }
+
+  ParallelJob job = {
+    .block = block, .array = NULL, .str = str, .range = NULL,
+    .packed = NULL, .results = malloc(sizeof(bool) * str->length)
+  };
+  if (job.results == NULL) {
+    error("Unable to allocate space for filter results!");
+  }
+  run_job(&job, str->length, false);
+
+  bool succeeded = atomic_load(&job.first_escape) == str->length;
+  if (succeeded) {
+    uint32_t chars_removed = 0;
+    for (uint32_t i = 0; i < str->length; i++) {
+      if (job.results[i])
+        str->str_data[i - chars_removed] = str->str_data[i];
+      else
+        chars_removed++;
+    }
+    str->length -= chars_removed;
+  }
+
+  free(job.results);
+  return succeeded;
+}
+
+// Filters a range on several threads into a new array of the kept integers
+// Returns false if it has to be done sequentially
+bool parallel_filter_range(const Range *range, const Item *block,
+                           Array *filtered)
+{
+  if (!worth_parallelizing(range->length, block)) {
+    return false;
+  }
+
+  ParallelJob job = {
+    .block = block, .array = NULL, .str = NULL, .range = range,
+    .packed = NULL, .results = malloc(sizeof(bool) * range->length)
+  };
+  if (job.results == NULL) {
+    error("Unable to allocate space for filter results!");
+  }
+  run_job(&job, range->length, false);
+
+  bool succeeded = atomic_load(&job.first_escape) == range->length;
+  if (succeeded) {
+    *filtered = new_array();
+    for (uint32_t i = 0; i < range->length; i++) {
+      if (job.results[i]) {
+        array_push(filtered, make_integer((int64_t) range->start + i));
+      }
+    }
+  }
+
+  free(job.results);
+  return succeeded;
+}
+
+// Filters a packed array on several threads, keeping the original order
+// Returns false without touching the array if it has to be done sequentially
+bool parallel_filter_packed(Packed *packed, const Item *block) {
+  if (!worth_parallelizing(packed->length, block)) {
+    return false;
+  }
+
+  ParallelJob job = {
+    .block = block, .array = NULL, .str = NULL, .range = NULL,
+    .packed = packed, .results = malloc(sizeof(bool) * packed->length)
+  };
+  if (job.results == NULL) {
+    error("Unable to allocate space for filter results!");
+  }
+  run_job(&job, packed->length, false);
+
+  bool succeeded = atomic_load(&job.first_escape) == packed->length;
+  if (succeeded) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < packed->length; i++) {
+      if (!job.results[i])
+        continue;
+      if (packed->is_wide)
+        packed->ints[kept++] = packed->ints[i];
+      else
+        packed->bytes[kept++] = packed->bytes[i];
+    }
+    packed->length = kept;
+  }
+
+  free(job.results);
+  return succeeded;
+}
+
+// Finds the index of the first element the block is true for, or -1 if there
+// is none. Once a match is known, work on later elements is abandoned.
+// Returns false if it has to be done sequentially
+static bool parallel_find(ParallelJob *job, uint32_t length, int64_t *index) {
+  run_job(job, length, true);
+
+  int64_t first_match = atomic_load(&job->first_match);
+  int64_t first_escape = atomic_load(&job->first_escape);
+
+  // A block escaping the sandbox only matters if it happened before the match
+  if (first_escape < first_match) {
+    return false;
+  }
+  *index = first_match == length ? -1 : first_match;
+  return true;
+}
+
+bool parallel_find_array(const Array *array, const Item *block,
+                         int64_t *index)
+{
+  if (!worth_parallelizing(array->length, block)) {
+    return false;
+  }
+  ParallelJob job = {
+    .block = block, .array = array, .str = NULL, .range = NULL, .packed = NULL
+  };
+  return parallel_find(&job, array->length, index);
+}
+
+bool parallel_find_string(const String *str, const Item *block,
+                          int64_t *index)
+{
+  if (!worth_parallelizing(str->length, block)) {
+    return false;
+  }
+  ParallelJob job = {
+    .block = block, .array = NULL, .str = str, .range = NULL, .packed = NULL
+  };
+  return parallel_find(&job, str->length, index);
+}
+
+bool parallel_find_range(const Range *range, const Item *block,
+                         int64_t *index)
+{
+  if (!worth_parallelizing(range->length, block)) {
+    return false;
+  }
+  ParallelJob job = {
+    .block = block, .array = NULL, .str = NULL, .range = range, .packed = NULL
+  };
+  return parallel_find(&job, range->length, index);
+}
+
+bool parallel_find_packed(const Packed *packed, const Item *block,
+                          int64_t *index)
+{
+  if (!worth_parallelizing(packed->length, block)) {
+    return false;
+  }
+  ParallelJob job = {
+    .block = block, .array = NULL, .str = NULL, .range = NULL,
+    .packed = packed
+  };
+  return parallel_find(&job, packed->length, index);
+}
@@ -0,0 +1,356 @@
+// peephole.c
+// Contains functions for finding short sequences of instructions in compiled
+// code that can be done in one step, like adding two literals together or
+// pushing a literal only to pop it, and for running them
+
+#include <stdlib.h>
+#include "golf.h"
+
+// The builtin a token stands for, or NULL if it isn't one a fused
+// instruction can stand in for
+static void (*token_builtin(const Instruction *instr))(void) {
+  if (!is_token_op(instr->op) || instr->token.length != 1) {
+    return NULL;
+  }
+  switch (instr->token.str_data[0]) {
+    case '+':  return builtin_plus;
+    case '-':  return builtin_minus;
+    case '*':  return builtin_asterisk;
+    case ',':  return builtin_comma;
+    case ';':  return builtin_semicolon;
+    case '\\': return builtin_backslash;
+    case '$':  return builtin_dollar_sign;
+    case '.':  return builtin_period;
+    case '=':  return builtin_equal;
+    case '(':  return builtin_lparen;
+    case ')':  return builtin_rparen;
+    default:   return NULL;
+  }
+}
+
+// Returns whether an instruction is the given builtin's token
+static bool is_token(const Instruction *instr, char c) {
+  return is_token_op(instr->op) && instr->token.length == 1 &&
+         instr->token.str_data[0] == c;
+}
+
+// Returns whether an instruction pushes the given small integer
+static bool is_integer_literal(const Instruction *instr, int64_t val) {
+  return instr->op == OP_LITERAL && instr->literal.type == TYPE_INTEGER &&
+         bigint_fits_in_int64(&instr->literal.int_val) &&
+         bigint_to_int64(&instr->literal.int_val) == val;
+}
+
+// Applies an operator to a value and a literal, as the builtin would with
+// the literal on top, returning false if it can't be done here
+static bool fold_literal(Item *value, const Item *literal, char op) {
+  if (value->type == TYPE_INTEGER && literal->type == TYPE_INTEGER) {
+    if (op == '+') {
+      bigint_add(&value->int_val, &literal->int_val);
+    }
+    else if (op == '-') {
+      bigint_subtract(&value->int_val, &literal->int_val);
+    }
+    else {
+      Bigint product = bigint_multiply(&value->int_val, &literal->int_val);
+      free_bigint(&value->int_val);
+      value->int_val = product;
+    }
+    return true;
+  }
+  else if (value->type == TYPE_STRING && literal->type == TYPE_STRING &&
+           op == '+')
+  {
+    string_unshare(value->str_val);
+    string_add_str(value->str_val, literal->str_val);
+    return true;
+  }
+  return false;
+}
+
+// Folds the literal at the start of the instructions with whatever literals
+// and operators follow it, setting the number of instructions used. Returns
+// whether anything was folded into it
+static bool fold_constant(Instruction *instrs, uint32_t length, Item *value,
+                          uint32_t *num_instructions)
+{
+  *value = make_copy(&instrs[0].literal);
+  bool folded = false;
+  uint32_t pos = 1;
+
+  while (pos < length) {
+    uint32_t next = skip_blanks(instrs, length, pos);
+    if (next >= length) {
+      break;
+    }
+    if (is_token(&instrs[next], ',') && value->type == TYPE_INTEGER &&
+        (bigint_is_negative(&value->int_val) ||
+         bigint_fits_in_uint32(&value->int_val)))
+    {
+      uint32_t range_len = bigint_is_negative(&value->int_val)
+                         ? 0 : bigint_to_uint32(&value->int_val);
+      free_item(value);
+      *value = make_range(0, range_len);
+      pos = next + 1;
+      folded = true;
+      continue;
+    }
+
+    if (instrs[next].op != OP_LITERAL) {
+      break;
+    }
+    uint32_t op_pos = skip_blanks(instrs, length, next + 1);
+    if (op_pos >= length ||
+        !(is_token(&instrs[op_pos], '+') || is_token(&instrs[op_pos], '-') ||
+          is_token(&instrs[op_pos], '*')) ||
+        !fold_literal(value, &instrs[next].literal,
+                      instrs[op_pos].token.str_data[0]))
+    {
+      break;
+    }
+    pos = op_pos + 1;
+    folded = true;
+  }
+
+  *num_instructions = pos;
+  return folded;
+}
+
+// Returns the fused instruction for the instructions at the start, or NULL if
+// they don't start with anything that can be fused
+static Fused *match_fused(Instruction *instrs, uint32_t length) {
+  Fused fused = {.type = FUSED_CONSTANT, .num_instructions = 0};
+  uint32_t next = skip_blanks(instrs, length, 1);
+  bool has_next = next < length;
+
+  if (instrs[0].op == OP_LITERAL) {
+    Item value;
+    uint32_t used;
+    bool folded = fold_constant(instrs, length, &value, &used);
+    uint32_t pop_pos = skip_blanks(instrs, length, used);
+
+    if (pop_pos < length && is_token(&instrs[pop_pos], ';')) {
+      free_item(&value);
+      fused.type = FUSED_NOTHING;
+      fused.num_instructions = pop_pos + 1;
+    }
+    else if (folded) {
+      if (value.type == TYPE_STRING) {
+        string_share(value.str_val);
+      }
+      fused.constant = value;
+      fused.num_instructions = used;
+    }
+    else {
+      free_item(&value);
+      if (has_next && is_integer_literal(&instrs[0], 1) &&
+          is_token(&instrs[next], '$'))
+      {
+        fused.type = FUSED_OVER;
+      }
+      else if (has_next && is_integer_literal(&instrs[0], 0) &&
+               is_token(&instrs[next], '='))
+      {
+        fused.type = FUSED_FIRST;
+      }
+      else {
+        return NULL;
+      }
+      fused.num_instructions = next + 1;
+    }
+  }
+  else if (has_next && is_token(&instrs[0], '\\') &&
+           is_token(&instrs[next], ';'))
+  {
+    fused.type = FUSED_SWAP_POP;
+    fused.num_instructions = next + 1;
+  }
+  else if (has_next && is_token(&instrs[0], '.') &&
+           is_token(&instrs[next], '+'))
+  {
+    fused.type = FUSED_DOUBLE;
+    fused.num_instructions = next + 1;
+  }
+  else if (is_token(&instrs[0], ')') || is_token(&instrs[0], '(')) {
+    fused.type = instrs[0].token.str_data[0] == ')' ? FUSED_INCREMENT
+                                                    : FUSED_DECREMENT;
+    fused.num_instructions = 1;
+  }
+  else {
+    return NULL;
+  }
+  fused.num_steps = count_non_blank(instrs, fused.num_instructions);
+
+  Fused *found = malloc(sizeof(Fused));
+  if (found == NULL) {
+    error("Unable to allocate space for fused instruction!");
+  }
+  *found = fused;
+  return found;
+}
+
+// Puts an OP_FUSED instruction in front of every sequence in the code that
+// can be done in one step. As with pipelines, the instructions it covers are
+// kept, to be run as they are whenever a builtin they use has been redefined
+void fuse_instructions(Code *code) {
+  Instruction *fused_instrs = NULL;
+  uint32_t fused_length = 0;
+
+  for (uint32_t i = 0; i < code->length; i++) {
+    Instruction *instr = &code->instructions[i];
+
+    // Pipelines are left as they are, along with the instructions they
+    // cover, and the instruction after a : could be what's being assigned to
+    uint32_t to_copy = 1;
+    Fused *fused = NULL;
+    if (instr->op == OP_PIPELINE) {
+      to_copy += instr->pipeline->num_instructions;
+    }
+    else if (i == 0 || code->instructions[i - 1].op != OP_ASSIGN) {
+      fused = match_fused(instr, code->length - i);
+    }
+
+    if (fused != NULL && fused_instrs == NULL) {
+      // Every fused instruction covers at least one other, so there can't
+      // be more than twice as many instructions
+      fused_instrs = malloc(sizeof(Instruction) * code->length * 2);
+      if (fused_instrs == NULL) {
+        error("Unable to allocate space for compiled code!");
+      }
+      for (uint32_t j = 0; j < i; j++) {
+        fused_instrs[fused_length++] = code->instructions[j];
+      }
+    }
+
+    if (fused != NULL) {
+      Instruction fused_instr = {
+        .op = OP_FUSED, .token = new_string(), .fused = fused,
+        .block = NULL, .definition = NULL, .definitions_version = 0
+      };
+      fused_instrs[fused_length++] = fused_instr;
+      to_copy = fused->num_instructions;
+    }
+    if (fused_instrs != NULL) {
+      for (uint32_t j = 0; j < to_copy; j++) {
+        fused_instrs[fused_length++] = code->instructions[i + j];
+      }
+    }
+    i += to_copy - 1;
+  }
+
+  if (fused_instrs != NULL) {
+    free(code->instructions);
+    code->instructions = fused_instrs;
+    code->length = fused_length;
+    code->allocated = code->length;
+  }
+}
+
+void free_fused(Fused *fused) {
+  if (fused->type == FUSED_CONSTANT) {
+    free_item(&fused->constant);
+  }
+  free(fused);
+}
+
+// Returns whether every builtin the instructions use is still defined as
+// itself, and nothing else they cover has been defined
+static bool fused_applies(const Fused *fused, Instruction *instrs) {
+  for (uint32_t i = 0; i < fused->num_instructions; i++) {
+    Item *defined_item = instruction_definition(&instrs[i]);
+    void (*builtin)(void) = token_builtin(&instrs[i]);
+    if (builtin != NULL) {
+      if (defined_item == NULL || defined_item->type != TYPE_FUNCTION ||
+          defined_item->function != builtin)
+      {
+        return false;
+      }
+    }
+    else if (defined_item != NULL) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Does what a fused instruction's instructions would do, returning false
+// without changing anything if it can't, so that they can be run instead.
+// Items are popped and pushed as the builtins would, so that brackets move
+// the same way
+bool run_fused(const Fused *fused, Instruction *instrs) {
+  if (!fused_applies(fused, instrs)) {
+    return false;
+  }
+  const Item *top = stack.length > 0 ? &stack.items[stack.length - 1] : NULL;
+
+  switch (fused->type) {
+    case FUSED_CONSTANT:
+      stack_push(make_copy(&fused->constant));
+      return true;
+
+    case FUSED_NOTHING:
+      return true;
+
+    case FUSED_SWAP_POP: {
+      if (stack.length < 2) {
+        return false;
+      }
+      Item top = stack_pop_lazy();
+      Item under = stack_pop_lazy();
+      free_item(&under);
+      stack_push(top);
+      return true;
+    }
+
+    case FUSED_OVER:
+      if (stack.length < 2) {
+        return false;
+      }
+      stack_push(make_copy(&stack.items[stack.length - 2]));
+      return true;
+
+    case FUSED_DOUBLE: {
+      if (top == NULL || top->type != TYPE_INTEGER) {
+        return false;
+      }
+      Item item = stack_pop_lazy();
+      Bigint copy = copy_bigint(&item.int_val);
+      bigint_add(&item.int_val, &copy);
+      free_bigint(&copy);
+      stack_push(item);
+      return true;
+    }
+
+    case FUSED_INCREMENT:
+    case FUSED_DECREMENT: {
+      if (top == NULL || top->type != TYPE_INTEGER) {
+        return false;
+      }
+      Item item = stack_pop_lazy();
+      if (fused->type == FUSED_INCREMENT)
+        bigint_increment(&item.int_val);
+      else
+        bigint_decrement(&item.int_val);
+      stack_push(item);
+      return true;
+    }
+
+    case FUSED_FIRST: {
+      if (top == NULL ||
+          (top->type != TYPE_INTEGER && top->type != TYPE_ARRAY))
+      {
+        return false;
+      }
+      Item item = stack_pop_lazy();
+      if (item.type == TYPE_INTEGER) {
+        stack_push(make_integer(bigint_is_zero(&item.int_val)));
+      }
+      else if (item.arr_val->length > 0) {
+        stack_push(make_copy(&item.arr_val->items[0]));
+      }
+      free_item(&item);
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,429 @@
+// pipeline.c
+// Contains functions for finding chains of map, filter and fold stages in
+// compiled code, and for running them as a single loop over the elements
+
+#include <ctype.h>
+#include <stdlib.h>
+#include "golf.h"
+
+// Returns whether an instruction is a block literal that a stage can use
+static bool is_block_literal(const Instruction *instr) {
+  return instr->op == OP_LITERAL && instr->literal.type == TYPE_BLOCK;
+}
+
+// Whitespace and comments can sit between the stages of a pipeline, as
+// they do nothing unless they've been defined
+static bool is_blank(const Instruction *instr) {
+  return instr->op == OP_TOKEN && (isspace(instr->token.str_data[0]) ||
+                                   instr->token.str_data[0] == '#');
+}
+
+// Returns the index of the first instruction from start that isn't blank
+uint32_t skip_blanks(const Instruction *instrs, uint32_t length,
+                     uint32_t start)
+{
+  while (start < length && is_blank(&instrs[start])) {
+    start++;
+  }
+  return start;
+}
+
+// Returns how many of the instructions aren't blank, which is how many steps
+// running them one at a time counts toward --max-steps
+uint32_t count_non_blank(const Instruction *instrs, uint32_t length) {
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < length; i++) {
+    count += !is_blank(&instrs[i]);
+  }
+  return count;
+}
+
+// Gets the kind of stage an instruction applies its block with, returning
+// false if it isn't one of %, , or *
+static bool get_stage_type(const Instruction *instr, enum StageType *type) {
+  if (!is_token_op(instr->op) || instr->token.length != 1) {
+    return false;
+  }
+  switch (instr->token.str_data[0]) {
+    case '%': *type = STAGE_MAP;    return true;
+    case ',': *type = STAGE_FILTER; return true;
+    case '*': *type = STAGE_FOLD;   return true;
+    default:  return false;
+  }
+}
+
+// The builtin each kind of stage stands in for
+static void (*stage_builtin(enum StageType type))(void) {
+  switch (type) {
+    case STAGE_MAP:    return builtin_percent;
+    case STAGE_FILTER: return builtin_comma;
+    default:           return builtin_asterisk;
+  }
+}
+
+// Returns the pipeline starting at the given instruction, or NULL if there
+// aren't at least two stages there
+static Pipeline *match_pipeline(Instruction *instrs, uint32_t length) {
+  Pipeline pipeline = {NULL, 0, 0, 0};
+  uint32_t pos = 0;
+
+  while (pos < length && is_block_literal(&instrs[pos])) {
+    uint32_t op_pos = skip_blanks(instrs, length, pos + 1);
+    enum StageType type;
+    if (op_pos >= length || !get_stage_type(&instrs[op_pos], &type)) {
+      break;
+    }
+
+    pipeline.stages = realloc(pipeline.stages,
+                              sizeof(Stage) * (pipeline.num_stages + 1));
+    if (pipeline.stages == NULL) {
+      error("Unable to allocate space for pipeline!");
+    }
+    pipeline.stages[pipeline.num_stages].type = type;
+    pipeline.stages[pipeline.num_stages].block = instrs[pos].block;
+    pipeline.num_stages++;
+    pipeline.num_instructions = op_pos + 1;
+
+    if (type == STAGE_FOLD) {
+      break;
+    }
+    pos = skip_blanks(instrs, length, op_pos + 1);
+  }
+
+  if (pipeline.num_stages < 2) {
+    free(pipeline.stages);
+    return NULL;
+  }
+  pipeline.num_steps = count_non_blank(instrs, pipeline.num_instructions);
+
+  Pipeline *found = malloc(sizeof(Pipeline));
+  if (found == NULL) {
+    error("Unable to allocate space for pipeline!");
+  }
+  *found = pipeline;
+  return found;
+}
+
+// Puts an OP_PIPELINE instruction in front of every pipeline in the code.
+// The instructions it covers are kept, to be run as they are whenever the
+// pipeline can't be
+void fuse_pipelines(Code *code) {
+  Code fused = *code;
+  fused.instructions = NULL;
+  fused.length = fused.allocated = 0;
+  bool found_pipeline = false;
+
+  for (uint32_t i = 0; i < code->length; i++) {
+    // The instruction after a : could be what's being assigned to
+    Pipeline *pipeline = NULL;
+    if (i == 0 || code->instructions[i - 1].op != OP_ASSIGN) {
+      pipeline = match_pipeline(&code->instructions[i], code->length - i);
+    }
+
+    if (pipeline != NULL) {
+      if (!found_pipeline) {
+        fused.allocated = code->length + 1;
+        fused.instructions = malloc(sizeof(Instruction) * fused.allocated);
+        if (fused.instructions == NULL) {
+          error("Unable to allocate space for compiled code!");
+        }
+        for (uint32_t j = 0; j < i; j++) {
+          fused.instructions[fused.length++] = code->instructions[j];
+        }
+        found_pipeline = true;
+      }
+      else if (fused.length + pipeline->num_instructions + 1 >
+               fused.allocated)
+      {
+        fused.allocated *= 2;
+        fused.instructions = realloc(fused.instructions,
+                                     sizeof(Instruction) * fused.allocated);
+        if (fused.instructions == NULL) {
+          error("Unable to allocate space for compiled code!");
+        }
+      }
+
+      Instruction instr = {
+        .op = OP_PIPELINE, .token = new_string(), .pipeline = pipeline,
+        .block = NULL, .definition = NULL, .definitions_version = 0
+      };
+      fused.instructions[fused.length++] = instr;
+      for (uint32_t j = 0; j < pipeline->num_instructions; j++) {
+        fused.instructions[fused.length++] = code->instructions[i + j];
+      }
+      i += pipeline->num_instructions - 1;
+    }
+    else if (found_pipeline) {
+      if (fused.length == fused.allocated) {
+        fused.allocated *= 2;
+        fused.instructions = realloc(fused.instructions,
+                                     sizeof(Instruction) * fused.allocated);
+        if (fused.instructions == NULL) {
+          error("Unable to allocate space for compiled code!");
+        }
+      }
+      fused.instructions[fused.length++] = code->instructions[i];
+    }
+  }
+
+  if (found_pipeline) {
+    free(code->instructions);
+    *code = fused;
+  }
+}
+
+void free_pipeline(Pipeline *pipeline) {
+  free(pipeline->stages);
+  free(pipeline);
+}
+
+// The results of a map stage, waiting to be passed on to the next stage
+typedef struct StageResults {
+  Array items;
+  uint32_t passed_on;
+} StageResults;
+
+// Everything a pipeline owns while it's running, so that it can all be
+// freed if the pipeline has to give up part way through
+typedef struct PipelineRun {
+  const Pipeline *pipeline;
+  StageResults *results;  // One per stage
+  Array held;             // Elements waiting on a filter's decision
+  Item accumulator;       // The value a fold has built up so far
+  bool has_accumulator;
+  Array output;           // Elements that made it through every stage
+  bool owns_region;       // Whether the region's cleared after each element
+} PipelineRun;
+
+// Checks the block of a stage did nothing the pipeline can't reproduce,
+// which includes leaving anything but one result if it had to
+static void check_stage(bool one_result) {
+  if ((one_result && stack.length != 1) || bracket_stack.length != 0) {
+    error("Block left the sandbox!");
+  }
+}
+
+// Moves an item that has to outlive the element it came from out of the
+// region, if that's going to be cleared
+static Item keep_item(const PipelineRun *run, Item item) {
+  return run->owns_region ? region_evacuate(item) : item;
+}
+
+// Passes an element through the pipeline from the given stage onwards
+static void feed_stage(PipelineRun *run, uint32_t stage_num, Item item) {
+  if (stage_num == run->pipeline->num_stages) {
+    array_push(&run->output, keep_item(run, item));
+    return;
+  }
+
+  const Stage *stage = &run->pipeline->stages[stage_num];
+  if (stage->type == STAGE_MAP) {
+    stack_push(item);
+    execute_code(stage->block);
+    check_stage(false);
+
+    // The results are swapped off the stack, so that the next stage starts
+    // with an empty one
+    StageResults *results = &run->results[stage_num];
+    Array mapped_items = stack;
+    stack = results->items;
+    results->items = mapped_items;
+    for (results->passed_on = 0; results->passed_on < mapped_items.length;) {
+      Item mapped_item = results->items.items[results->passed_on++];
+      item_expand(&mapped_item);
+      feed_stage(run, stage_num + 1, mapped_item);
+    }
+    results->items.length = 0;
+  }
+  else if (stage->type == STAGE_FILTER) {
+    array_push(&run->held, item);
+    stack_push(make_copy(&item));
+    execute_code(stage->block);
+    check_stage(true);
+
+    Item mapped_item = stack_pop();
+    bool keep = item_boolean(&mapped_item);
+    free_item(&mapped_item);
+    item = run->held.items[--run->held.length];
+    if (keep)
+      feed_stage(run, stage_num + 1, item);
+    else
+      free_item(&item);
+  }
+  else if (!run->has_accumulator) {
+    run->accumulator = keep_item(run, item);
+    run->has_accumulator = true;
+  }
+  else {
+    // The accumulator outlives every element, so it's built on the heap
+    item = keep_item(run, item);
+    bool was_allocating = region_pause();
+    if (!native_fold_step(stage->block, &run->accumulator, &item)) {
+      run->has_accumulator = false;
+      stack_push(run->accumulator);
+      stack_push(item);
+      execute_code(stage->block);
+      check_stage(true);
+      run->accumulator = stack_pop_lazy();
+      run->has_accumulator = true;
+    }
+    region_resume(was_allocating);
+  }
+}
+
+// Passes an element through the whole pipeline, after which nothing made
+// for it is left in the region
+static void feed_element(PipelineRun *run, Item item) {
+  feed_stage(run, 0, item);
+  if (run->owns_region) {
+    region_clear();
+  }
+}
+
+static void feed_elements(PipelineRun *run, const Item *input) {
+  if (input->type == TYPE_RANGE) {
+    const Range *range = &input->range_val;
+    for (uint32_t i = 0; i < range->length; i++) {
+      feed_element(run, make_integer((int64_t) range->start + i));
+    }
+  }
+  else if (input->type == TYPE_PACKED) {
+    const Packed *packed = input->packed_val;
+    for (uint32_t i = 0; i < packed->length; i++) {
+      feed_element(run, make_integer(packed_get(packed, i)));
+    }
+  }
+  else {
+    for (uint32_t i = 0; i < input->arr_val->length; i++) {
+      feed_element(run, make_copy(&input->arr_val->items[i]));
+    }
+  }
+}
+
+static void free_pipeline_run(PipelineRun *run) {
+  for (uint32_t i = 0; i < run->pipeline->num_stages; i++) {
+    StageResults *results = &run->results[i];
+    for (uint32_t j = results->passed_on; j < results->items.length; j++) {
+      free_item(&results->items.items[j]);
+    }
+    free_array_buffer(&results->items);
+  }
+  free(run->results);
+  free_array(&run->held);
+  if (run->has_accumulator) {
+    free_item(&run->accumulator);
+  }
+  free_array(&run->output);
+}
+
+// Returns whether the pipeline's instructions would do what it does if they
+// were run now
+static bool pipeline_applies(const Pipeline *pipeline, Instruction *instrs) {
+  for (uint32_t i = 0; i < pipeline->num_instructions; i++) {
+    Item *defined_item = instruction_definition(&instrs[i]);
+    enum StageType type;
+    if (get_stage_type(&instrs[i], &type)) {
+      if (defined_item == NULL || defined_item->type != TYPE_FUNCTION ||
+          defined_item->function != stage_builtin(type))
+      {
+        return false;
+      }
+    }
+    else if (defined_item != NULL) {
+      return false;
+    }
+  }
+
+  if (stack.length == 0) {
+    return false;
+  }
+  enum Type input_type = stack.items[stack.length - 1].type;
+  return input_type == TYPE_ARRAY || input_type == TYPE_RANGE ||
+         input_type == TYPE_PACKED;
+}
+
+// Runs a pipeline over the array on top of the stack, one element at a time.
+// The blocks run in a sandbox on a stack of their own, and if anything
+// happens that running the stages one after the other would do differently,
+// it gives up and returns false so the instructions can be run instead.
+// Unless it's inside another sandbox, what's made for each element comes
+// from the region, and anything that outlives the element is copied out
+bool run_pipeline(const Pipeline *pipeline, Instruction *instrs) {
+  if (!pipeline_applies(pipeline, instrs)) {
+    return false;
+  }
+
+  PipelineRun run = {
+    .pipeline = pipeline,
+    .results = malloc(sizeof(StageResults) * pipeline->num_stages),
+    .held = new_array(),
+    .has_accumulator = false,
+    .output = new_array()
+  };
+  if (run.results == NULL) {
+    error("Unable to allocate space for pipeline!");
+  }
+  for (uint32_t i = 0; i < pipeline->num_stages; i++) {
+    run.results[i].items = new_array();
+    run.results[i].passed_on = 0;
+  }
+
+  Array outer_stack = stack;
+  Array outer_bracket_stack = bracket_stack;
+  jmp_buf *outer_escape = sandbox_escape;
+  jmp_buf escape;
+  bool succeeded;
+
+  // The steps taken by work that's given up on are taken back, as the
+  // instructions that redo it count them again
+  uint64_t steps_before = steps_so_far();
+
+  // Everything that lasts the whole run is allocated before the region's
+  // started, and freed before it's stopped
+  stack = new_array();
+  bracket_stack = new_array();
+  bool was_allocating = region_in_use();
+  run.owns_region = region_start();
+  if (setjmp(escape) == 0) {
+    sandbox_escape = &escape;
+    feed_elements(&run, &outer_stack.items[outer_stack.length - 1]);
+    succeeded = true;
+  }
+  else {
+    succeeded = false;
+    rewind_steps(steps_before);
+  }
+  sandbox_escape = outer_escape;
+  free_array(&stack);
+  free_array(&bracket_stack);
+  stack = outer_stack;
+  bracket_stack = outer_bracket_stack;
+  if (!succeeded) {
+    free_pipeline_run(&run);
+  }
+  if (run.owns_region) {
+    region_stop();
+  }
+  else {
+    region_resume(was_allocating);
+  }
+
+  if (succeeded) {
+    Item input = stack_pop_lazy();
+    free_item(&input);
+    if (pipeline->stages[pipeline->num_stages - 1].type == STAGE_FOLD) {
+      if (run.has_accumulator) {
+        stack_push(run.accumulator);
+        run.has_accumulator = false;
+      }
+    }
+    else {
+      Item output = make_array_from(run.output);
+      item_pack(&output);
+      stack_push(output);
+      run.output = new_array();
+    }
+    free_pipeline_run(&run);
+  }
+  return succeeded;
+}
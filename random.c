@@ -1,6 +1,7 @@
 // random.c
 // Contains functions for generating random numbers
 
+#include <stdlib.h>
 #include <time.h>
 #include "golf.h"
 
@@ -32,24 +33,28 @@ uint64_t get_random() {
 // Returns a number in the range of [0, max_val)
 // Returns 0 if max_val is negative
 Bigint get_randint(Bigint max_val) {
-  if (bigint_is_zero(&max_val) || max_val.is_negative) {
+  if (bigint_is_zero(&max_val) || bigint_is_negative(&max_val)) {
     return new_bigint();
   }
   else {
-    Bigint rand_num = bigint_with_digits(max_val.length);
-    for (uint32_t i = 0; i < max_val.length; i++) {
-      if (i + 1 < max_val.length) {
-        rand_num.digits[i] = get_random();
+    uint32_t length = bigint_length(&max_val);
+    uint64_t *digits = malloc(sizeof(uint64_t) * length);
+    for (uint32_t i = 0; i < length; i++) {
+      if (i + 1 < length) {
+        digits[i] = get_random();
       }
       else {
         uint64_t result = get_random();
+        uint64_t max_digit = bigint_digit(&max_val, i);
         // Prevent modulo bias
-        while (result > (UINT64_MAX - (UINT64_MAX % max_val.digits[i]))) {
+        while (result > (UINT64_MAX - (UINT64_MAX % max_digit))) {
             result = get_random();
         }
-        rand_num.digits[i] = result % max_val.digits[i];
+        digits[i] = result % max_digit;
       }
     }
+    Bigint rand_num = bigint_from_digits(digits, length, false);
+    free(digits);
     return rand_num;
   }
 }
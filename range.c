@@ -0,0 +1,134 @@
+// range.c
+// Contains functions for lazy integer ranges, which stand in for the arrays
+// created by using , on an integer until something needs the actual array
+
+#include <stdlib.h>
+#include "golf.h"
+
+Item make_range(uint32_t start, uint32_t length) {
+  Item item = {TYPE_RANGE, .range_val = {start, length}};
+  return item;
+}
+
+// Creates the array of integers a range stands in for
+Array range_to_array(const Range *range) {
+  Array array = new_array();
+  array_reserve(&array, range->length);
+  for (uint32_t i = 0; i < range->length; i++) {
+    array.items[i] = make_integer((int64_t) range->start + i);
+  }
+  array.length = range->length;
+  return array;
+}
+
+// Returns the index of an item in a range, or -1 if it isn't in it
+int64_t range_find(const Range *range, const Item *item) {
+  if (item->type != TYPE_INTEGER || bigint_is_negative(&item->int_val) ||
+      !bigint_fits_in_uint32(&item->int_val))
+  {
+    return -1;
+  }
+  uint32_t val = bigint_to_uint32(&item->int_val);
+  if (val < range->start || val - range->start >= range->length) {
+    return -1;
+  }
+  return val - range->start;
+}
+
+// Keeps only the first new_len elements of a range
+void range_truncate(Range *range, uint32_t new_len) {
+  range->length = min(range->length, new_len);
+}
+
+// Removes a number of elements from the range's front
+void range_remove_from_front(Range *range, Bigint to_remove) {
+  if (bigint_is_negative(&to_remove) || bigint_is_zero(&to_remove))
+    return;
+
+  uint32_t to_remove_int;
+  if (!bigint_fits_in_uint32(&to_remove))
+    to_remove_int = range->length;
+  else
+    to_remove_int = min(bigint_to_uint32(&to_remove), range->length);
+
+  range->start += to_remove_int;
+  range->length -= to_remove_int;
+}
+
+// Returns the array made by running a block over each element of a range
+Array map_range(const Range *range, Item *block) {
+  Array mapped_array = new_array();
+  Code *code = get_code(block->str_val);
+  for (uint32_t i = 0; i < range->length; i++) {
+    uint32_t start_stack_size = stack.length;
+    stack_push(make_integer((int64_t) range->start + i));
+    execute_code(code);
+    for (uint32_t j = start_stack_size; j < stack.length; j++) {
+      item_expand(&stack.items[j]);
+      array_push(&mapped_array, stack.items[j]);
+    }
+    stack.length = min(stack.length, start_stack_size);
+  }
+  release_code(code);
+  return mapped_array;
+}
+
+void fold_range(const Range *range, Item *block) {
+  if (native_fold_range(range, block)) {
+    return;
+  }
+  if (range->length > 0) {
+    stack_push(make_integer(range->start));
+    Code *code = get_code(block->str_val);
+    for (uint32_t i = 1; i < range->length; i++) {
+      stack_push(make_integer((int64_t) range->start + i));
+      execute_code(code);
+    }
+    release_code(code);
+  }
+}
+
+// Returns the array of the elements of a range a block is true for
+Array filter_range(const Range *range, Item *block) {
+  Array filtered_array;
+  if (parallel_filter_range(range, block, &filtered_array)) {
+    return filtered_array;
+  }
+
+  filtered_array = new_array();
+  Code *code = get_code(block->str_val);
+  for (uint32_t i = 0; i < range->length; i++) {
+    stack_push(make_integer((int64_t) range->start + i));
+    execute_code(code);
+    Item mapped_item = stack_pop();
+    if (item_boolean(&mapped_item)) {
+      array_push(&filtered_array, make_integer((int64_t) range->start + i));
+    }
+    free_item(&mapped_item);
+  }
+  release_code(code);
+  return filtered_array;
+}
+
+// Returns the index of the first element of a range a block is true for,
+// or -1 if there isn't one
+int64_t find_in_range(const Range *range, Item *block) {
+  int64_t index;
+  if (parallel_find_range(range, block, &index)) {
+    return index;
+  }
+
+  index = -1;
+  Code *code = get_code(block->str_val);
+  for (uint32_t i = 0; i < range->length && index < 0; i++) {
+    stack_push(make_integer((int64_t) range->start + i));
+    execute_code(code);
+    Item item_bool = stack_pop();
+    if (item_boolean(&item_bool)) {
+      index = i;
+    }
+    free_item(&item_bool);
+  }
+  release_code(code);
+  return index;
+}
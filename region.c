@@ -0,0 +1,186 @@
+// region.c
+// Contains the region, which the contents of items are allocated from while
+// a sandbox works through the elements of a loop. Nothing made for one
+// element can outlive it without being copied out, so everything it
+// allocated is thrown away at once instead of being freed piece by piece
+
+// For MAP_ANONYMOUS and MAP_NORESERVE
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "golf.h"
+
+// How much address space each thread's region takes up. Pages are only
+// used once something's put in them
+#define REGION_SIZE ((size_t) 1 << 26)
+
+// How much of a region stays in use once it's stopped being used, with any
+// more than that handed back
+#define REGION_KEEP ((size_t) 1 << 24)
+
+// Allocations are kept aligned to this, and each is preceded by its size
+#define REGION_ALIGN sizeof(size_t)
+
+static _Thread_local char *region_base;
+static _Thread_local size_t region_used;
+static _Thread_local size_t region_peak;  // The most of it that's been used
+static _Thread_local bool region_active;  // Whether it has anything in it
+static _Thread_local bool region_allocating;
+
+static inline size_t round_up(size_t size) {
+  return (size + REGION_ALIGN - 1) & ~(REGION_ALIGN - 1);
+}
+
+// Returns whether something was allocated from this thread's region
+bool in_region(const void *ptr) {
+  return region_base != NULL &&
+         (size_t) ((const char *) ptr - region_base) < REGION_SIZE;
+}
+
+// Returns whether the contents of items are being allocated from the region
+bool region_in_use() {
+  return region_allocating;
+}
+
+static inline size_t allocation_size(const void *ptr) {
+  return ((const size_t *) ptr)[-1];
+}
+
+// Returns whether an allocation is the last one made from the region, which
+// can grow or shrink where it is
+static inline bool is_last(const void *ptr) {
+  return (const char *) ptr + round_up(allocation_size(ptr)) ==
+         region_base + region_used;
+}
+
+static void *region_bump(size_t size) {
+  size_t needed = sizeof(size_t) + round_up(size);
+  if (needed > REGION_SIZE - region_used) {
+    // Anything that doesn't fit is allocated from the heap, and freed from
+    // there like anything else
+    return malloc(size);
+  }
+  size_t *header = (size_t *) (region_base + region_used);
+  region_used += needed;
+  *header = size;
+  return header + 1;
+}
+
+// Allocates from the region while it's being used, and from the heap
+// otherwise
+void *region_malloc(size_t size) {
+  return region_allocating ? region_bump(size) : malloc(size);
+}
+
+// Reallocates something where it was allocated, so that something from the
+// region stays in it
+void *region_realloc(void *ptr, size_t size) {
+  if (ptr == NULL || !in_region(ptr)) {
+    return realloc(ptr, size);
+  }
+  size_t old_size = allocation_size(ptr);
+  if (is_last(ptr) &&
+      round_up(size) - round_up(old_size) <= REGION_SIZE - region_used)
+  {
+    region_used += round_up(size) - round_up(old_size);
+    ((size_t *) ptr)[-1] = size;
+    return ptr;
+  }
+  if (size <= old_size) {
+    return ptr;
+  }
+  void *new_ptr = region_bump(size);
+  if (new_ptr != NULL) {
+    memcpy(new_ptr, ptr, old_size);
+  }
+  return new_ptr;
+}
+
+// Frees something from the heap. Something from the region is only thrown
+// away along with the rest of it, unless it's the last thing in it
+void region_free(void *ptr) {
+  if (ptr == NULL || !in_region(ptr)) {
+    free(ptr);
+  }
+  else if (is_last(ptr)) {
+    region_used = (char *) ptr - region_base - sizeof(size_t);
+  }
+}
+
+// Starts allocating the contents of items from this thread's region.
+// Returns false if it's already being used, by a sandbox further out that
+// everything will be thrown away with, or if it can't be set up
+bool region_start() {
+  if (region_active) {
+    return false;
+  }
+  if (region_base == NULL) {
+    void *base = mmap(NULL, REGION_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+      return false;
+    }
+    region_base = base;
+  }
+  region_active = true;
+  region_allocating = true;
+  return true;
+}
+
+// Throws away everything that's been allocated from the region, which
+// nothing can still be using
+void region_clear() {
+  region_peak = max(region_peak, region_used);
+  region_used = 0;
+}
+
+// Clears the region and stops allocating from it, handing back most of any
+// space a big element needed
+void region_stop() {
+  region_clear();
+  region_active = false;
+  region_allocating = false;
+  if (region_peak > REGION_KEEP) {
+    madvise(region_base + REGION_KEEP, region_peak - REGION_KEEP,
+            MADV_DONTNEED);
+    region_peak = REGION_KEEP;
+  }
+}
+
+// Allocates from the heap for now, for something that has to outlive the
+// element it's made for. Returns what to pass to region_resume afterwards
+bool region_pause() {
+  bool was_allocating = region_allocating;
+  region_allocating = false;
+  return was_allocating;
+}
+
+void region_resume(bool was_allocating) {
+  region_allocating = was_allocating && region_active;
+}
+
+// Gives back a thread's region once the thread's done with it
+void free_region() {
+  if (region_base != NULL) {
+    munmap(region_base, REGION_SIZE);
+    region_base = NULL;
+  }
+  region_active = false;
+  region_allocating = false;
+  region_used = region_peak = 0;
+}
+
+// Copies an item from the region onto the heap, so that it can outlive the
+// element it was made for
+Item region_evacuate(Item item) {
+  if (!region_active) {
+    return item;
+  }
+  bool was_allocating = region_pause();
+  Item copy = make_copy(&item);
+  region_resume(was_allocating);
+  free_item(&item);
+  return copy;
+}
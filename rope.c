@@ -0,0 +1,176 @@
+// rope.c
+// Contains functions for ropes, which stand in for long strings built up by
+// joining strings together, so that joining doesn't copy what's been built
+
+#include <stdlib.h>
+#include <string.h>
+#include "golf.h"
+
+#define ROPE_INIT_SIZE 8
+
+// Strings joined into anything shorter than this are just concatenated
+#define ROPE_MIN_LENGTH 1024
+
+// Pieces shorter than this are merged into the chunk next to them rather
+// than becoming chunks of their own, so that ropes don't fill up with tiny
+// chunks
+#define ROPE_MIN_CHUNK 256
+
+static Rope new_rope() {
+  Rope rope = {
+    .chunks = region_malloc(sizeof(String) * ROPE_INIT_SIZE), .num_chunks = 0,
+    .allocated = ROPE_INIT_SIZE, .start = ROPE_INIT_SIZE / 2, .length = 0
+  };
+  if (rope.chunks == NULL) {
+    error("Unable to allocate space for rope!");
+  }
+  rope.chunks += rope.start;
+  return rope;
+}
+
+void free_rope(Rope *rope) {
+  for (uint32_t i = 0; i < rope->num_chunks; i++) {
+    free_string(&rope->chunks[i]);
+  }
+  region_free(rope->chunks - rope->start);
+}
+
+Rope copy_rope(const Rope *rope) {
+  Rope new_rope = *rope;
+  new_rope.chunks = region_malloc(sizeof(String) * rope->allocated);
+  if (new_rope.chunks == NULL) {
+    error("Unable to allocate space for rope!");
+  }
+  new_rope.chunks += rope->start;
+  for (uint32_t i = 0; i < rope->num_chunks; i++) {
+    new_rope.chunks[i] = copy_string(&rope->chunks[i]);
+  }
+  return new_rope;
+}
+
+// Moves the chunks into a new allocation twice the size, with as much free
+// space in front of them as behind, so either end can grow again
+static void rope_grow(Rope *rope) {
+  uint32_t allocated = rope->allocated * 2;
+  uint32_t start = (allocated - rope->num_chunks) / 2;
+  String *chunks = region_malloc(sizeof(String) * allocated);
+  if (chunks == NULL) {
+    error("Unable to allocate additional space for rope!");
+  }
+  memcpy(chunks + start, rope->chunks, sizeof(String) * rope->num_chunks);
+  region_free(rope->chunks - rope->start);
+  rope->chunks = chunks + start;
+  rope->allocated = allocated;
+  rope->start = start;
+}
+
+// Adds a string to the end of a rope, taking ownership of it
+static void rope_append(Rope *rope, String str) {
+  rope->length += str.length;
+  if (rope->num_chunks > 0) {
+    String *last = &rope->chunks[rope->num_chunks - 1];
+    if (str.length < ROPE_MIN_CHUNK || last->length < ROPE_MIN_CHUNK) {
+      string_add_str(last, &str);
+      free_string(&str);
+      return;
+    }
+  }
+  if (rope->start + rope->num_chunks == rope->allocated) {
+    rope_grow(rope);
+  }
+  rope->chunks[rope->num_chunks++] = str;
+}
+
+// Adds a string to the start of a rope, taking ownership of it
+static void rope_prepend(Rope *rope, String str) {
+  rope->length += str.length;
+  if (rope->num_chunks > 0) {
+    String *first = &rope->chunks[0];
+    if (str.length < ROPE_MIN_CHUNK && first->length < ROPE_MIN_CHUNK) {
+      string_add_str(&str, first);
+      free_string(first);
+      *first = str;
+      return;
+    }
+  }
+  if (rope->start == 0) {
+    rope_grow(rope);
+  }
+  rope->chunks--;
+  rope->start--;
+  rope->num_chunks++;
+  rope->chunks[0] = str;
+}
+
+// Returns the length of a string or rope item
+static uint64_t text_length(const Item *item) {
+  return item->type == TYPE_ROPE ? item->rope_val->length
+                                 : item->str_val->length;
+}
+
+// Joins two items into a rope, if they're both strings or ropes and long
+// enough together to be worth it. The result is left in item1, and item2 is
+// taken ownership of. Returns whether the items were joined
+bool rope_add(Item *item1, Item *item2) {
+  if ((item1->type != TYPE_STRING && item1->type != TYPE_ROPE) ||
+      (item2->type != TYPE_STRING && item2->type != TYPE_ROPE))
+  {
+    return false;
+  }
+  uint64_t total_length = text_length(item1) + text_length(item2);
+  if (total_length < ROPE_MIN_LENGTH && item1->type == TYPE_STRING &&
+      item2->type == TYPE_STRING)
+  {
+    return false;
+  }
+  if (total_length > UINT32_MAX) {
+    error("Unable to allocate space for string!");
+  }
+
+  if (item1->type == TYPE_STRING && item2->type == TYPE_ROPE) {
+    rope_prepend(item2->rope_val, take_string(item1));
+    *item1 = *item2;
+  }
+  else if (item2->type == TYPE_STRING) {
+    if (item1->type == TYPE_STRING) {
+      Rope rope = new_rope();
+      rope_append(&rope, take_string(item1));
+      *item1 = make_rope_from(rope);
+    }
+    rope_append(item1->rope_val, take_string(item2));
+  }
+  else {
+    Rope *other = item2->rope_val;
+    for (uint32_t i = 0; i < other->num_chunks; i++) {
+      rope_append(item1->rope_val, other->chunks[i]);
+    }
+    region_free(other->chunks - other->start);
+    region_free(other);
+  }
+  return true;
+}
+
+// Turns a rope into the string it stands in for, copying each chunk once,
+// and frees the rope
+String rope_flatten(Rope *rope) {
+  if (rope->num_chunks == 1) {
+    String str = rope->chunks[0];
+    region_free(rope->chunks - rope->start);
+    return str;
+  }
+  String str = new_string();
+  string_reserve(&str, rope->length);
+  for (uint32_t i = 0; i < rope->num_chunks; i++) {
+    memcpy(str.str_data + str.length, rope->chunks[i].str_data,
+           rope->chunks[i].length);
+    str.length += rope->chunks[i].length;
+  }
+  free_rope(rope);
+  return str;
+}
+
+void output_rope(const Rope *rope) {
+  for (uint32_t i = 0; i < rope->num_chunks; i++) {
+    output_bytes(rope->chunks[i].str_data, rope->chunks[i].length);
+  }
+}
@@ -4,32 +4,61 @@
 #include <stdlib.h>
 #include "golf.h"
 
+// The number of nodes in a set's first block. Each block after that is
+// twice the size of the one before, up to NODE_BLOCK_MAX_SIZE
+#define NODE_BLOCK_INIT_SIZE 8
+#define NODE_BLOCK_MAX_SIZE 4096
+
+typedef struct NodeBlock {
+  struct NodeBlock *next;
+  uint32_t size;
+  TreeNode nodes[];
+} NodeBlock;
+
 Set new_set() {
-  Set set = {NULL};
+  Set set = {NULL, NULL, 0, NULL};
   return set;
 }
 
-static inline void free_node(TreeNode *node) {
-  free_item(&node->item);
-  free(node);
-}
-
-// Frees a tree node and all of its descendants
-static inline void free_tree(TreeNode *node) {
-  if (node == NULL)
-    return;
-  free_tree(node->left);
-  free_tree(node->right);
-  free_node(node);
+// Keeps a node that's been removed to be reused
+static inline void free_node(Set *set, TreeNode *node) {
+  node->left = set->free_nodes;
+  set->free_nodes = node;
 }
 
 void free_set(Set *set) {
-  free_tree(set->root);
+  NodeBlock *block = set->blocks;
+  while (block != NULL) {
+    NodeBlock *next = block->next;
+    free(block);
+    block = next;
+  }
 }
 
-static inline TreeNode *new_node(const Item *item) {
-  TreeNode *node = malloc(sizeof(TreeNode));
-  node->item = make_copy(item);
+static inline TreeNode *new_node(Set *set, const Item *item) {
+  TreeNode *node;
+  if (set->free_nodes != NULL) {
+    node = set->free_nodes;
+    set->free_nodes = node->left;
+  }
+  else {
+    if (set->blocks == NULL || set->block_used == set->blocks->size) {
+      uint32_t size = NODE_BLOCK_INIT_SIZE;
+      if (set->blocks != NULL) {
+        size = min(set->blocks->size * 2, NODE_BLOCK_MAX_SIZE);
+      }
+      NodeBlock *block = malloc(sizeof(NodeBlock) + sizeof(TreeNode) * size);
+      if (block == NULL) {
+        error("Unable to allocate space for set!");
+      }
+      block->next = set->blocks;
+      block->size = size;
+      set->blocks = block;
+      set->block_used = 0;
+    }
+    node = &set->blocks->nodes[set->block_used++];
+  }
+  node->item = *item;
   node->left = NULL;
   node->right = NULL;
   node->height = 1;
@@ -122,15 +151,17 @@ static inline TreeNode *double_rotate_right(TreeNode *cur_node) {
 
 // Inserts a node in an AVL tree, rotating the tree if necessary, returning
 // the new top of this tree after a rotation
-static TreeNode *insert_node(TreeNode *cur_node, const Item *item) {
+static TreeNode *insert_node(Set *set, TreeNode *cur_node,
+                             const Item *item)
+{
   if (cur_node == NULL) {
-    return new_node(item);
+    return new_node(set, item);
   }
 
   int result = item_compare(item, &cur_node->item);
 
   if (result < 0) {
-    cur_node->left = insert_node(cur_node->left, item);
+    cur_node->left = insert_node(set, cur_node->left, item);
 
     if (get_height(cur_node->left) - get_height(cur_node->right) == 2) {
       if (item_compare(item, &cur_node->left->item) < 0)
@@ -140,7 +171,7 @@ static TreeNode *insert_node(TreeNode *cur_node, const Item *item) {
     }
   }
   else if (result > 0) {
-    cur_node->right = insert_node(cur_node->right, item);
+    cur_node->right = insert_node(set, cur_node->right, item);
 
     if (get_height(cur_node->right) - get_height(cur_node->left) == 2) {
       if (item_compare(item, &cur_node->right->item) > 0)
@@ -161,7 +192,7 @@ static TreeNode *insert_node(TreeNode *cur_node, const Item *item) {
 
 // Adds an item to a set
 void set_add(Set *set, const Item *item) {
-  set->root = insert_node(set->root, item);
+  set->root = insert_node(set, set->root, item);
 }
 
 // Returns the largest value in a given subtree
@@ -174,7 +205,9 @@ static inline TreeNode *get_largest_node(TreeNode *cur_node) {
 
 // Deletes a node from an AVL tree, rotating the tree if it becomes unbalanced
 // and returns the root node of the subtree
-static TreeNode *delete_node(TreeNode *cur_node, const Item *item) {
+static TreeNode *delete_node(Set *set, TreeNode *cur_node,
+                             const Item *item)
+{
   if (cur_node == NULL) {
     return NULL;
   }
@@ -182,7 +215,7 @@ static TreeNode *delete_node(TreeNode *cur_node, const Item *item) {
   int result = item_compare(item, &cur_node->item);
 
   if (result < 0) {
-    cur_node->left = delete_node(cur_node->left, item);
+    cur_node->left = delete_node(set, cur_node->left, item);
     if (get_height(cur_node->right) - get_height(cur_node->left) == 2) {
       TreeNode *left_node = cur_node->left;
       int16_t left_balance = 0;
@@ -199,7 +232,7 @@ static TreeNode *delete_node(TreeNode *cur_node, const Item *item) {
     }
   }
   else if (result > 0) {
-    cur_node->right = delete_node(cur_node->right, item);
+    cur_node->right = delete_node(set, cur_node->right, item);
     if (get_height(cur_node->left) - get_height(cur_node->right) == 2) {
       TreeNode *right_node = cur_node->right;
       int16_t right_balance = 0;
@@ -222,20 +255,20 @@ static TreeNode *delete_node(TreeNode *cur_node, const Item *item) {
       // is smaller than the current node, copy that node to our
       // current node, and delete the node that we copied
       TreeNode *to_replace = get_largest_node(cur_node->left);
-      free_item(&cur_node->item);
-      cur_node->item = make_copy(&to_replace->item);
-      cur_node->left = delete_node(cur_node->left, &to_replace->item);
+      cur_node->item = to_replace->item;
+      cur_node->left = delete_node(set, cur_node->left,
+                                   &to_replace->item);
     }
     else if (cur_node->left != NULL || cur_node->right != NULL) {
       // If the node has one child, we just return that child
       TreeNode *child = cur_node->left ? cur_node->left: cur_node->right;
-      free_node(cur_node);
+      free_node(set, cur_node);
       return child;
     }
     else {
       // No children. Easiest case to handle (and also a pretty great song)
       // We just return NULL for this case
-      free_node(cur_node);
+      free_node(set, cur_node);
       return NULL;
     }
   }
@@ -246,5 +279,5 @@ static TreeNode *delete_node(TreeNode *cur_node, const Item *item) {
 }
 
 void set_remove(Set *set, const Item *item) {
-  set->root = delete_node(set->root, item);
+  set->root = delete_node(set, set->root, item);
 }
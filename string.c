@@ -1,41 +1,169 @@
 // string.c
 // Contains functions for manipulating strings
 
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include "golf.h"
 
 #define STRING_INIT_SIZE 16
 
-String new_string() {
-  String str = {malloc(STRING_INIT_SIZE), 0, STRING_INIT_SIZE};
-  if (str.str_data == NULL) {
-    error("Unable to allocate space for new string!");
-  }
+// Slices shorter than this are moved into place instead of becoming views
+#define VIEW_MIN_LENGTH 64
+
+// A view that's been sliced down to less than this fraction of its buffer is
+// given its own copy, so that a small slice can't keep a huge string alive
+#define VIEW_MIN_FRACTION 4
+
+#define CHARS_16(c) c, c + 1, c + 2, c + 3, c + 4, c + 5, c + 6, c + 7, \
+  c + 8, c + 9, c + 10, c + 11, c + 12, c + 13, c + 14, c + 15
+
+// Every possible single character, so that strings of no more than one
+// character can point here instead of being allocated. Such strings have
+// neither space of their own nor a shared buffer
+static const unsigned char single_chars[256] = {
+  CHARS_16(0), CHARS_16(16), CHARS_16(32), CHARS_16(48), CHARS_16(64),
+  CHARS_16(80), CHARS_16(96), CHARS_16(112), CHARS_16(128), CHARS_16(144),
+  CHARS_16(160), CHARS_16(176), CHARS_16(192), CHARS_16(208), CHARS_16(224),
+  CHARS_16(240)
+};
+
+// Returns a string of at most one character, without allocating anything
+static String small_string(const unsigned char *chars, uint32_t length) {
+  unsigned char c = length == 0 ? 0 : chars[0];
+  String str = {(unsigned char *) &single_chars[c], length, 0, NULL};
   return str;
 }
 
+// Returns whether a string owns the space its characters are in
+static inline bool string_is_owned(const String *str) {
+  return str->allocated > 0;
+}
+
+// Creates an empty string. Space for it is only allocated once something is
+// added to it
+String new_string() {
+  return small_string(NULL, 0);
+}
+
 void free_string(String *str) {
-  free(str->str_data);
+  if (string_is_owned(str)) {
+    region_free(str->str_data);
+  }
+  else if (str->shared != NULL &&
+           atomic_fetch_sub(&str->shared->refs, 1) == 1)
+  {
+    region_free(str->shared->data);
+    region_free(str->shared);
+  }
+}
+
+// Turns a string into a view of its own characters, so that copies and
+// views of it share them. Does nothing to a string that doesn't own any
+void string_share(String *str) {
+  if (!string_is_owned(str)) {
+    return;
+  }
+  // The buffer's kept with the characters, in the region or on the heap
+  bool was_allocating = region_pause();
+  region_resume(in_region(str->str_data));
+  StringBuffer *shared = region_malloc(sizeof(StringBuffer));
+  region_resume(was_allocating);
+  if (shared == NULL) {
+    error("Unable to allocate space for string buffer!");
+  }
+  shared->data = str->str_data;
+  shared->size = str->allocated;
+  atomic_init(&shared->refs, 1);
+  str->shared = shared;
+  str->allocated = 0;
+}
+
+// Returns whether a string's characters are kept apart from where strings
+// are being made, in the region or on the heap. They're copied rather than
+// shared then, so that nothing on the heap is left pointing into the region,
+// and nothing thrown away with the region holds on to a buffer on the heap
+static inline bool string_is_foreign(const String *str) {
+  return in_region(str->str_data) != region_in_use();
+}
+
+// Returns a view of part of a string, which shares the string's characters
+// instead of copying them
+String string_view(String *str, uint32_t start, uint32_t length) {
+  if (length <= 1) {
+    return small_string(str->str_data + start, length);
+  }
+  if (string_is_foreign(str)) {
+    return string_from_chars(str->str_data + start, length);
+  }
+  if (str->shared == NULL) {
+    string_share(str);
+  }
+  atomic_fetch_add(&str->shared->refs, 1);
+  String view = {str->str_data + start, length, 0, str->shared};
+  return view;
+}
+
+// Gives a view or a string of at most one character its own copy of its
+// characters, so that they can be changed. Does nothing to any other string
+void string_unshare(String *str) {
+  if (string_is_owned(str)) {
+    return;
+  }
+  String view = *str;
+  str->allocated = max(view.length, STRING_INIT_SIZE);
+  str->str_data = region_malloc(str->allocated);
+  if (str->str_data == NULL) {
+    error("Unable to allocate space for string!");
+  }
+  memcpy(str->str_data, view.str_data, view.length);
+  str->shared = NULL;
+  free_string(&view);
+}
+
+// Gives a view its own copy once it's only a small part of its buffer
+static void string_check_view(String *str) {
+  if (str->shared != NULL &&
+      str->length < str->shared->size / VIEW_MIN_FRACTION)
+  {
+    string_unshare(str);
+  }
 }
 
 // Makes sure that the length of the allocated string is at least new_len bytes
 // long, and if not, we reallocate more space for the string
 static inline void string_request_size(String *str, uint32_t new_len) {
+  if (new_len > str->allocated && !string_is_owned(str)) {
+    string_unshare(str);
+  }
   if (new_len > str->allocated) {
     do {
       str->allocated <<= 1;
     } while (new_len > str->allocated);
-    str->str_data = realloc(str->str_data, str->allocated);
+    str->str_data = region_realloc(str->str_data, str->allocated);
     if (str->str_data == NULL) {
       error("Unable to allocate additional space for string!");
     }
   }
 }
 
-// Returns a copy of a string
+// Makes sure a string has space for at least min_allocated bytes
+void string_reserve(String *str, uint32_t min_allocated) {
+  string_request_size(str, min_allocated);
+}
+
+// Returns a copy of a string, which for a view is another view of the same
+// characters unless they're foreign to where it's being made. Copies only
+// get as much space as their characters need
 String copy_string(const String *str) {
-  String new_str = {malloc(str->allocated), str->length, str->allocated};
+  if (str->shared != NULL && !string_is_foreign(str)) {
+    atomic_fetch_add(&str->shared->refs, 1);
+    return *str;
+  }
+  if (str->length <= 1) {
+    return small_string(str->str_data, str->length);
+  }
+  String new_str = {region_malloc(str->length), str->length, str->length, NULL};
   if (new_str.str_data == NULL) {
     error("Unable to allocate space for new string!");
   }
@@ -45,19 +173,31 @@ String copy_string(const String *str) {
 
 // Creates a String from a C string
 String create_string(const char *to_copy) {
-  size_t old_len = strlen(to_copy);
-  uint32_t new_len = STRING_INIT_SIZE;
-  while (new_len < old_len) {
-    new_len <<= 1;
+  return string_from_chars((const unsigned char *) to_copy, strlen(to_copy));
+}
+
+// Creates a String with a copy of the given characters
+String string_from_chars(const unsigned char *chars, uint32_t length) {
+  if (length <= 1) {
+    return small_string(chars, length);
   }
-  String str = {malloc(new_len), old_len, new_len};
+  String str = {region_malloc(length), length, length, NULL};
   if (str.str_data == NULL) {
     error("Unable to allocate space for new string!");
   }
-  memcpy(str.str_data, to_copy, old_len);
+  memcpy(str.str_data, chars, length);
   return str;
 }
 
+// Implements the djb2 hash function over a string
+uint32_t string_hash(const String *str) {
+  uint32_t hash_val = 5381;
+  for (uint32_t i = 0; i < str->length; i++) {
+    hash_val = ((hash_val << 5) + hash_val) + str->str_data[i];
+  }
+  return hash_val;
+}
+
 // Compares one string to another, returning a negative value if str1 is less
 // than str1, a positive value if str2 is greater, and 0 if they are equal
 int string_compare(const String *str1, const String *str2) {
@@ -77,6 +217,7 @@ int string_compare(const String *str1, const String *str2) {
 
 // Reverses a string in-place
 void string_reverse(String *str) {
+  string_unshare(str);
   for (uint32_t i = 0; i < str->length / 2; i++) {
     char temp = str->str_data[i];
     str->str_data[i] = str->str_data[str->length - i - 1];
@@ -93,9 +234,7 @@ void string_add_char(String *str, char c) {
 // Adds a string to the end of a string
 void string_add_str(String *str, const String *to_append) {
   string_request_size(str, str->length + to_append->length);
-  for (uint32_t i = 0; i < to_append->length; i++) {
-    str->str_data[str->length + i] = to_append->str_data[i];
-  }
+  memcpy(str->str_data + str->length, to_append->str_data, to_append->length);
   str->length += to_append->length;
 }
 
@@ -103,9 +242,7 @@ void string_add_str(String *str, const String *to_append) {
 void string_add_c_str(String *str, const char *to_append) {
   size_t append_len = strlen(to_append);
   string_request_size(str, str->length + append_len);
-  for (uint32_t i = 0; i < append_len; i++) {
-    str->str_data[str->length + i] = to_append[i];
-  }
+  memcpy(str->str_data + str->length, to_append, append_len);
   str->length += append_len;
 }
 
@@ -172,16 +309,16 @@ void string_step_over(String *str, Bigint step_size) {
   if (bigint_is_zero(&step_size)) {
     error("Step size of string select must be nonzero!");
   }
-  else if (step_size.is_negative) {
+  else if (bigint_is_negative(&step_size)) {
     string_reverse(str);
-    step_size.is_negative = false;
   }
   if (!bigint_fits_in_uint32(&step_size)) {
     str->length = min(str->length, 1);
     return;
   }
-  uint32_t step_int = bigint_to_uint32(&step_size);
+  uint32_t step_int = bigint_digit(&step_size, 0);
   if (step_int > 1) {
+    string_unshare(str);
     for (uint32_t i = 1; i * step_int < str->length; i++) {
       str->str_data[i] = str->str_data[i * step_int];
     }
@@ -189,24 +326,26 @@ void string_step_over(String *str, Bigint step_size) {
   }
 }
 
-// Splits a string into parts divided by a given seperator string
+// Splits a string into parts divided by a given seperator string. The parts
+// are views of the string rather than copies
 Item string_split(String *str, const String *sep) {
   Item arr = make_array();
-  Item cur_string = empty_string();
+  uint32_t part_start = 0;
 
   for (uint32_t i = 0; i < str->length; i++) {
     if (str->length - i > sep->length - 1 &&
         memcmp(str->str_data + i, sep->str_data, sep->length) == 0)
     {
-      array_push(&arr.arr_val, cur_string);
-      cur_string = empty_string();
+      Item part = make_string_from(string_view(str, part_start,
+                                               i - part_start));
+      array_push(arr.arr_val, part);
       i += sep->length - 1;
-    }
-    else {
-      string_add_char(&cur_string.str_val, str->str_data[i]);
+      part_start = i + 1;
     }
   }
-  array_push(&arr.arr_val, cur_string);
+  Item part = make_string_from(string_view(str, part_start,
+                                           str->length - part_start));
+  array_push(arr.arr_val, part);
   return arr;
 }
 
@@ -214,11 +353,9 @@ Item string_split(String *str, const String *sep) {
 // substrings of a given length
 Item string_split_into_groups(String *str, Bigint group_size) {
   Item array = make_array();
-  Item cur_string = empty_string();
 
-  if (group_size.is_negative) {
+  if (bigint_is_negative(&group_size)) {
     string_reverse(str);
-    group_size.is_negative = false;
   }
   else if (bigint_is_zero(&group_size)) {
     error("Cannot split string into groups of size 0!");
@@ -226,20 +363,16 @@ Item string_split_into_groups(String *str, Bigint group_size) {
 
   uint32_t group_len;
   if (bigint_fits_in_uint32(&group_size))
-    group_len = bigint_to_uint32(&group_size);
+    group_len = bigint_digit(&group_size, 0);
   else
     group_len = UINT32_MAX;
 
-  for (uint32_t i = 0; i < str->length; i++) {
-    string_add_char(&cur_string.str_val, str->str_data[i]);
-    if (cur_string.str_val.length == group_len) {
-      array_push(&array.arr_val, cur_string);
-      cur_string = empty_string();
-    }
-  }
-
-  if (cur_string.str_val.length > 0) {
-    array_push(&array.arr_val, cur_string);
+  uint32_t i = 0;
+  while (i < str->length) {
+    uint32_t length = min(group_len, str->length - i);
+    Item group = make_string_from(string_view(str, i, length));
+    array_push(array.arr_val, group);
+    i += length;
   }
 
   return array;
@@ -247,7 +380,7 @@ Item string_split_into_groups(String *str, Bigint group_size) {
 
 // Remove a certain number of characters from the start of a string
 void string_remove_from_front(String *str, Bigint to_remove) {
-  if (to_remove.is_negative || bigint_is_zero(&to_remove))
+  if (bigint_is_negative(&to_remove) || bigint_is_zero(&to_remove))
     return;
 
   if (!bigint_fits_in_uint32(&to_remove)) {
@@ -260,20 +393,46 @@ void string_remove_from_front(String *str, Bigint to_remove) {
     str->length = 0;
     return;
   }
+  string_drop_front(str, to_remove_int);
+}
 
-  str->length -= to_remove_int;
-
-  for (uint32_t i = 0; i < str->length; i++) {
-    str->str_data[i] = str->str_data[i + to_remove_int];
+// Removes the first characters of a string. Long strings become views, so
+// that the rest of the string doesn't have to be moved, which makes taking
+// a string apart from the front take linear time overall
+void string_drop_front(String *str, uint32_t to_drop) {
+  str->length -= to_drop;
+  if (str->shared == NULL && str->length >= VIEW_MIN_LENGTH) {
+    string_share(str);
   }
+  if (str->shared != NULL) {
+    str->str_data += to_drop;
+    string_check_view(str);
+  }
+  else {
+    memmove(str->str_data, str->str_data + to_drop, str->length);
+  }
+}
+
+// Keeps only the first new_len characters of a string
+void string_truncate(String *str, uint32_t new_len) {
+  str->length = min(str->length, new_len);
+  string_check_view(str);
 }
 
 Item string_join(String *str, String *sep) {
   Item joined_str = empty_string();
+  if (str->length > 0) {
+    uint64_t total_len = str->length +
+                         (uint64_t) sep->length * (str->length - 1);
+    if (total_len > UINT32_MAX) {
+      error("Unable to allocate space for string!");
+    }
+    string_reserve(joined_str.str_val, total_len);
+  }
   for (uint32_t i = 0; i < str->length; i++) {
-    string_add_char(&joined_str.str_val, str->str_data[i]);
+    string_add_char(joined_str.str_val, str->str_data[i]);
     if (i + 1 < str->length) {
-      string_add_str(&joined_str.str_val, sep);
+      string_add_str(joined_str.str_val, sep);
     }
   }
   return joined_str;
@@ -281,14 +440,17 @@ Item string_join(String *str, String *sep) {
 
 void map_string(String *str, Item *block) {
   Item mapped_str = empty_string();
+  Code *code = get_code(block->str_val);
   for (uint32_t i = 0; i < str->length; i++) {
     uint32_t start_stack_size = stack.length;
     stack_push(make_integer(str->str_data[i]));
-    execute_string(&block->str_val);
+    execute_code(code);
     for (uint32_t j = start_stack_size; j < stack.length; j++) {
+      item_expand(&stack.items[j]);
       Item new_item = stack.items[j];
       if (new_item.type == TYPE_INTEGER) {
-        string_add_char(&mapped_str.str_val, new_item.int_val.digits[0] & 255);
+        string_add_char(mapped_str.str_val,
+                        bigint_digit(&new_item.int_val, 0) & 255);
       }
       else {
         if (new_item.type == TYPE_BLOCK) {
@@ -300,25 +462,36 @@ void map_string(String *str, Item *block) {
     }
     stack.length = min(stack.length, start_stack_size);
   }
+  release_code(code);
   free_string(str);
-  *str = mapped_str.str_val;
+  *str = take_string(&mapped_str);
 }
 
 void fold_string(String *str, Item *block) {
+  if (native_fold_string(str, block)) {
+    return;
+  }
   if (str->length > 0) {
     stack_push(make_integer(str->str_data[0]));
+    Code *code = get_code(block->str_val);
     for (uint32_t i = 1; i < str->length; i++) {
       stack_push(make_integer(str->str_data[i]));
-      execute_string(&block->str_val);
+      execute_code(code);
     }
+    release_code(code);
   }
 }
 
 void filter_string(String *str, Item *block) {
+  string_unshare(str);
+  if (parallel_filter_string(str, block)) {
+    return;
+  }
   uint32_t chars_removed = 0;
+  Code *code = get_code(block->str_val);
   for (uint32_t i = 0; i < str->length; i++) {
     stack_push(make_integer(str->str_data[i]));
-    execute_string(&block->str_val);
+    execute_code(code);
     Item mapped_item = stack_pop();
     if (item_boolean(&mapped_item)) {
       str->str_data[i - chars_removed] = str->str_data[i];
@@ -328,11 +501,13 @@ void filter_string(String *str, Item *block) {
     }
     free_item(&mapped_item);
   }
+  release_code(code);
   str->length -= chars_removed;
 }
 
 // Sorts a string. Utilizes counting sort and runs in O(n) time
 void string_sort(String *str) {
+  string_unshare(str);
   uint32_t counts[256] = {0};
   for (uint32_t i = 0; i < str->length; i++) {
     counts[str->str_data[i]]++;
@@ -348,7 +523,7 @@ void string_sort(String *str) {
 
 // Repeats a string a given number of times
 void string_multiply(String *str, Bigint factor) {
-  if (factor.is_negative) {
+  if (bigint_is_negative(&factor)) {
     error("Cannot multiply array by a negative argument!");
   }
   if (!bigint_fits_in_uint32(&factor)) {
@@ -372,6 +547,7 @@ void string_multiply(String *str, Bigint factor) {
 
 // Removes the characters in to_subtract from str
 void string_subtract(String *str, const String *to_subtract) {
+  string_unshare(str);
   bool subtracted_chars[256] = {0};
   for (uint32_t i = 0; i < to_subtract->length; i++) {
     subtracted_chars[to_subtract->str_data[i]] = true;
@@ -391,6 +567,7 @@ void string_subtract(String *str, const String *to_subtract) {
 // Removes all characters from str that aren't in to_and, and removes
 // duplicate characters
 void string_setwise_and(String *str, const String *to_and) {
+  string_unshare(str);
   bool present_chars[256] = {0};
   for (uint32_t i = 0; i < to_and->length; i++) {
     present_chars[to_and->str_data[i]] = true;
@@ -410,6 +587,7 @@ void string_setwise_and(String *str, const String *to_and) {
 
 // Replaces str with the union of str and to_or
 void string_setwise_or(String *str, const String *to_or) {
+  string_unshare(str);
   bool present_chars[256] = {0};
   uint32_t chars_removed = 0;
   for (uint32_t i = 0; i < str->length; i++) {
@@ -432,6 +610,7 @@ void string_setwise_or(String *str, const String *to_or) {
 
 // Replaces str with the setwise symmetric difference of str and to_xor
 void string_setwise_xor(String *str, const String *to_xor) {
+  string_unshare(str);
   bool in_string1[256] = {0};
   bool in_string2[256] = {0};
   for (uint32_t i = 0; i < to_xor->length; i++) {
@@ -34,6 +34,15 @@
 # Folding over an array with a block
 ["3" 2 "5" {4} [6] 7] {+} * {325 4 6 7} = print
 
+# Folding with blocks that are a single builtin
+[1 -2 3 4] {*} * -24 = print
+["ab" "" "cd"] {+} * "abcd" = print
+[[1] [2 3]] {+} * [1 2 3] = print
+[1 "a"] {+} * "1a" = print
+100, {+} * 4950 = print
+100, 1> {*} * 99, {1+} % {*} * = print
+"abc" {^} * 96 = print
+
 # Folding over a string with a block
 "abcdef" {*9-} * 968587765155 = print
 
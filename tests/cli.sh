@@ -0,0 +1,219 @@
+#!/bin/sh
+# tests/cli.sh
+# Runs scripts with each of the interpreter's command-line options, and
+# checks that they output the same thing and exit with the same status as
+# the plain interpreter does. Prints a 1 for each check that passes and a 0
+# for each one that doesn't, and exits with status 1 if any didn't
+
+golf=${GOLF:-./golf}
+cc=${CC:-cc}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+failed=0
+
+# Runs a command, outputting what it writes followed by its exit status
+run() {
+  "$@" 2>&1
+  echo "exit $?"
+}
+
+# Passes if the first two arguments are the same, naming the check with the
+# third if they aren't
+check() {
+  if [ "$1" = "$2" ]; then
+    echo 1
+  else
+    echo "0 $3"
+    failed=1
+  fi
+}
+
+# Runs a script on each piece of input given after it, one at a time, the
+# way --lines should
+run_each() {
+  script=$1
+  shift
+  for piece in "$@"; do
+    printf '%s' "$piece" | "$golf" --run "$script" 2>&1
+  done
+  echo "exit 0"
+}
+
+# Runs a script on each piece of input the same way, except that it first
+# runs on the pieces before inside brackets it throws away, so that it has
+# what was assigned on them the way --keep-definitions should
+run_kept() {
+  script=$1
+  shift
+  before=
+  for piece in "$@"; do
+    printf '%s' "$piece" | "$golf" --run "$before$script" 2>&1
+    before="$before['$piece'$script];"
+  done
+  echo "exit 0"
+}
+
+# Runs the plain interpreter on a script and the same script with an option,
+# with the same input
+check_option() {
+  option=$1
+  script=$2
+  check "$(run "$golf" $option "$script" </dev/null)" \
+        "$(run "$golf" "$script" </dev/null)" "$option $script"
+}
+
+# Scripts that run the same code over and over, which --jit compiles, and
+# compiles again once something's been assigned
+cat >"$dir/loops.gs" <<'EOF'
+0 100000{.2%{1+}{3+}if}*
+0 50000{.5%!{1}{2}if+}/
+{.0>{1-f}{}if}:f;5000 f
+[1 2 3 4]{.;}%{\}*
+{1+}:f;0 100{f}*p {2+}:f; 100{f}*p 5:z; 100{f}*p
+0 100{\.@+7%}*;; 5:z; 0 1 3000{\.@+7%}*p;
+EOF
+: >"$dir/empty.gs"
+scripts="tests/*.gs $dir/loops.gs $dir/empty.gs"
+
+# --lines, --delimiter and --keep-definitions
+printf 'a b\nc d e\n\nf' >"$dir/lines"
+check "$(run "$golf" --lines --run '" "/,' <"$dir/lines")" \
+      "$(run_each '" "/,' 'a b' 'c d e' '' 'f')" "--lines"
+printf 'a,b;c;;d,e,f;' >"$dir/fields"
+check "$(run "$golf" --delimiter ';' --run '","/,' <"$dir/fields")" \
+      "$(run_each '","/,' 'a,b' 'c' '' 'd,e,f')" "--delimiter ;"
+printf 'ab\tc' >"$dir/tabs"
+check "$(run "$golf" --delimiter '\t' --run '.+' <"$dir/tabs")" \
+      "$(run_each '.+' 'ab' 'c')" "--delimiter \\t"
+printf 'x\0yz\0' >"$dir/nuls"
+check "$(run "$golf" --delimiter '\0' --run ',' <"$dir/nuls")" \
+      "$(run_each ',' 'x' 'yz')" "--delimiter \\0"
+
+printf 'a\nb\nc\n' >"$dir/keep"
+check "$(run "$golf" --lines --keep-definitions --run '[x]\:x;' <"$dir/keep")" \
+      "$(run_kept '[x]\:x;' 'a' 'b' 'c')" "--keep-definitions"
+check "$(run "$golf" --lines --run '[x]\:x;' <"$dir/keep")" \
+      "$(run_each '[x]\:x;' 'a' 'b' 'c')" "--lines without definitions"
+
+# --jit, --async-output and --threads
+for script in $scripts; do
+  check_option --jit "$script"
+  check_option --async-output "$script"
+  check_option '--threads 4' "$script"
+done
+printf '100000,{p}/' >"$dir/output.gs"
+check_option --async-output "$dir/output.gs"
+
+# --compile, with the bytecode run in place of the script, and --cache,
+# which runs it from __golfcache__ the second time without writing it again
+for script in $scripts; do
+  "$golf" --compile "$dir/compiled.gsc" "$script"
+  check "$(run "$golf" "$dir/compiled.gsc" </dev/null)" \
+        "$(run "$golf" "$script" </dev/null)" "--compile $script"
+  cp "$script" "$dir/cached.gs"
+  rm -rf "$dir/__golfcache__"
+  check "$(run "$golf" --cache "$dir/cached.gs" </dev/null)" \
+        "$(run "$golf" "$script" </dev/null)" "--cache $script"
+  touch "$dir/cached"
+  check "$(run "$golf" --cache "$dir/cached.gs" </dev/null)" \
+        "$(run "$golf" "$script" </dev/null)" "--cache $script again"
+  check "$(find "$dir/__golfcache__" -newer "$dir/cached")" "" \
+        "--cache $script rewritten"
+done
+check "$(ls "$dir/__golfcache__" | wc -l | tr -d ' ')" 1 "__golfcache__"
+
+# --save-image and --image, where starting from an image is the same as
+# running the script it was saved from first, with its input under it
+check_image() {
+  "$golf" --save-image "$dir/image" --run "$1" </dev/null
+  check "$(run "$golf" --image "$dir/image" --run "$2" </dev/null)" \
+        "$(run "$golf" --run "$1''$2" </dev/null)" "--image $1 then $2"
+}
+check_image '{1+}:inc; 5' 'inc'
+check_image '[1 "ab" {2*}]:x; 10,' 'x~~\;+'
+check_image '"\n":n; 1 2 3' '++ n'
+
+# --max-steps and --timeout, which stop a script with status 124 once it
+# goes past them, and leave one that doesn't alone
+check "$(run "$golf" --max-steps 1000 --run '{1}{}while' </dev/null)" \
+      "Error! Exceeded the limit of 1000 steps!
+exit 124" "--max-steps"
+check "$(run "$golf" --max-steps 1000 --run '10000,{+}*' </dev/null)" \
+      "Error! Exceeded the limit of 1000 steps!
+exit 124" "--max-steps with a native fold"
+check "$(run "$golf" --timeout 100 --run '{1}{}while' </dev/null)" \
+      "Error! Exceeded the time limit of 100 milliseconds!
+exit 124" "--timeout"
+check "$(run "$golf" --timeout 100 --run '2 200000?' </dev/null)" \
+      "Error! Exceeded the time limit of 100 milliseconds!
+exit 124" "--timeout in a builtin"
+check "$(run "$golf" --timeout 100 --run '100000000,' </dev/null |
+         sed 's/^[0-9]*//')" \
+      "Error! Exceeded the time limit of 100 milliseconds!
+exit 124" "--timeout while outputting"
+for script in $scripts; do
+  check_option '--max-steps 100000000' "$script"
+  check_option '--timeout 100000' "$script"
+done
+
+# Corrupt bytecode and images are turned down, whether they're cut short
+# or have any one byte changed. A change that still makes a valid file
+# gives some other program, which can't be told apart from one that was
+# compiled, so it only has to run without crashing
+printf '{1+}:inc; [1 "ab" {2*}] 5 inc' >"$dir/small.gs"
+"$golf" --compile "$dir/small.gsc" "$dir/small.gs"
+"$golf" --save-image "$dir/small.image" "$dir/small.gs" </dev/null
+head -c 40 "$dir/small.gsc" >"$dir/short.gsc"
+check "$(run "$golf" "$dir/short.gsc")" \
+      "Error! '$dir/short.gsc' isn't bytecode this version can run!
+exit 1" "short bytecode"
+head -c 40 "$dir/small.image" >"$dir/short.image"
+check "$(run "$golf" --image "$dir/short.image" --run '' </dev/null)" \
+      "Error! The image '$dir/short.image' is corrupt!
+exit 1" "short image"
+
+# Runs a corrupt copy of a file, failing if it crashed
+run_corrupt() {
+  if [ "$1" = gsc ]; then
+    "$golf" --max-steps 100000 "$dir/corrupt.gsc" </dev/null >/dev/null 2>&1
+  else
+    "$golf" --max-steps 100000 --image "$dir/corrupt.image" --run '' \
+            </dev/null >/dev/null 2>&1
+  fi
+  status=$?
+  if [ $status -ne 0 ] && [ $status -ne 1 ] && [ $status -ne 124 ]; then
+    echo "crashed with status $status"
+  fi
+}
+for kind in gsc image; do
+  file=$dir/small.$kind
+  size=$(wc -c <"$file")
+  crashes=
+  offset=0
+  while [ $offset -lt "$size" ]; do
+    for byte in '\000' '\001' '\377'; do
+      cp "$file" "$dir/corrupt.$kind"
+      printf "$byte" | dd of="$dir/corrupt.$kind" bs=1 seek=$offset \
+                          conv=notrunc 2>/dev/null
+      crashes=$crashes$(run_corrupt $kind)
+    done
+    head -c $offset "$file" >"$dir/corrupt.$kind"
+    crashes=$crashes$(run_corrupt $kind)
+    offset=$((offset + 1))
+  done
+  check "$crashes" "" "corrupt $kind"
+done
+
+# --emit-c, with the C built with libgolf.a from make lib
+if [ -f libgolf.a ]; then
+  for script in $scripts; do
+    rm -f "$dir/emitted"
+    "$golf" --emit-c "$dir/emitted.c" "$script" &&
+      $cc -O1 -std=c11 -pthread -I. "$dir/emitted.c" libgolf.a \
+          -o "$dir/emitted"
+    check "$(run "$dir/emitted" </dev/null)" \
+          "$(run "$golf" "$script" </dev/null)" "--emit-c $script"
+  done
+fi
+
+exit $failed
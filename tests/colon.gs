@@ -3,6 +3,17 @@
 "A testing program for golfscript. Tests the behavior of the : operator." puts
 "1's indicate passed tests." puts
 
+# Assigning to builtins that code has already been compiled to use
+{5 3+ 2)}:f;
+{-}:+;
+{;7}:);
+[f] [2 7] = print
+[1 2 3+ 4)] [1 -1 7] = print
+
+# Assigning to a builtin between runs of a block that's already used it
+{2 3<}:g;
+[g {>}:<; g] [1 0] = print
+
 # Assigning to an identifier
 1:one;
 0 one print
@@ -7,6 +7,9 @@
 10 , [0 1 2 3 4 5 6 7 8 9] = print
 0 , [] = print
 -10 , [] = print
+100000000 , -1 = 99999999 = print
+10 , 3 > 2 < [3 4] = print
+10 , 5 < 10 , 5 > + 10 , = print
 
 # Getting the size of an array or string
 [] , 0 = print
@@ -21,5 +24,7 @@
 "" {88 *} , [] = print
 {0 1 2 3 4 5 6 7} {32 >} , {01234567} = print
 {} {0p} , {} = print
+5000, {7%!} , 715, {7*} % = print
+"abc" 2000 * {98 >} , "c" 2000 * = print
 
 n
@@ -22,6 +22,10 @@
 ["1" "11" [49 49 49] {1111} "11111" "ab" [97 98 99] "abcd"] = print
 [27 62652 8326735 733 -283 82752 81 0 -2723 -373 -4726 376] $
 [-4726 -2723 -373 -283 0 27 81 376 733 62652 82752 8326735] = print
+[9 8 7 6 5 4 3 2 1 0 9 8 7 6 5 4 3 2 1 0] $
+[0 0 1 1 2 2 3 3 4 4 5 5 6 6 7 7 8 8 9 9] = print
+[5 -1 300 4 3 2 1 0 9 8 7 6 5 4 3 2] $
+[-1 0 1 2 2 3 3 4 4 5 5 6 7 8 9 300] = print
 
 # Sorting by a mapping
 [1982 52653 7387 516728 9383 67353 -12673 0 236 -9262] {-1*} $
@@ -10,9 +10,12 @@
 
 # Arrays
 [1 2 3 4 5] ( ] [[2 3 4 5] 1] = print
+[20 , {2 *} % ( \ ( ] [0 20 , 2 > {2 *} % 2] = print
+100 , {(;} 95 * 100 + [95 96 97 98 99 100] = print
 
 # Strings
 "abcd" ( ] ["bcd" 97] = print
+"abc" 30 * {(;} 60 * "abc" 10 * = print
 
 # Blocks
 {abcd} ( ] [{bcd} 97] = print
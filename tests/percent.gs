@@ -34,4 +34,10 @@
 # Mapping over a string with a block
 "abcdefgh" {.} % "aabbccddeeffgghh" = print
 
+# Chains of mapping, filtering and folding
+100,{7%!},{3*}%{+}* 2205 = print
+["a" "b"]{.}%{+}* "aabb" = print
+[5 [1 2]{1$}%{+}*] [5 13] = print
+2,{;"hello" -1%}% ["olleh" "olleh"] = print
+
 n
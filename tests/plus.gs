@@ -46,4 +46,14 @@
 "abc 0 1    2" {1 2 4} + {abc 0 1    2 1 2 4} = print
 {1 2 4} "abc 0 1    2" + {1 2 4 abc 0 1    2} = print
 
+# Folded constants
+2 3+ 4- 5* 5 = print
+"ab" "cd"+ "e"+ "abcde" = print
+5[.+] [10] = print
+
+# Long strings built up a piece at a time
+"" 400,{`+}/ 400,""* = print
+"" 400,{`\+}/ 400,-1%""* = print
+"a"600* "b"600* + "c"600* \+ "c"600* "a"600* "b"600* ++ = print
+
 n
@@ -0,0 +1,38 @@
+;
+
+"A testing program for golfscript. Tests the behavior of n, puts, p, and, or and xor." puts
+"1's indicate passed tests." puts
+
+# and
+[1 2 and 0 2 and 1 0 and 0 0 and] [2 0 0 0] = print
+[1 {2} and] [2] = print
+[0 {2} and] [0] = print
+
+# or
+[1 2 or 0 2 or 1 0 or 0 0 or] [1 2 1 0] = print
+["a" [] or [] "b" or] ["a" "b"] = print
+
+# xor
+[1 2 xor 0 2 xor 1 0 xor 0 0 xor] [0 2 1 0] = print
+["" [1] xor] [[1]] = print
+
+# Brackets moving as the words pop
+[1 [2 and]] [[2]] = print
+[1 [2 or]] [[1]] = print
+[1 [2 xor]] [[0]] = print
+
+# n
+n "\n" = print
+[n n+] ["\n\n"] = print
+
+# The words are still made of whatever they're written in
+{;5}:!;
+[1 2 xor] [5] = print
+{;;2}:if;
+[0 1 and] [0 2] = print
+{"1"}:n;
+[n] ["1"] = print
+
+# p, which outputs what ` gives with puts
+{:x;}:puts;
+"p" p x "\"p\"" = print
@@ -31,5 +31,8 @@
 "abcdefghijkl" {111 =} ? ] [] = print
 {99 =}  {abcdefghijkl} ? 99 = print
 {111 =} {abcdefghijkl} ? ] [] = print
+5000, {.*4000000>} ? 2001 = print
+5000, {5000>} ? ] [] = print
+"ab" 3000 * {98 =} ? 98 = print
 
 n
@@ -13,6 +13,8 @@
 [[1 2 [3]] "a" "b" {1} [1 2] "?" 0 1 "2" 4] 3 /
 [[[1 2 [3]] "a" "b"] [{1} [1 2] "?"] [0 1 "2"] [4]] = print
 [1 2 [3 4] 5 {6} {7 8} [9]] -2 / [[[9] {7 8}] [{6} 5] [[3 4] 2] [1]] = print
+40,{}% 20 / $ [20,{}% 20,{20+}%] = print
+40,{}% 20 / [20,{}%] - [20,{20+}%] = print
 
 # Splitting a string into groups
 "abcdefghij" 3 / ["abc" "def" "ghi" "j"] = print
@@ -20,6 +22,8 @@
 
 # Split a string based on a delimiter
 "1, 2,3 , , , 4 5, " ", " / ["1" "2,3 " "" "" "4 5" ""] = print
+"ab cd ef" " " / {-1 %} % ["ba" "dc" "fe"] = print
+["ab cd ef" . " " / 0 = "!" +] ["ab cd ef" "ab!"] = print
 
 # Splitting an array with an array
 ["a" "b" "b" "a" "b" "b" "b" "a" "a" "b"] ["a" "b"] /
@@ -27,6 +31,7 @@
 
 # Splitting a string with an array
 "abbababbbabbab" [97 98] / [[] [98] [] [98 98] [98] []] = print
+"aaaaaaaaaaaaaaaaaaaa aaaaaaaaaaaaaaaaaaaa" [32] / ""* 40,{;97}% = print
 
 # Executing a block over an array
 [1 "abcd" [1 "abc"] {100} 0 -1] {2*} / ]
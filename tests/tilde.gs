@@ -21,4 +21,8 @@
 5 {.*} ~ 25 = print
 1 {} ~ print
 
+# Blocks that run themselves deeper than the C stack goes
+{.{({f}~}{}if}:f; 200000 f 0 = print
+{.{.(g+}{}if}:g; 200000 g 20000100000 = print
+
 n